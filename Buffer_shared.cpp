@@ -15,6 +15,28 @@ GlobalHitBuffer& GlobalHitBuffer::operator+=(const GlobalHitBuffer& src) {
 	return *this;
 }
 
+/**
+* \brief Appends the hit and leak histories of another counter after this one's, oldest first
+ * Unlike a tracer's fresh local counter, src may have turned over already, so its histories are read from their oldest valid entry
+ * \param src counter whose histories are appended, already circular (such as a partial sum of several threads)
+ */
+void GlobalHitBuffer::AppendCaches(const GlobalHitBuffer& src) {
+	if (src.hitCacheSize > 0) {
+		size_t first = (src.lastHitIndex + HITCACHESIZE - src.hitCacheSize) % HITCACHESIZE;
+		for (size_t i = 0; i < src.hitCacheSize; i++)
+			hitCache[(lastHitIndex + i) % HITCACHESIZE] = src.hitCache[(first + i) % HITCACHESIZE];
+		lastHitIndex = (lastHitIndex + src.hitCacheSize) % HITCACHESIZE;
+		hitCache[lastHitIndex] = src.hitCache[src.lastHitIndex]; //pen-up marker closing src's last block of hits
+		hitCacheSize = std::min(HITCACHESIZE, hitCacheSize + src.hitCacheSize);
+	}
+
+	size_t firstLeak = (src.lastLeakIndex + LEAKCACHESIZE - src.leakCacheSize) % LEAKCACHESIZE;
+	for (size_t i = 0; i < src.leakCacheSize; i++)
+		leakCache[(lastLeakIndex + i) % LEAKCACHESIZE] = src.leakCache[(firstLeak + i) % LEAKCACHESIZE];
+	lastLeakIndex = (lastLeakIndex + src.leakCacheSize) % LEAKCACHESIZE;
+	leakCacheSize = std::min(LEAKCACHESIZE, leakCacheSize + src.leakCacheSize);
+}
+
 #if defined(MOLFLOW)
 /**
 * \brief += operator, with simple += of underlying structures
@@ -26,7 +26,8 @@
 
 enum AccelType : int {
     BVH = 0,
-    KD = 1
+    KD = 1,
+    WideBVH = 2 // BVH collapsed to SimulationModel::wideBVHWidth children per node
 };
 
 class HistogramParams {
@@ -403,8 +404,9 @@ public:
 
 	size_t desorptionLimit = 0;
 	double	 timeLimit = 0.0;
+	size_t accelRebuildDes = 0; // rebuild the accel structure with facet hit probabilities once this many molecules are desorbed, 0=never
 
-	template<class Archive> void serialize(Archive& archive) {
+	template<class Archive> void serialize(Archive& archive, const std::uint32_t version) {
 		archive(
 #if defined(SYNRAD)
 			CEREAL_NVP(generation_mode),
@@ -417,9 +419,13 @@ public:
 			CEREAL_NVP(desorptionLimit),
 			CEREAL_NVP(timeLimit)
 		);
+		if (version >= 1) { //absent from version 0 archives, left at 0 (never rebuild)
+			archive(CEREAL_NVP(accelRebuildDes));
+		}
 	}
 
 }; //parameters that can be changed without restarting the simulation
+CEREAL_CLASS_VERSION(OntheflySimulationParams, 1); //1: accelRebuildDes
 
 class HIT {
 public:
@@ -584,6 +590,7 @@ class GlobalHitBuffer { //Should be plain old data, memset applied
 public:
 
 	GlobalHitBuffer& operator+=(const GlobalHitBuffer& src);
+	void AppendCaches(const GlobalHitBuffer& src);
 	GlobalHitBuffer()=default; //required for move constructor of globalsimustate
 
 	FacetHitBuffer globalHits;		//Global counts (as if the whole geometry was one extra facet)
@@ -38,6 +38,17 @@ bool RTFacet::Intersect(Ray &ray) {
     if ((this->sh.is2sided) || (det > 0.0)) { //If 2-sided or if ray going opposite facet normal
 
         double u, v, d;
+        if (shape == FacetShape::Triangle) {
+            double b1, b2;
+            if (IntersectTriangle(triP0, triE1, triE2, ray, d, b1, b2)) {
+                // (u,v) is linear on the facet plane, so interpolate the vertex coordinates
+                u = vertices2[0].u + b1 * (vertices2[1].u - vertices2[0].u) + b2 * (vertices2[2].u - vertices2[0].u);
+                v = vertices2[0].v + b1 * (vertices2[1].v - vertices2[0].v) + b2 * (vertices2[2].v - vertices2[0].v);
+                return RegisterHit(ray, d, u, v);
+            }
+            return false;
+        }
+
         // Ray/rectangle instersection. Find (u,v,dist) and check 0<=u<=1, 0<=v<=1, dist>=0
 
         if (det != 0.0) {
@@ -62,19 +73,9 @@ bool RTFacet::Intersect(Ray &ray) {
                     if (d>0.0) {
 
                         // Now check intersection with the facet polygon (in the u,v space)
-                        // This check could be avoided on rectangular facet.
-                        if (IsInPoly(u, v, vertices2)) {
-                            bool hardHit = this->surf->IsHardHit(ray);
-                            if (hardHit) {
-                                if (d < ray.tMax) {
-                                    ray.tMax = d;
-                                    ray.hardHit = HitDescriptor(globalId, FacetHitDetail(d,u,v,true));
-                                }
-                            }
-                            else {
-                                ray.transparentHits.emplace_back(globalId, FacetHitDetail(d,u,v,false));
-                            }
-                            return hardHit;
+                        // Not needed when the polygon is the whole rectangle
+                        if (shape == FacetShape::Parallelogram || IsInPolygon(u, v)) {
+                            return RegisterHit(ray, d, u, v);
                         } // IsInFacet
                     } // d range
                 } // u range
@@ -83,4 +84,62 @@ bool RTFacet::Intersect(Ray &ray) {
     } // dot<0
 
     return false;
-}
\ No newline at end of file
+}
+
+bool RTFacet::RegisterHit(Ray &ray, double d, double u, double v) const {
+    bool hardHit = this->surf->IsHardHit(ray);
+    if (hardHit) {
+        if (d < ray.tMax) {
+            ray.tMax = d;
+            ray.hardHit = HitDescriptor(globalId, FacetHitDetail(d,u,v,true));
+        }
+    }
+    else {
+        ray.transparentHits.emplace_back(globalId, FacetHitDetail(d,u,v,false));
+    }
+    return hardHit;
+}
+
+/**
+* \brief Selects the intersection test from the polygon, to be called whenever vertices2 or the (O,U,V) basis change
+ */
+void RTFacet::InitShape() {
+    shape = FacetShape::Polygon;
+    if (vertices2.size() == 3) {
+        // Vertices as the polygon test sees them, mapped back from the (u,v) space
+        triP0 = sh.O + vertices2[0].u * sh.U + vertices2[0].v * sh.V;
+        triE1 = sh.O + vertices2[1].u * sh.U + vertices2[1].v * sh.V - triP0;
+        triE2 = sh.O + vertices2[2].u * sh.U + vertices2[2].v * sh.V - triP0;
+        shape = FacetShape::Triangle;
+    }
+    else if (vertices2.size() == 4) {
+        // Rectangle in (u,v) space: every vertex on a corner and every edge along u or v
+        const double tolerance = 1E-9;
+        auto isCorner = [tolerance](double x) { return std::abs(x) < tolerance || std::abs(x - 1.0) < tolerance; };
+        bool fillsRectangle = true;
+        for (size_t j = 0; j < 4 && fillsRectangle; ++j) {
+            const Vector2d& p1 = vertices2[j];
+            const Vector2d& p2 = vertices2[Next(j, 4)];
+            const bool sameU = std::abs(p1.u - p2.u) < tolerance;
+            const bool sameV = std::abs(p1.v - p2.v) < tolerance;
+            fillsRectangle = isCorner(p1.u) && isCorner(p1.v) && (sameU != sameV);
+        }
+        if (fillsRectangle)
+            shape = FacetShape::Parallelogram;
+    }
+}
+
+/**
+* \brief Builds the cell grid that speeds up IsInPolygon() for polygons with at least POLY_GRID_MIN_VERTICES vertices
+ */
+void RTFacet::InitPolyGrid() {
+    if (shape == FacetShape::Polygon && vertices2.size() >= POLY_GRID_MIN_VERTICES)
+        polyGrid = std::make_shared<PolyGrid>(vertices2);
+    else
+        polyGrid.reset();
+}
+
+//! Point in polygon test in (u,v) space, through the cell grid if there is one
+bool RTFacet::IsInPolygon(double u, double v) const {
+    return polyGrid ? polyGrid->Contains(u, v) : IsInPoly(u, v, vertices2);
+}
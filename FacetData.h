@@ -46,6 +46,35 @@ public:
 };
 #endif
 
+//! Intersection test used for a facet, selected from its polygon by RTFacet::InitShape()
+enum class FacetShape : uint8_t {
+    Polygon, // u,v solve on the (O,U,V) rectangle, then IsInPoly
+    Triangle, // Moller-Trumbore on the 3D triangle, no polygon test
+    Parallelogram // polygon fills the whole (O,U,V) rectangle, no polygon test
+};
+
+/**
+* \brief Moller-Trumbore ray/triangle test, for the triangle p0, p0+e1, p0+e2
+ * \return true if hit with d>0, b1 and b2 being the barycentric coordinates of the hit point along e1 and e2
+ */
+inline bool IntersectTriangle(const Vector3d &p0, const Vector3d &e1, const Vector3d &e2, const Ray &ray,
+                              double &d, double &b1, double &b2) {
+    Vector3d pvec = CrossProduct(ray.direction, e2);
+    double det = Dot(e1, pvec);
+    if (det == 0.0) return false;
+    double iDet = 1.0 / det;
+    Vector3d tvec = ray.origin - p0;
+    b1 = iDet * Dot(tvec, pvec);
+    if (b1 < 0.0 || b1 > 1.0) return false;
+    Vector3d qvec = CrossProduct(tvec, e1);
+    b2 = iDet * Dot(ray.direction, qvec);
+    if (b2 < 0.0 || b1 + b2 > 1.0) return false;
+    d = iDet * Dot(e2, qvec);
+    return d > 0.0;
+}
+
+class PolyGrid;
+
 /**
 * \brief Polygon class (standard facet) that extends the Ray Tracing primitive containing various components for the post-processing features (hit tracking)
  */
@@ -62,7 +91,18 @@ public:
 
     size_t globalId=0; //Global index (to identify when superstructures are present)
 
+    // Triangle shape only: first vertex and the edges to the second and third vertex, in 3D
+    FacetShape shape = FacetShape::Polygon;
+    Vector3d triP0, triE1, triE2;
+
+    std::shared_ptr<PolyGrid> polyGrid; // Polygon shape with many vertices only, see InitPolyGrid()
+
     void ComputeBB() { bb = sh.bb;};
+    void InitShape();
+    void InitPolyGrid();
+    bool IsInPolygon(double u, double v) const;
     bool Intersect(Ray &r) override;
+    // Registers a hit at distance d and facet coordinates (u,v) on the ray, returns true if it was a hard hit
+    bool RegisterHit(Ray &ray, double d, double u, double v) const;
 
 };
@@ -1,12 +1,30 @@
 
 #include "File.h"
 #include "GLApp/GLTypes.h"
+#include <charconv>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib> //strtod
 #include <cstring> //strcpy, etc.
 #include <filesystem>
 #include <sstream>
+#include <type_traits>
 #include <fstream>
 #include <fmt/core.h>
 
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #define MAX_WORD_LENGTH 65536 // expected length of the longest line
 
 // FileUtils class
@@ -21,49 +39,29 @@ bool FileUtils::Exist(const char *fileName) {
 
 // FileReader class
 
-FileReader::FileReader(const char *fileName) : fileName{}, readBuffer{} {
+FileReader::FileReader(const char *fileName) : mappedFile(fileName), fileName{} {
     wasLineEnd = false;
-    nbLeft = 0;
     buffPos = 0;
 
-    file = fopen(fileName, "r");
-    if (!file) {
-        char tmp[512];
-        sprintf(tmp, "Cannot open file for reading (%s)", fileName);
-        throw Error(tmp);
-    }
-
     curLine = 1;
     strcpy(this->fileName, fileName);
-    isEof = 0;
+    isEof = (mappedFile.Size() == 0);
     CurrentChar = ' ';
 
     peekedKeyword = false;
     bufferedKeyword = nullptr;
-    RefillBuffer();
-}
-
-void FileReader::RefillBuffer() {
-
-    if (!isEof) {
-        nbLeft = (int) fread(readBuffer, 1, READ_BUFFSIZE, file);
-        isEof = (nbLeft == 0);
-    }
-    buffPos = 0;
 }
 
 char FileReader::ReadChar() {
 
-    if (buffPos >= nbLeft)
-        RefillBuffer();
-
-    if (!isEof) {
-        CurrentChar = readBuffer[buffPos++];
+    if (buffPos < mappedFile.Size()) {
+        CurrentChar = mappedFile.Data()[buffPos++];
         if (CurrentChar == '\n') {
             curLine++;
             wasLineEnd = true;
         }
     } else {
+        isEof = 1;
         CurrentChar = 0;
     }
 
@@ -80,15 +78,40 @@ int FileReader::GetCurrentLine() const { return curLine; }
 
 const char *FileReader::GetName() { return fileName; }
 
-FileReader::~FileReader() { fclose(file); }
+FileReader::~FileReader() = default;
 
 std::string FileReader::MakeError(const std::string& msg) const {
     return fmt::format("{} (line {}",msg, curLine);
 }
 
+/**
+* \brief Parses the next word as a number directly in the mapped file, without copying it
+ * \return false, with the read position unchanged, if the word isn't entirely a number of type T: the caller then falls back to sscanf
+ */
+template<typename T>
+bool FileReader::ParseNumber(T& value) {
+    if (peekedKeyword) return false;
+    JumpControlChars();
+    if (isEof) return false;
+    const char* begin = mappedFile.Data() + buffPos - 1; //CurrentChar
+    const char* end = mappedFile.Data() + mappedFile.Size();
+    const char* wordEnd = begin;
+    while (wordEnd < end && *wordEnd > 32 && *wordEnd != ':' && *wordEnd != '{' && *wordEnd != '}' && *wordEnd != ',')
+        wordEnd++;
+    const char* numberBegin = (*begin == '+') ? begin + 1 : begin; //accepted by sscanf, not by from_chars
+    std::from_chars_result result;
+    if constexpr (std::is_floating_point_v<T>) result = FileUtils::FromChars(numberBegin, wordEnd, value);
+    else result = std::from_chars(numberBegin, wordEnd, value);
+    if (result.ec != std::errc() || result.ptr != wordEnd) return false;
+    buffPos = wordEnd - mappedFile.Data();
+    ReadChar(); //delimiter after the word, as after ReadWord()
+    return true;
+}
+
 int FileReader::ReadInt() {
 
     int ret;
+    if (ParseNumber(ret)) return ret;
     char *w = ReadWord();
     if (sscanf(w, "%d", &ret) <= 0)
         throw Error(MakeError("Wrong integer format"));
@@ -98,6 +121,7 @@ int FileReader::ReadInt() {
 size_t FileReader::ReadSizeT() {
 
     size_t ret;
+    if (ParseNumber(ret)) return ret;
     char *w = ReadWord();
     if (sscanf(w, "%zd", &ret) <= 0) {
         throw Error(MakeError("Wrong integer64 format"));
@@ -108,6 +132,7 @@ size_t FileReader::ReadSizeT() {
 double FileReader::ReadDouble() {
 
     double ret;
+    if (ParseNumber(ret)) return ret;
     char *w = ReadWord();
     if (sscanf(w, "%lf", &ret) <= 0) {
         throw Error(MakeError("Wrong double format"));
@@ -115,6 +140,12 @@ double FileReader::ReadDouble() {
     return ret;
 }
 
+void FileReader::ReadDoubles(size_t n, double* out) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = ReadDouble();
+    }
+}
+
 char *FileReader::ReadString() {
     static char retStr[MAX_WORD_LENGTH];
 
@@ -162,10 +193,9 @@ bool FileReader::PeekKeyword(const char *keyword) {
 }
 
 void FileReader::SeekStart() {
-    fseek(file, 0L, SEEK_SET);
-    isEof = 0;
+    buffPos = 0;
+    isEof = (mappedFile.Size() == 0);
     curLine = 1;
-    RefillBuffer();
     CurrentChar = ' ';
 }
 
@@ -190,7 +220,7 @@ bool FileReader::SeekForInline(const char *keyword) {
     char *w;
     char *res;
     bool notFound = true;
-    int oldbuffPos;
+    size_t oldbuffPos;
     do {
         oldbuffPos = buffPos;
         w = ReadWord();
@@ -560,15 +590,97 @@ std::string FileUtils::exec(const char* cmd) { //Execute a command and return wh
     return result;
 }
 
+MappedFile::MappedFile(const std::string& fileName) {
+#ifdef _WIN32
+    fileHandle = CreateFileW(std::filesystem::path(fileName).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                             OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+        fileHandle = nullptr;
+        throw Error("Cannot open file for reading ({})", fileName);
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize)) {
+        CloseHandle(fileHandle);
+        throw Error("Cannot get size of file {}", fileName);
+    }
+    size = static_cast<size_t>(fileSize.QuadPart);
+    if (size == 0) return;
+    mappingHandle = CreateFileMapping(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mappingHandle) data = static_cast<const char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    if (!data) {
+        if (mappingHandle) CloseHandle(mappingHandle);
+        CloseHandle(fileHandle);
+        throw Error("Cannot map file {} to memory", fileName);
+    }
+#else
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw Error("Cannot open file for reading ({})", fileName);
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0) {
+        close(fd);
+        throw Error("Cannot get size of file {}", fileName);
+    }
+    size = static_cast<size_t>(fileStat.st_size);
+    if (size > 0) {
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close(fd);
+            throw Error("Cannot map file {} to memory", fileName);
+        }
+        data = static_cast<const char*>(mapped);
+        madvise(mapped, size, MADV_SEQUENTIAL);
+    }
+    close(fd); //the mapping stays valid
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+    if (data) UnmapViewOfFile(data);
+    if (mappingHandle) CloseHandle(mappingHandle);
+    if (fileHandle) CloseHandle(fileHandle);
+#else
+    if (data) munmap(const_cast<char*>(data), size);
+#endif
+}
+
 bool FileUtils::isBinarySTL(const std::string& filePath) {
     std::ifstream file(filePath); //file closed when goes out of scope
 
     if (!file) {
-        throw Error(("Failed to open file\n{}", filePath));
+        throw Error("Failed to open file\n{}", filePath);
     }
 
     std::string firstLine;
     std::getline(file, firstLine);
 
     return (firstLine.find("solid") != 0); //binary if doesn't begin with "solid"
-}
\ No newline at end of file
+}
+
+/**
+* \brief Parses a double at the beginning of [first, last) like std::from_chars
+ * Floating-point std::from_chars is missing from older standard libraries (libstdc++ before 11, libc++), which then get strtod on a null-terminated copy.
+ * The copy is bounded: longer numbers are reported invalid, callers fall back to their slower path.
+ */
+std::from_chars_result FileUtils::FromChars(const char* first, const char* last, double& value) {
+#if defined(__cpp_lib_to_chars)
+    return std::from_chars(first, last, value);
+#else
+    char buffer[64];
+    const size_t length = std::min(static_cast<size_t>(last - first), sizeof(buffer) - 1);
+    std::memcpy(buffer, first, length);
+    buffer[length] = '\0';
+    if (first < last && std::isspace(static_cast<unsigned char>(*first))) return { first, std::errc::invalid_argument }; //skipped by strtod, not by from_chars
+
+    char* parsedEnd = nullptr;
+    errno = 0;
+    const double parsed = std::strtod(buffer, &parsedEnd);
+    const size_t parsedLength = parsedEnd - buffer;
+    if (parsedLength == 0 || parsedLength == sizeof(buffer) - 1) return { first, std::errc::invalid_argument };
+    if (errno == ERANGE) return { first + parsedLength, std::errc::result_out_of_range };
+    value = parsed;
+    return { first + parsedLength, std::errc() };
+#endif
+}
@@ -2,13 +2,12 @@
 
 #pragma once
 
+#include <charconv>
 #include <cstdio>
 #include <string>
 #include <vector>
 #include <memory>
 
-#define READ_BUFFSIZE 4096
-
 class FileUtils {
 
 public:
@@ -25,6 +24,30 @@ public:
 	static std::string exec(const std::string& command);
 	static std::string exec(const char* cmd);
 	static bool isBinarySTL(const std::string& filePath); //throws error
+	static std::from_chars_result FromChars(const char* first, const char* last, double& value); //std::from_chars, through strtod where the standard library has no floating-point overload
+};
+
+/**
+* \brief Read-only memory mapping of a whole file, unmapped on destruction
+ * Lets importers parse large files in place, from several threads, without copying them through stream buffers
+ */
+class MappedFile {
+public:
+	explicit MappedFile(const std::string& fileName); //throws Error if the file can't be opened or mapped
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const char* Data() const { return data; }
+	size_t Size() const { return size; }
+
+private:
+	const char* data = nullptr; //nullptr for an empty file
+	size_t size = 0;
+#ifdef _WIN32
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#endif
 };
 
 class FileReader {
@@ -45,6 +68,7 @@ public:
   size_t ReadSizeT();
   int ReadInt();
   double ReadDouble();
+  void ReadDoubles(size_t n, double* out); //n consecutive numbers, as n calls of ReadDouble()
   void ReadKeyword(const char *keyword);
   bool PeekKeyword(const char *keyword);
   char *ReadWord();
@@ -65,18 +89,16 @@ public:
   std::vector<std::vector<std::string>> ImportCSV_string();
 private:
 
-  void RefillBuffer();
   char ReadChar();
+  template<typename T> bool ParseNumber(T& value); //parses the next word in place, false if it doesn't start with a number
   
   
-  FILE *file;
+  MappedFile mappedFile; //whole file, read in place
   int curLine;
   char fileName[2048];
-  char readBuffer[READ_BUFFSIZE];
   char* bufferedKeyword;
   bool peekedKeyword;
-  int  nbLeft;
-  int  buffPos;
+  size_t buffPos; //next char to read, CurrentChar is the one before
   int  isEof;
   char CurrentChar;
 };
@@ -3523,6 +3523,7 @@ void InterfaceGeometry::LoadSTL(const std::string& filePath, GLProgress_Abstract
 	}
 
 	// Allocate memory
+	const size_t nbNewVertex = rawGeom.vertices.size();
 	if (!insert) { //load
         try{
             facets.resize(rawGeom.triangleCount, nullptr);
@@ -3530,7 +3531,7 @@ void InterfaceGeometry::LoadSTL(const std::string& filePath, GLProgress_Abstract
         catch(const std::exception &) {
             throw Error("Out of memory: LoadSTL");
         }
-		std::vector<InterfaceVertex>(3 * rawGeom.triangleCount).swap(vertices3);
+		std::vector<InterfaceVertex>(nbNewVertex).swap(vertices3);
 	}
 	else { //insert
         try{
@@ -3539,36 +3540,37 @@ void InterfaceGeometry::LoadSTL(const std::string& filePath, GLProgress_Abstract
         catch(const std::exception &) {
             throw Error("Couldn't allocate memory for facets");
         }
-		vertices3.resize(sh.nbVertex + 3 * rawGeom.triangleCount);
+		vertices3.resize(sh.nbVertex + nbNewVertex);
 	}
 
 	size_t oldFacetNb = sh.nbFacet;
 	size_t oldVertexNb = sh.nbVertex;
 
+	for (size_t i = 0; i < nbNewVertex; i++) {
+		vertices3[oldVertexNb + i] = scaleFactor * rawGeom.vertices[i];
+	}
+
 	// Second pass
 	size_t globalId = 0;
 	for (size_t b = 0; b < rawGeom.bodies.size();b++) {
 		prg.SetMessage(fmt::format("Constructing body {} / {} ...", b+1, rawGeom.bodies.size())); //Will repaint scene, and read sh.nbFacet and sh.nbVertex!
 		for (size_t i = 0; i < rawGeom.bodies[b].triangles.size(); i++) {
 
-			prg.SetProgress((double)globalId / (double)(rawGeom.triangleCount));
-
-			vertices3[oldVertexNb + 3 * globalId + 0] = scaleFactor * rawGeom.bodies[b].triangles[i].v1;
-			vertices3[oldVertexNb + 3 * globalId + 1] = scaleFactor * rawGeom.bodies[b].triangles[i].v2;
-			vertices3[oldVertexNb + 3 * globalId + 2] = scaleFactor * rawGeom.bodies[b].triangles[i].v3;
+			if (globalId % 65536 == 0) prg.SetProgress((double)globalId / (double)(rawGeom.triangleCount));
 
 			try {
 				facets[oldFacetNb + globalId] = new InterfaceFacet(3);
 			}
 			catch (...) {
 				sh.nbFacet = oldFacetNb + globalId;
-				sh.nbVertex = oldVertexNb + 3 * globalId;
+				sh.nbVertex = oldVertexNb + nbNewVertex;
 				throw Error("Out of memory");
 			}
 			//Molflow is right-handed normal, STL standard is left-handed
-			facets[oldFacetNb + globalId]->indices[0] = oldVertexNb + 3 * globalId + 0;
-			facets[oldFacetNb + globalId]->indices[1] = oldVertexNb + 3 * globalId + 2;
-			facets[oldFacetNb + globalId]->indices[2] = oldVertexNb + 3 * globalId + 1;
+			const size_t* triangleIndices = rawGeom.bodies[b].triangles[i].indices;
+			facets[oldFacetNb + globalId]->indices[0] = oldVertexNb + triangleIndices[0];
+			facets[oldFacetNb + globalId]->indices[1] = oldVertexNb + triangleIndices[2];
+			facets[oldFacetNb + globalId]->indices[2] = oldVertexNb + triangleIndices[1];
 
 			if (insert) {
 				facets[oldFacetNb + globalId]->selected = true; //Highlight selected facets
@@ -3585,7 +3587,7 @@ void InterfaceGeometry::LoadSTL(const std::string& filePath, GLProgress_Abstract
 	}
 
 	sh.nbFacet += rawGeom.triangleCount;
-	sh.nbVertex += 3 * rawGeom.triangleCount;
+	sh.nbVertex += nbNewVertex;
 
 	if (!insert || newStruct) AddStruct(FileUtils::StripExtension(FileUtils::GetFilename(filePath)),true);
 
@@ -3673,10 +3675,12 @@ void InterfaceGeometry::LoadTXTGeom(FileReader& file, Worker* worker, size_t str
 	*/
 
 	// Read geometry vertices
-	for (int i = 0; i < sh.nbVertex; i++) {
-		vertices3[i].x = file.ReadDouble();
-		vertices3[i].y = file.ReadDouble();
-		vertices3[i].z = file.ReadDouble();
+	std::vector<double> coordinates(3 * sh.nbVertex);
+	file.ReadDoubles(coordinates.size(), coordinates.data());
+	for (size_t i = 0; i < sh.nbVertex; i++) {
+		vertices3[i].x = coordinates[3 * i];
+		vertices3[i].y = coordinates[3 * i + 1];
+		vertices3[i].z = coordinates[3 * i + 2];
 	}
 
 	// Read geometry facets (indexed from 1)
@@ -3738,11 +3742,13 @@ void InterfaceGeometry::InsertTXTGeom(FileReader& file, size_t strIdx, bool newS
 	vertices3.resize(sh.nbVertex + nbNewVertex);
 
 	// Read geometry vertices
-	for (size_t i = sh.nbVertex; i < (sh.nbVertex + nbNewVertex); i++) {
-		vertices3[i].x = file.ReadDouble();
-		vertices3[i].y = file.ReadDouble();
-		vertices3[i].z = file.ReadDouble();
-		vertices3[i].selected = false;
+	std::vector<double> coordinates(3 * (size_t)nbNewVertex);
+	file.ReadDoubles(coordinates.size(), coordinates.data());
+	for (size_t i = 0; i < (size_t)nbNewVertex; i++) {
+		vertices3[sh.nbVertex + i].x = coordinates[3 * i];
+		vertices3[sh.nbVertex + i].y = coordinates[3 * i + 1];
+		vertices3[sh.nbVertex + i].z = coordinates[3 * i + 2];
+		vertices3[sh.nbVertex + i].selected = false;
 	}
 
 	// Read geometry facets (indexed from 1)
@@ -4430,190 +4436,6 @@ void InterfaceGeometry::SetInterfaceFacets(vector<shared_ptr<SimulationFacet>> s
     sh.nbFacet = facets.size();
 }
 
-RawSTLfile LoadRawSTL(const std::string& filePath, GLProgress_Abstract& prg)
-{
-	prg.SetMessage("Checking if STL file is binary or ascii...");
-	bool isBinary = FileUtils::isBinarySTL(filePath);
-	std::ifstream file(filePath, isBinary ? std::ios::binary : std::ios::in);
-	if (!file) {
-		throw Error(("Failed to open file:\n{}", filePath));
-	}
-
-	RawSTLfile result;
-
-	if (isBinary) {
-		result.bodies.resize(1); //currently no multibody support for binary as SpaceClaim format unclear
-		
-		// Read the header (80 bytes) - ignored in this example
-		file.ignore(80);
-
-		// Read the number of triangles (4 bytes)
-		uint32_t numTriangles;
-		file.read(reinterpret_cast<char*>(&numTriangles), sizeof(numTriangles));
-		double numTriangles_double = (double)numTriangles;
-		result.triangleCount = (size_t)numTriangles;
-
-		prg.SetMessage("Reading triangles in binary STL...");
-		// Read each triangle
-		for (uint32_t i = 0; i < numTriangles; ++i) {
-
-			prg.SetProgress((double)i / numTriangles_double);
-
-			STLTriangle triangle;
-
-			// Read the normal vector as floats (12 bytes - 3 floats)
-			float nx, ny, nz;
-			file.read(reinterpret_cast<char*>(&nx), sizeof(nx));
-			file.read(reinterpret_cast<char*>(&ny), sizeof(ny));
-			file.read(reinterpret_cast<char*>(&nz), sizeof(nz));
-
-			// Convert the normal vector to doubles
-			triangle.normal.x = static_cast<double>(nx);
-			triangle.normal.y = static_cast<double>(ny);
-			triangle.normal.z = static_cast<double>(nz);
-
-			// Read the three vertex coordinates as floats (36 bytes - 9 floats)
-			float v1x, v1y, v1z;
-			file.read(reinterpret_cast<char*>(&v1x), sizeof(v1x));
-			file.read(reinterpret_cast<char*>(&v1y), sizeof(v1y));
-			file.read(reinterpret_cast<char*>(&v1z), sizeof(v1z));
-
-			float v2x, v2y, v2z;
-			file.read(reinterpret_cast<char*>(&v2x), sizeof(v2x));
-			file.read(reinterpret_cast<char*>(&v2y), sizeof(v2y));
-			file.read(reinterpret_cast<char*>(&v2z), sizeof(v2z));
-
-			float v3x, v3y, v3z;
-			file.read(reinterpret_cast<char*>(&v3x), sizeof(v3x));
-			file.read(reinterpret_cast<char*>(&v3y), sizeof(v3y));
-			file.read(reinterpret_cast<char*>(&v3z), sizeof(v3z));
-
-			// Convert the vertex coordinates to doubles
-			triangle.v1.x = static_cast<double>(v1x);
-			triangle.v1.y = static_cast<double>(v1y);
-			triangle.v1.z = static_cast<double>(v1z);
-
-			triangle.v2.x = static_cast<double>(v2x);
-			triangle.v2.y = static_cast<double>(v2y);
-			triangle.v2.z = static_cast<double>(v2z);
-
-			triangle.v3.x = static_cast<double>(v3x);
-			triangle.v3.y = static_cast<double>(v3y);
-			triangle.v3.z = static_cast<double>(v3z);
-
-			// Read the attribute byte count (2 bytes)
-			file.read(reinterpret_cast<char*>(&triangle.attributeByteCount), sizeof(triangle.attributeByteCount));
-
-			// Add the triangle to the current body
-			result.bodies.back().triangles.push_back(triangle);
-		}
-	}
-	else { //ASCII
-		std::string line;
-		{
-			STLBody currentBody;
-			prg.SetMessage("Counting bodies and triangles in ASCII STL file...", true, true);
-			while (std::getline(file, line)) {
-				if (line.find("endsolid") != std::string::npos) {
-					// End of body
-					result.bodies.push_back(currentBody);
-					currentBody = STLBody();
-				} else if (line.find("solid") != std::string::npos) {
-					// New body found (and not 'endsolid')
-					currentBody.name = line.substr(line.find_first_not_of("solid"));
-				} else if (line.find("endfacet") != std::string::npos) {
-					// Count the triangle for the current body
-					currentBody.triangles.push_back(STLTriangle());
-					result.triangleCount++;
-				}
-			}
-		}
-
-		//Second pass
-		double triangleCount = (double)result.triangleCount;
-		size_t nbTrianglesRead = 0;
-		size_t bodyIndex = 0;
-		size_t triangleIndex = 0;
-
-		file.clear();
-		file.seekg(0, std::ios::beg);
-
-		int lineNum = 0;
-		// Read each triangle
-		while (std::getline(file, line)) {
-			lineNum++;
-			if (line.find("endsolid") != std::string::npos) {
-				bodyIndex++;
-			} else if (line.find("solid") != std::string::npos) {
-				prg.SetMessage(fmt::format("Reading ASCII STL file (body {}/{})...", bodyIndex + 1,result.bodies.size()));
-				std::istringstream iss(line);
-				iss.ignore(6); // Skip "solid " prefix
-				iss >> result.bodies[bodyIndex].name;
-				triangleIndex = 0;
-			} else if (line.find("facet normal") != std::string::npos) {
-				
-				std::istringstream iss(line);
-				STLTriangle& triangle=result.bodies[bodyIndex].triangles[triangleIndex++];
-				nbTrianglesRead++;
-				prg.SetProgress((double)nbTrianglesRead / triangleCount);
-
-				// Read the normal vector
-				std::string normalPrefix;
-				iss >> normalPrefix >> triangle.normal.x >> triangle.normal.y >> triangle.normal.z;
-
-				// Skip "outer loop" line
-				std::getline(file, line); lineNum++;
-
-				// Read vertex coordinates
-				for (int i = 0; i < 3; ++i) {
-					std::getline(file, line); lineNum++;
-					iss.str(line);
-					iss.clear();
-
-					std::string vertexPrefix;
-					float x, y, z;
-					iss >> vertexPrefix >> x >> y >> z;
-
-					// Handle scientific notation in vertex coordinates
-					if (iss.fail()) {
-						std::string scientificNotation;
-						iss.clear();
-						iss.str(line);
-						try {
-							iss >> vertexPrefix >> scientificNotation;
-							x = std::stod(scientificNotation);
-							iss >> scientificNotation;
-							y = std::stod(scientificNotation);
-							iss >> scientificNotation;
-							z = std::stod(scientificNotation);
-						}
-						catch (...) {
-							throw Error("Failed to parse line {}:\n\"{}\"\n\"{}\" can't be converted to a number.", lineNum,line,scientificNotation);
-						}
-					}
-
-					if (i == 0) {
-						triangle.v1.x = x;
-						triangle.v1.y = y;
-						triangle.v1.z = z;
-					}
-					else if (i == 1) {
-						triangle.v2.x = x;
-						triangle.v2.y = y;
-						triangle.v2.z = z;
-					}
-					else if (i == 2) {
-						triangle.v3.x = x;
-						triangle.v3.y = y;
-						triangle.v3.z = z;
-					}
-				}
-			}
-		}
-	}
-	return result;
-}
-
 GLListWrapper::GLListWrapper() {
 	listId = glGenLists(1);
 	//std::cout << "Allocated OpenGL list " << listId << std::endl;
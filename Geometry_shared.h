@@ -11,6 +11,7 @@
 #include <GLApp/GLChart/GLChartConst.h>
 #include "Buffer_shared.h"
 #include "Vector.h"
+#include "STLImport.h"
 #include "GLApp/GLTypes.h" //glolor, glmaterial, ...
 
 #define GEOVERSION   16
@@ -367,21 +368,4 @@ protected:
 #endif
 };
 
-struct STLTriangle {
-	Vector3d normal;
-	Vector3d v1, v2, v3;
-	short attributeByteCount; //2-byte
-};
-
-struct STLBody {
-	std::string name;
-	std::vector<STLTriangle> triangles;
-};
-
-struct RawSTLfile {
-	std::vector<STLBody> bodies;
-	size_t triangleCount=0;
-};
-
-RawSTLfile LoadRawSTL(const std::string& filePath, GLProgress_Abstract& prg);
 
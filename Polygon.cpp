@@ -2,7 +2,13 @@
 #include "Polygon.h"
 #include "Helper/MathTools.h"
 #include <math.h>
+#include <cmath>
 #include <algorithm> //min max
+#include <limits>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
 
 bool IsConvex(const GLAppPolygon &p,const size_t idx) {
 
@@ -737,13 +743,17 @@ bool IsInPoly(const Vector2d& point, const std::vector<Vector2d>& polygon) {
     return IsInPoly(point.u, point.v, polygon);
 }
 
-//Performance critical! 15% of ray-tracing CPU usage
 bool IsInPoly(const double u, const double v, const std::vector<Vector2d>& polygon) {
+    return IsInPoly(u, v, polygon.data(), polygon.size());
+}
+
+//Performance critical! 15% of ray-tracing CPU usage
+bool IsInPoly(const double u, const double v, const Vector2d* polygon, const size_t nbVertices) {
     // Fast method to check if a point is inside a polygon or not.
     // Works with convex and concave polys, orientation independent
     int n_updown = 0;
     int n_found = 0;
-    int n = (int)polygon.size();
+    int n = (int)nbVertices;
 
     for (int j = 0; j < n; ++j) {
         const Vector2d& p1 = polygon[j];
@@ -765,6 +775,170 @@ bool IsInPoly(const double u, const double v, const std::vector<Vector2d>& polyg
     
 }
 
+size_t PolyEdgeTableSize(const size_t nbVertices) {
+    const size_t nbPadded = (nbVertices + POLY_EDGE_LANES - 1) / POLY_EDGE_LANES * POLY_EDGE_LANES;
+    return 4 * nbPadded;
+}
+
+/**
+* \brief Precomputes the per-edge terms of IsInPoly, so that the test needs no division
+ * \param table PolyEdgeTableSize(nbVertices) doubles: [p1.u...][p2.u...][slope...][slope*p1.u-p1.v...]
+ */
+void BuildPolyEdgeTable(const Vector2d* polygon, const size_t nbVertices, double* table) {
+    const size_t nbPadded = PolyEdgeTableSize(nbVertices) / 4;
+    double* p1u = table;
+    double* p2u = table + nbPadded;
+    double* slope = table + 2 * nbPadded;
+    double* intercept = table + 3 * nbPadded;
+    for (size_t j = 0; j < nbPadded; ++j) {
+        if (j < nbVertices) {
+            const Vector2d& p1 = polygon[j];
+            const Vector2d& p2 = polygon[Next(j, nbVertices)];
+            p1u[j] = p1.u;
+            p2u[j] = p2.u;
+            slope[j] = (p2.v - p1.v) / (p2.u - p1.u);
+            intercept[j] = slope[j] * p1.u - p1.v;
+        }
+        else {
+            // Padding edge, never crossed since u < p1.u == u < p2.u
+            p1u[j] = p2u[j] = std::numeric_limits<double>::infinity();
+            slope[j] = intercept[j] = 0.0;
+        }
+    }
+}
+
+//Crossing-number test of IsInPoly on a precomputed edge table, POLY_EDGE_LANES edges at once with AVX
+bool IsInPolyEdgeTable(const double u, const double v, const double* table, const size_t nbVertices) {
+    const size_t nbPadded = PolyEdgeTableSize(nbVertices) / 4;
+    const double* p1u = table;
+    const double* p2u = table + nbPadded;
+    const double* slope = table + 2 * nbPadded;
+    const double* intercept = table + 3 * nbPadded;
+    int n_updown = 0;
+    int n_found = 0;
+
+#if defined(__AVX__)
+    static const int bitCount[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+    const __m256d uu = _mm256_set1_pd(u);
+    const __m256d vv = _mm256_set1_pd(v);
+    for (size_t j = 0; j < nbPadded; j += POLY_EDGE_LANES) {
+        const __m256d left1 = _mm256_cmp_pd(uu, _mm256_loadu_pd(p1u + j), _CMP_LT_OQ);
+        const __m256d left2 = _mm256_cmp_pd(uu, _mm256_loadu_pd(p2u + j), _CMP_LT_OQ);
+        const int crossing = _mm256_movemask_pd(_mm256_xor_pd(left1, left2));
+        if (!crossing) continue;
+        const __m256d lhs = _mm256_sub_pd(_mm256_mul_pd(_mm256_loadu_pd(slope + j), uu), vv);
+        const int below = _mm256_movemask_pd(_mm256_cmp_pd(lhs, _mm256_loadu_pd(intercept + j), _CMP_LT_OQ)) & crossing;
+        n_updown += bitCount[below] - bitCount[crossing & ~below];
+        n_found += bitCount[crossing];
+    }
+#else
+    for (size_t j = 0; j < nbPadded; ++j) {
+        if (u < p1u[j] != u < p2u[j]) {
+            if ((slope[j] * u - v) < intercept[j]) {
+                n_updown++;
+            }
+            else {
+                n_updown--;
+            }
+            n_found++;
+        }
+    }
+#endif
+
+    return !(n_found & 2u) ^ !(n_updown & 2u);
+}
+
+/**
+* \brief Classifies the grid cells: cells touched by an edge (with a small margin) are boundary, the others take the state of their center
+ * Resolution grows with the vertex count, up to POLY_GRID_MAX_RESOLUTION cells per side
+ */
+PolyGrid::PolyGrid(const std::vector<Vector2d>& polygon) {
+    const size_t n = polygon.size();
+    resolution = std::clamp((size_t)(2.0 * std::sqrt((double)n)) + 1, (size_t)8, POLY_GRID_MAX_RESOLUTION);
+    cells.assign(resolution * resolution, CellState::Outside);
+    const double res = (double)resolution;
+    const double margin = 1E-6; // in cells, keeps points near an edge in boundary cells despite rounding
+
+    auto toCell = [&](double x) { return (size_t)std::clamp(std::floor(x), 0.0, res - 1.0); };
+    std::vector<std::vector<size_t>> edgesOfColumn(resolution);
+    for (size_t j = 0; j < n; ++j) {
+        const Vector2d& p1 = polygon[j];
+        const Vector2d& p2 = polygon[Next(j, n)];
+        const double u1 = std::min(p1.u, p2.u) * res, u2 = std::max(p1.u, p2.u) * res;
+        // Walk the columns the edge spans, marking the rows it covers within each column
+        for (size_t col = toCell(u1 - margin); col <= toCell(u2 + margin); ++col) {
+            edgesOfColumn[col].push_back(j);
+            double vLow, vHigh;
+            if (u2 - u1 < 1E-12) {
+                vLow = std::min(p1.v, p2.v) * res;
+                vHigh = std::max(p1.v, p2.v) * res;
+            }
+            else {
+                const double slope = (p2.v - p1.v) / (p2.u - p1.u);
+                const double ua = std::max((double)col, u1) / res;
+                const double ub = std::min((double)(col + 1), u2) / res;
+                const double va = (p1.v + slope * (ua - p1.u)) * res;
+                const double vb = (p1.v + slope * (ub - p1.u)) * res;
+                vLow = std::min(va, vb);
+                vHigh = std::max(va, vb);
+            }
+            for (size_t row = toCell(vLow - margin); row <= toCell(vHigh + margin); ++row)
+                cells[row * resolution + col] = CellState::Boundary;
+        }
+    }
+
+    // Same per-edge terms as IsInPoly, so boundary cell tests give identical results
+    columnStart.resize(resolution + 1);
+    columnStart[0] = 0;
+    for (size_t col = 0; col < resolution; ++col) {
+        for (const size_t j : edgesOfColumn[col]) {
+            const Vector2d& p1 = polygon[j];
+            const Vector2d& p2 = polygon[Next(j, n)];
+            const double slope = (p2.v - p1.v) / (p2.u - p1.u);
+            columnEdges.insert(columnEdges.end(), {p1.u, p2.u, slope, slope * p1.u - p1.v});
+        }
+        columnStart[col + 1] = (uint32_t)(columnEdges.size() / 4);
+    }
+
+    for (size_t row = 0; row < resolution; ++row) {
+        for (size_t col = 0; col < resolution; ++col) {
+            uint8_t& cell = cells[row * resolution + col];
+            if (cell != CellState::Boundary)
+                cell = IsInColumn(col, ((double)col + 0.5) / res, ((double)row + 0.5) / res) ? CellState::Inside : CellState::Outside;
+        }
+    }
+}
+
+//! Point in polygon test: O(1) outside boundary cells, otherwise IsInPoly restricted to the edges spanning the column
+bool PolyGrid::Contains(const double u, const double v) const {
+    const size_t col = std::min(resolution - 1, (size_t)std::max(0.0, u * (double)resolution));
+    const size_t row = std::min(resolution - 1, (size_t)std::max(0.0, v * (double)resolution));
+    const uint8_t cell = cells[row * resolution + col];
+    if (cell != CellState::Boundary)
+        return cell == CellState::Inside;
+    return IsInColumn(col, u, v);
+}
+
+//! IsInPoly over the edges of one column, for a point whose u lies in that column
+bool PolyGrid::IsInColumn(const size_t col, const double u, const double v) const {
+    // Edges not spanning u don't change the counts, so skipping them keeps the IsInPoly result
+    int n_updown = 0;
+    int n_found = 0;
+    for (size_t e = columnStart[col]; e < columnStart[col + 1]; ++e) {
+        const double* edge = &columnEdges[4 * e];
+        if (u < edge[0] != u < edge[1]) {
+            if ((edge[2] * u - v) < edge[3]) {
+                n_updown++;
+            }
+            else {
+                n_updown--;
+            }
+            n_found++;
+        }
+    }
+    return !(n_found & 2u) ^ !(n_updown & 2u);
+}
+
 // Returns true if the point p is inside the triangle abc, false otherwise
 bool Point_in_triangle(const Vector2d& p, const Vector2d& a, const Vector2d& b, const Vector2d& c) {
 	double d1 = sign(p, a, b);
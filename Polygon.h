@@ -4,6 +4,7 @@
 #include <tuple>
 #include <optional>
 #include <vector>
+#include <cstdint>
 #include <Clipper2Lib/include/clipper2/clipper.h>
 
 class GLAppPolygon { //To distinguish from possible other Polygon classes in the namespace
@@ -48,6 +49,35 @@ bool   ContainsConcave(const GLAppPolygon& p,const int i1,const int i2,const int
 //std::tuple<bool,Vector2d>  EmptyTriangle(const GLAppPolygon& p,int i1,int i2,int i3);
 bool IsInPoly(const Vector2d& point, const std::vector<Vector2d>& polygon);
 bool IsInPoly(const double u, const double v, const std::vector<Vector2d>& polygon);
+bool IsInPoly(const double u, const double v, const Vector2d* polygon, const size_t nbVertices); //on contiguous vertex storage
+// Edge table for repeated IsInPoly tests on the same polygon: per edge p1.u, p2.u, slope and slope*p1.u-p1.v, as SoA padded to POLY_EDGE_LANES
+constexpr size_t POLY_EDGE_LANES = 4;
+size_t PolyEdgeTableSize(const size_t nbVertices); //in doubles
+void BuildPolyEdgeTable(const Vector2d* polygon, const size_t nbVertices, double* table);
+bool IsInPolyEdgeTable(const double u, const double v, const double* table, const size_t nbVertices); //same result as IsInPoly
+
+constexpr size_t POLY_GRID_MIN_VERTICES = 32; // Polygons with fewer vertices are tested directly
+constexpr size_t POLY_GRID_MAX_RESOLUTION = 64;
+
+/**
+* \brief Uniform grid over the (u,v) unit square of a facet, each cell classified as inside, outside or crossed by the polygon outline
+ * Points in boundary cells are tested against the edges spanning their grid column only, with the same result as IsInPoly
+ */
+class PolyGrid {
+public:
+    enum CellState : uint8_t { Outside, Inside, Boundary };
+    explicit PolyGrid(const std::vector<Vector2d>& polygon);
+    bool Contains(const double u, const double v) const;
+    size_t GetMemSize() const { return sizeof(PolyGrid) + cells.capacity() + columnStart.capacity() * sizeof(uint32_t) + columnEdges.capacity() * sizeof(double); }
+private:
+    bool IsInColumn(const size_t col, const double u, const double v) const;
+
+    size_t resolution;
+    std::vector<uint8_t> cells; // row-major, v rows of u cells
+    std::vector<uint32_t> columnStart; // first edge of each column in columnEdges, resolution+1 entries
+    std::vector<double> columnEdges; // per edge: p1.u, p2.u, slope, slope*p1.u-p1.v
+};
+
 bool Point_in_triangle(const Vector2d& p, const Vector2d& a, const Vector2d& b, const Vector2d& c); //fast isinpoly for triangle
 double sign(const Vector2d& p1, const Vector2d& p2, const Vector2d& p3);
 bool   IsOnPolyEdge(const double  u, const double  v, const std::vector<Vector2d>& polyPoints, const double  tolerance);
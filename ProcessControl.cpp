@@ -3,35 +3,7 @@
 #include "ProcessControl.h"
 #include <cstring>
 #include <optional>
-
-//! Moves first sub process to the back of the "active", for round robin fashion of communication for updates
-void ProcComm::PlaceFrontToBack() {
-    //this->activeProcsMutex.lock();
-    hitUpdateQueue.emplace_back(hitUpdateQueue.front());
-    hitUpdateQueue.pop_front();
-    //this->activeProcsMutex.unlock();
-}
-
-//! Removes a process from the active list, in case it is finished
-void ProcComm::RemoveFromHitUpdateQueue(size_t id) {
-    //this->activeProcsMutex.lock();
-    for(auto proc = hitUpdateQueue.begin(); proc != hitUpdateQueue.end(); ++proc){
-        if(id == (*proc)) {
-            hitUpdateQueue.erase(proc);
-            break;
-        }
-    }
-    //this->activeProcsMutex.unlock();
-}
-
-//! Init list of active/simulating processes
-void ProcComm::InitHitUpdateQueue() {
-    //this->activeProcsMutex.lock();
-    hitUpdateQueue.clear();
-    for(size_t id = 0; id < this->threadInfos.size(); ++id)
-        hitUpdateQueue.emplace_back(id);
-    //this->activeProcsMutex.unlock();
-}
+#include <chrono>
 
 void ProcCommData::UpdateCounterSizes(const std::vector<size_t>& counterSizes) {
     procDataMutex.lock();
@@ -45,7 +17,9 @@ void ProcCommData::UpdateControllerStatus(const std::optional<ControllerState>&
     procDataMutex.lock();
     if (status.has_value()) controllerStatus = *status;
     if (state.has_value()) controllerState = *state;
+    stateVersion++;
     procDataMutex.unlock();
+    stateChanged.notify_all();
     if (loadStatus) {
         loadStatus->procStateCache.procDataMutex.lock();
         if (status.has_value()) loadStatus->procStateCache.controllerStatus = *status;
@@ -53,4 +27,84 @@ void ProcCommData::UpdateControllerStatus(const std::optional<ControllerState>&
         loadStatus->procStateCache.procDataMutex.unlock();
         loadStatus->Update();
     }
-};
\ No newline at end of file
+};
+
+void ProcCommData::UpdateThreadState(size_t threadNum, ThreadState state) {
+    LockTimed(procDataMutex); //mostly called by simulation threads
+    threadInfos[threadNum].threadState = state;
+    stateVersion++;
+    procDataMutex.unlock();
+    stateChanged.notify_all();
+}
+
+//! Sets a new command and wakes up the controller waiting for it
+void ProcCommData::PostCommand(SimCommand command, size_t param, size_t param2) {
+    procDataMutex.lock();
+    masterCmd = command;
+    cmdParam = param;
+    cmdParam2 = param2;
+    commandId++;
+    stateVersion++;
+    procDataMutex.unlock();
+    stateChanged.notify_all();
+}
+
+//! Clears the executed command. The controller reports its final state before clearing, so the manager may already have posted the next command
+void ProcCommData::ClearCommand(size_t executedCommandId) {
+    procDataMutex.lock();
+    if (commandId == executedCommandId) {
+        masterCmd = SimCommand::None;
+        cmdParam = 0;
+        cmdParam2 = 0;
+        stateVersion++;
+    }
+    procDataMutex.unlock();
+    stateChanged.notify_all();
+}
+
+size_t ProcCommData::GetCommandId() {
+    std::lock_guard<std::mutex> lock(procDataMutex);
+    return commandId;
+}
+
+SimCommand ProcCommData::GetCommand(size_t& id) {
+    std::lock_guard<std::mutex> lock(procDataMutex);
+    id = commandId;
+    return masterCmd;
+}
+
+//! Waits for a command posted after the one currently executed (or after the last one when idle), the timeout only serves as a watchdog
+//! Compares ids rather than commands, so that posting the same command again (ex. Pause while paused) wakes the controller too
+SimCommand ProcCommData::WaitForCommand(size_t currentCommandId, unsigned int timeout_ms) {
+    std::unique_lock<std::mutex> lock(procDataMutex);
+    stateChanged.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&] { return commandId != currentCommandId; });
+    return masterCmd;
+}
+
+size_t ProcCommData::GetStateVersion() {
+    std::lock_guard<std::mutex> lock(procDataMutex);
+    return stateVersion;
+}
+
+//! Waits for a command, controller state or thread state change that happened after seenVersion was read
+size_t ProcCommData::WaitForStateChange(size_t seenVersion, unsigned int timeout_ms) {
+    std::unique_lock<std::mutex> lock(procDataMutex);
+    stateChanged.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&] { return stateVersion != seenVersion; });
+    return stateVersion;
+}
+
+/*!
+ * @brief Snapshot of the per-thread telemetry, published by the threads after every simulation step
+ * @return one entry per simulation thread, empty before Resize()
+ */
+std::vector<ThreadTelemetry> ProcComm::GetThreadTelemetry() const {
+    std::vector<ThreadTelemetry> telemetry;
+    if (!threadCounters) return telemetry;
+    telemetry.resize(threadInfos.size());
+    for (size_t i = 0; i < telemetry.size(); i++) {
+        telemetry[i].threadNum = i;
+        telemetry[i].counts = threadCounters[i].Load();
+        telemetry[i].stepsPerSec = threadCounters[i].stepsPerSec.load(std::memory_order_relaxed);
+    }
+    return telemetry;
+}
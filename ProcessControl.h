@@ -5,9 +5,14 @@
 #include <cstddef> //size_t
 #include <vector>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <list>
 #include <map>
 #include <optional>
+#include <memory>
+#include <string>
+#include "ThreadTelemetry.h"
 
 enum ControllerState {
     Loading,
@@ -82,19 +87,30 @@ struct ThreadInfo {
     ThreadState threadState=ThreadState::Idle;
     std::string threadStatus;
     PROCESS_INFO runtimeInfo;
+
+    //Statistics of the last run
+    size_t nbHitMerges=0;
+    double hitMergeTime=0.0; //total time spent adding local hits to group/global counters (in second)
+    double maxHitMergeLatency=0.0; //longest single merge (in second)
+    double runTime=0.0; //wall time of the thread's run loop (in second)
+    double simTime=0.0; //time spent in MC steps (in second)
+    size_t nbDesChunks=0; //desorption chunks claimed from the shared budget
 };
 
 class LoadStatus_abstract;
 
 struct ProcCommData {
-    SimCommand masterCmd = SimCommand::None;
+    std::atomic<SimCommand> masterCmd{ SimCommand::None };
     size_t cmdParam = 0;
     size_t cmdParam2 = 0;
     std::string controllerStatus; //Allows to display fine-grained status in LoadStatus/Global Settings
-    ControllerState controllerState = ControllerState::Initializing;
+    std::atomic<ControllerState> controllerState{ ControllerState::Initializing };
 
     std::vector<ThreadInfo> threadInfos;
     std::mutex procDataMutex; // To avoid writing to it while GUI refreshes LoadStatus window
+    std::condition_variable stateChanged; // Notified on every new command, controller state and thread state change
+    size_t stateVersion = 0; // Incremented under procDataMutex on every notified change, so that waiters can't miss one
+    size_t commandId = 0; // Incremented by PostCommand(), lets the controller clear only the command it executed
 
     // Custom assignment operator
     ProcCommData& operator=(const ProcCommData& other) {
@@ -103,26 +119,41 @@ struct ProcCommData {
         }
 
         // Copy all members except the mutex
-        masterCmd = other.masterCmd;
+        masterCmd = other.masterCmd.load();
         cmdParam = other.cmdParam;
         cmdParam2 = other.cmdParam2;
         controllerStatus = other.controllerStatus;
-        controllerState = other.controllerState;
+        controllerState = other.controllerState.load();
         threadInfos = other.threadInfos;
 
-        // No need to copy the mutex, it's not copyable
+        // No need to copy the mutex and condition variable, they're not copyable
 
         return *this;
     }
 
     void UpdateCounterSizes(const std::vector<size_t>& counterSizes);
     void UpdateControllerStatus(const std::optional<ControllerState>& state, const std::optional<std::string>& status, LoadStatus_abstract* loadStatus = nullptr);
+    void UpdateThreadState(size_t threadNum, ThreadState state);
+
+    // Command channel between simulation manager and controller
+    void PostCommand(SimCommand command, size_t param, size_t param2); //Called by simulation manager, wakes up the controller
+    void ClearCommand(size_t executedCommandId); //Called by simulation controller once a command has been executed, no-op if a new one was posted meanwhile
+    SimCommand WaitForCommand(size_t currentCommandId, unsigned int timeout_ms); //Blocks until a command is posted after currentCommandId or timeout
+    size_t GetCommandId();
+    SimCommand GetCommand(size_t& id); //Reads command and its commandId consistently
+    size_t GetStateVersion();
+    size_t WaitForStateChange(size_t seenVersion, unsigned int timeout_ms); //Blocks until any notified change after seenVersion or timeout, returns the new version
 };
 
 //! Process Communication class for handling inter process/thread communication
 struct ProcComm : ProcCommData {
 
-    std::list<size_t> hitUpdateQueue; //For round-robin access. When a process in front is "processed", it's moved to back
+    std::unique_ptr<ThreadCounters[]> threadCounters; //Published per-thread telemetry, not copied with the rest of the state
+    std::string telemetryFile; //If set, simulation thread 0 appends a telemetry snapshot every telemetryInterval while running, see AppendTelemetryFile()
+    double telemetryInterval = 60.0; //seconds
+    std::string autosaveFile; //If set, simulation thread 0 saves the results (ResultsFile.h) every autosaveInterval while running
+    double autosaveInterval = 600.0; //seconds
+    size_t autosaveMemory = 0; //snapshot budget of the background autosave in bytes, 0: the autosave holds the simulation while writing
     //std::mutex activeProcsMutex;
 
     // Custom assignment operator
@@ -139,17 +170,12 @@ struct ProcComm : ProcCommData {
         Resize(nbProcs);
     };
 
+    [[nodiscard]] std::vector<ThreadTelemetry> GetThreadTelemetry() const;
+
     void Resize(size_t nbProcs) { //Called by constructor and by simulation manager's CreateCPUHandle()
         threadInfos.resize(nbProcs);
-        InitHitUpdateQueue();
+        threadCounters = std::make_unique<ThreadCounters[]>(nbProcs);
     };
-
-    void PlaceFrontToBack(); //Called by simulation controller (SimThreadHandle::runloop) when thread-local hits are added to master hits
-
-    void RemoveFromHitUpdateQueue(size_t id); //Called by simulation controller (SimThreadHandle::runloop) when end condition is met (and exit from loop), before final hit update
-
-    void InitHitUpdateQueue(); //Called by constructor and on resize
-    
 };
 
 //An abstract class that can display the status of subprocesses and issue an abort command
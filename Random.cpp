@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include "Random.h"
 #include "Helper/MathTools.h"
+#include "ThreadTelemetry.h"
 #include <omp.h>
 
 #ifdef _WIN32
@@ -35,7 +36,10 @@ void MersenneTwister::SetSeed(unsigned long seed)
 
 // Initialise the random generator with the specified seed
 
-double MersenneTwister::rnd() { return rk_double(); }
+double MersenneTwister::rnd() {
+    threadTelemetry.rngDraws++;
+    return rk_double();
+}
 
 double MersenneTwister::Gaussian(const double  sigma) //inline
 {
@@ -122,6 +126,114 @@ MersenneTwister::MersenneTwister() {
 #endif
 }
 
+/* Philox4x32 multipliers and Weyl key increments, from Salmon et al., "Parallel random numbers: as easy as 1, 2, 3" */
+#define PHILOX_M0 0xD2511F53U
+#define PHILOX_M1 0xCD9E8D57U
+#define PHILOX_W0 0x9E3779B9U
+#define PHILOX_W1 0xBB67AE85U
+
+CounterRNG::CounterRNG() {
+#if defined(DEBUG)
+    SetSeed(42424242);
+#else
+    SetSeed(GenerateSeed(0));
+#endif
+}
+
+void CounterRNG::SetSeed(unsigned long seed) {
+    this->seed = seed;
+    const uint64_t seed64 = static_cast<uint64_t>(seed);
+    key[0] = static_cast<uint32_t>(seed64);
+    key[1] = static_cast<uint32_t>(seed64 >> 32);
+    nextBlock = 0;
+    pos = COUNTER_RNG_BUFFER;
+}
+
+void CounterRNG::Blocks(uint64_t firstBlock, uint32_t out[4][COUNTER_RNG_LANES]) const {
+    // Lane-wise loops over independent counters, which the compiler turns into SIMD multiplies
+    uint32_t c0[COUNTER_RNG_LANES], c1[COUNTER_RNG_LANES], c2[COUNTER_RNG_LANES], c3[COUNTER_RNG_LANES];
+    for (int lane = 0; lane < COUNTER_RNG_LANES; lane++) {
+        const uint64_t blockIndex = firstBlock + lane;
+        c0[lane] = static_cast<uint32_t>(blockIndex);
+        c1[lane] = static_cast<uint32_t>(blockIndex >> 32);
+        c2[lane] = 0;
+        c3[lane] = 0;
+    }
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int round = 0; round < PHILOX_ROUNDS; round++) {
+        for (int lane = 0; lane < COUNTER_RNG_LANES; lane++) {
+            const uint64_t p0 = static_cast<uint64_t>(PHILOX_M0) * c0[lane];
+            const uint64_t p1 = static_cast<uint64_t>(PHILOX_M1) * c2[lane];
+            c0[lane] = static_cast<uint32_t>(p1 >> 32) ^ c1[lane] ^ k0;
+            c2[lane] = static_cast<uint32_t>(p0 >> 32) ^ c3[lane] ^ k1;
+            c1[lane] = static_cast<uint32_t>(p1);
+            c3[lane] = static_cast<uint32_t>(p0);
+        }
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    for (int lane = 0; lane < COUNTER_RNG_LANES; lane++) {
+        out[0][lane] = c0[lane];
+        out[1][lane] = c1[lane];
+        out[2][lane] = c2[lane];
+        out[3][lane] = c3[lane];
+    }
+}
+
+void CounterRNG::Fill(double* values, size_t nbValues) {
+    threadTelemetry.rngDraws += nbValues;
+    FillStream(values, nbValues);
+}
+
+void CounterRNG::FillStream(double* values, size_t nbValues) {
+    size_t i = 0;
+    // Values left in the buffer come first, to keep the stream order
+    while (i < nbValues && pos < COUNTER_RNG_BUFFER)
+        values[i++] = buffer[pos++];
+    // Two doubles per block, 53 bits each, as in MersenneTwister::rk_double()
+    const double twoPowMinus53 = 1.0 / 9007199254740992.0; // exact, so same values as dividing
+    for (; i + COUNTER_RNG_BUFFER <= nbValues; i += COUNTER_RNG_BUFFER) {
+        uint32_t r[4][COUNTER_RNG_LANES];
+        Blocks(nextBlock, r);
+        nextBlock += COUNTER_RNG_LANES;
+        for (int lane = 0; lane < COUNTER_RNG_LANES; lane++) {
+            values[i + 2 * lane] = ((r[0][lane] >> 5) * 67108864.0 + (r[1][lane] >> 6)) * twoPowMinus53;
+            values[i + 2 * lane + 1] = ((r[2][lane] >> 5) * 67108864.0 + (r[3][lane] >> 6)) * twoPowMinus53;
+        }
+    }
+    if (i < nbValues) {
+        FillStream(buffer, COUNTER_RNG_BUFFER); // pos was at the end, refills completely
+        pos = 0;
+        while (i < nbValues)
+            values[i++] = buffer[pos++];
+    }
+}
+
+double CounterRNG::rnd() {
+    threadTelemetry.rngDraws++;
+    if (pos == COUNTER_RNG_BUFFER) {
+        FillStream(buffer, COUNTER_RNG_BUFFER);
+        pos = 0;
+    }
+    return buffer[pos++];
+}
+
+double CounterRNG::Gaussian(const double sigma) {
+    //Same polar method as MersenneTwister::Gaussian
+    double v1, v2, r, fac;
+    do {
+        v1 = 2.0*rnd() - 1.0;
+        v2 = 2.0*rnd() - 1.0;
+        r = v1 * v1 + v2 * v2;
+    } while (r >= 1.0);
+    fac = sqrt(-2.0*log(r) / r);
+    return v2 * fac*sigma;
+}
+
+unsigned long CounterRNG::GetSeed() {
+    return seed;
+}
+
 /*
 double TruncatedGaussian::GetGaussian(const double  mean, const double  sigma, const double  lowerBound, const double  upperBound) //inline
 {
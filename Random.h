@@ -1,6 +1,8 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 //#include "TruncatedGaussian/rtnorm.hpp"
 
 /* Maximum generated random value */
@@ -46,4 +48,41 @@ private:
     unsigned long rk_random();
 
     double rk_double();
-};
\ No newline at end of file
+};
+
+#define PHILOX_ROUNDS 10
+#define COUNTER_RNG_LANES 4 // Philox blocks generated together
+#define COUNTER_RNG_BUFFER (2 * COUNTER_RNG_LANES) // doubles generated per refill
+
+/**
+* \brief Counter-based generator (Philox4x32-10), same interface as MersenneTwister
+ * The n-th value is a pure function of (seed, n): the seed is the key, the 64-bit block index the counter (2^65 values per seed)
+ */
+class CounterRNG {
+public:
+    CounterRNG();
+    void   SetSeed(unsigned long seed); // Restarts at the beginning of the seed's sequence
+    double rnd(); // Returns a uniform distributed double value in the interval [0,1[
+    void   Fill(double* values, size_t nbValues); // Next nbValues of the sequence, same as calling rnd() nbValues times
+
+    double Gaussian(const double sigma);
+
+    unsigned long GetSeed();
+
+private:
+    void Blocks(uint64_t firstBlock, uint32_t out[4][COUNTER_RNG_LANES]) const; // Philox4x32 of counters (firstBlock+lane, 0)
+    void FillStream(double* values, size_t nbValues); // Fill() without telemetry, also used to refill the buffer
+
+    unsigned long seed;
+    uint32_t key[2];
+    uint64_t nextBlock; // lower half of the counter, the upper half stays 0
+    double buffer[COUNTER_RNG_BUFFER];
+    int pos;
+};
+
+// Generator used for rays, selected by the USE_COUNTER_RNG build option
+#if defined(USE_COUNTER_RNG)
+using RandomEngine = CounterRNG;
+#else
+using RandomEngine = MersenneTwister;
+#endif
\ No newline at end of file
@@ -10,15 +10,28 @@
 #include <cassert>
 #include <Helper/ConsoleLogger.h>
 #include "IntersectAABB_shared.h"
+#include "Polygon.h"
+#include "Helper/MathTools.h"
+#include "ThreadTelemetry.h"
+#include <atomic>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <omp.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
 
 namespace STATS {
     //STAT_MEMORY_COUNTER("Memory/BVH tree", treeBytes);
     //STAT_RATIO("BVH/Primitives per leaf node", totalPrimitives, totalLeafNodes);
 
-    static int totalPrimitives = 0;
-    static int totalLeafNodes = 0;
-    static int interiorNodes = 0;
-    static int leafNodes = 0;
+    // Atomic, as subtrees are built in parallel tasks
+    static std::atomic<int> totalPrimitives{0};
+    static std::atomic<int> totalLeafNodes{0};
+    static std::atomic<int> interiorNodes{0};
+    static std::atomic<int> leafNodes{0};
 
     void _reset() {
         totalPrimitives = 0;
@@ -68,15 +81,102 @@ struct BVHBuildNode {
         ++STATS::interiorNodes;
     }
 
-    ~BVHBuildNode(){
-        if(children[1]) delete children[1];
-        if(children[0]) delete children[0];
-    }
     AxisAlignedBoundingBox bounds;
     BVHBuildNode *children[2];
     int splitAxis, firstPrimOffset, nPrimitives;
 };
 
+//! Preallocated storage for build nodes, replacing one new/delete per node
+//! A binary tree over n primitives has at most 2n-1 nodes, so a single atomic counter is enough for parallel allocation
+struct BVHBuildArena {
+    explicit BVHBuildArena(size_t nbPrimitives) : buildNodes(new BVHBuildNode[2 * nbPrimitives - 1]) {}
+    BVHBuildNode *Alloc() { return &buildNodes[nextFree++]; }
+    int NbAllocated() const { return (int) nextFree; }
+
+    std::unique_ptr<BVHBuildNode[]> buildNodes;
+    std::atomic<size_t> nextFree{0};
+};
+
+constexpr int BVH_TASK_THRESHOLD = 4096; // Subtrees with more primitives are built as separate OpenMP tasks
+constexpr int BVH_PARALLEL_BIN_THRESHOLD = 65536; // Nodes with more primitives compute bounds and SAH bins in parallel chunks
+
+//! Splits [start,end) into one chunk per thread, runs fn(partial, chunkStart, chunkEnd) as tasks and waits for them
+//! Partial results are merged by the caller in chunk order, so the outcome does not depend on scheduling
+template<typename Partial, typename Fn>
+static void ForEachChunkParallel(int start, int end, std::vector<Partial> &partials, Fn fn) {
+    const int nbChunks = std::max(1, omp_get_num_threads());
+    partials.assign(nbChunks, Partial());
+    const int chunkSize = (end - start + nbChunks - 1) / nbChunks;
+    for (int c = 0; c < nbChunks; ++c) {
+        const int chunkStart = std::min(end, start + c * chunkSize);
+        const int chunkEnd = std::min(end, chunkStart + chunkSize);
+#pragma omp task default(shared) firstprivate(c, chunkStart, chunkEnd)
+        fn(partials[c], chunkStart, chunkEnd);
+    }
+#pragma omp taskwait
+}
+
+//! Sort key of HLBVH: Morton code of the primitive centroid, interleaved x,y,z bits
+struct MortonPrimitive {
+    int primitiveIndex;
+    uint64_t mortonCode;
+};
+
+//! Range of Morton-sorted primitives sharing the top HLBVH_TREELET_BITS of their code
+struct LBVHTreelet {
+    int startIndex, nPrimitives;
+    BVHBuildNode *root;
+};
+
+constexpr int HLBVH_TREELET_BITS = 12; // 4 bits per axis define a treelet
+constexpr size_t HLBVH_WIDE_CODE_THRESHOLD = 1 << 20; // From this primitive count, 63-bit codes (21 bits per axis) instead of 30-bit
+
+//! Spreads the lower 21 bits of x so that two zero bits are between each
+static inline uint64_t LeftShift3(uint64_t x) {
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffff;
+    x = (x | x << 16) & 0x1f0000ff0000ff;
+    x = (x | x << 8) & 0x100f00f00f00f00f;
+    x = (x | x << 4) & 0x10c30c30c30c30c3;
+    x = (x | x << 2) & 0x1249249249249249;
+    return x;
+}
+
+static inline uint64_t EncodeMorton3(uint64_t x, uint64_t y, uint64_t z) {
+    return (LeftShift3(z) << 2) | (LeftShift3(y) << 1) | LeftShift3(x);
+}
+
+//! LSD radix sort on the lowest nbBits of the Morton codes, stable
+static void RadixSort(std::vector<MortonPrimitive> &v, int nbBits) {
+    std::vector<MortonPrimitive> tempVector(v.size());
+    constexpr int bitsPerPass = 8;
+    constexpr int nBuckets = 1 << bitsPerPass;
+    constexpr int bitMask = nBuckets - 1;
+    const int nPasses = (nbBits + bitsPerPass - 1) / bitsPerPass;
+    for (int pass = 0; pass < nPasses; ++pass) {
+        //<<Perform one pass of radix sort, sorting bitsPerPass bits>>
+        const int lowBit = pass * bitsPerPass;
+        std::vector<MortonPrimitive> &in = (pass & 1) ? tempVector : v;
+        std::vector<MortonPrimitive> &out = (pass & 1) ? v : tempVector;
+
+        size_t bucketCount[nBuckets] = {0};
+        for (const MortonPrimitive &mp : in) {
+            int bucket = (mp.mortonCode >> lowBit) & bitMask;
+            ++bucketCount[bucket];
+        }
+        size_t outIndex[nBuckets];
+        outIndex[0] = 0;
+        for (int i = 1; i < nBuckets; ++i)
+            outIndex[i] = outIndex[i - 1] + bucketCount[i - 1];
+        for (const MortonPrimitive &mp : in) {
+            int bucket = (mp.mortonCode >> lowBit) & bitMask;
+            out[outIndex[bucket]++] = mp;
+        }
+    }
+    if (nPasses & 1)
+        std::swap(v, tempVector);
+}
+
 struct LinearBVHNode {
     AxisAlignedBoundingBox bounds;
     union {
@@ -88,6 +188,298 @@ struct LinearBVHNode {
     uint8_t pad[1];        // ensure 32 byte total size
 };
 
+//! Collapsed node with up to BVH_MAX_WIDTH children, their boxes are stored in BVHAccel::wideBounds
+struct WideBVHNode {
+    int childOffset[BVH_MAX_WIDTH]; // interior child: index in wideNodes, leaf child: first primitive
+    uint16_t nPrimitives[BVH_MAX_WIDTH]; // 0 -> interior child
+    uint8_t nbChildren;
+};
+
+//! Intersection-only copy of a facet, stored in leaf order: two cache lines instead of the full RTFacet
+struct alignas(64) CompactFacet {
+    Vector3d O; // origin of the facet's uv space, Triangle: first vertex
+    Vector3d U; // Triangle: edge to the second vertex
+    Vector3d V; // Triangle: edge to the third vertex
+    Vector3d Nuv; // U x V of the uv space, for back facet culling
+    const RTFacet *facet; // owner, only dereferenced on hits for its surface
+    const PolyGrid *polyGrid; // kept alive by BVHAccel::compactPolyGrids, null unless the polygon has many vertices
+    int globalId; // same type as Ray::lastIntersectedId
+    uint32_t vertexOffset; // first 2D vertex in BVHAccel::compactVertices
+    uint32_t edgeOffset; // Polygon: edge table in BVHAccel::compactEdges
+    uint16_t nbVertices; // 0 for polygons with more vertices, tested by RTFacet::IsInPolygon() instead of an edge table
+    bool is2sided;
+    FacetShape shape;
+};
+static_assert(sizeof(CompactFacet) == 128, "CompactFacet should span two cache lines");
+constexpr size_t COMPACT_MAX_VERTICES = std::numeric_limits<uint16_t>::max(); // CompactFacet::nbVertices range
+
+/**
+* \brief Same test as RTFacet::Intersect, on the compact record, its contiguous 2D polygon and edge table
+ */
+static inline bool IntersectCompactFacet(const CompactFacet &f, const Vector2d *polygon, const double *edges, Ray &ray) {
+    Vector3d rayDirOpposite(-1.0 * ray.direction);
+    double det = Dot(f.Nuv, rayDirOpposite);
+
+    // Eliminate "back facet"
+    if ((f.is2sided) || (det > 0.0)) { //If 2-sided or if ray going opposite facet normal
+        if (f.shape == FacetShape::Triangle) {
+            double d, b1, b2;
+            if (IntersectTriangle(f.O, f.U, f.V, ray, d, b1, b2)) {
+                const Vector2d *tri = polygon + f.vertexOffset;
+                double u = tri[0].u + b1 * (tri[1].u - tri[0].u) + b2 * (tri[2].u - tri[0].u);
+                double v = tri[0].v + b1 * (tri[1].v - tri[0].v) + b2 * (tri[2].v - tri[0].v);
+                return f.facet->RegisterHit(ray, d, u, v);
+            }
+            return false;
+        }
+        if (det != 0.0) {
+            double iDet = 1.0 / det;
+            Vector3d intZ = ray(0) - f.O;
+
+            double u = iDet * DET33(intZ.x, f.V.x, rayDirOpposite.x,
+                                    intZ.y, f.V.y, rayDirOpposite.y,
+                                    intZ.z, f.V.z, rayDirOpposite.z);
+            if (u >= 0.0 && u <= 1.0) {
+                double v = iDet * DET33(f.U.x, intZ.x, rayDirOpposite.x,
+                                        f.U.y, intZ.y, rayDirOpposite.y,
+                                        f.U.z, intZ.z, rayDirOpposite.z);
+                if (v >= 0.0 && v <= 1.0) {
+                    double d = iDet * Dot(f.Nuv, intZ);
+                    if (d > 0.0 && (f.shape == FacetShape::Parallelogram
+                                    || (f.polyGrid ? f.polyGrid->Contains(u, v)
+                                                   : f.nbVertices ? IsInPolyEdgeTable(u, v, edges + f.edgeOffset, f.nbVertices)
+                                                                  : f.facet->IsInPolygon(u, v)))) {
+                        return f.facet->RegisterHit(ray, d, u, v);
+                    }
+                }
+            }
+        }
+    }
+    return false;
+}
+
+//! Structure-of-arrays copy of up to BVH_PACKET_SIZE rays sharing the same dirIsNeg pattern
+struct BVHRayPacket {
+    alignas(32) double originX[BVH_PACKET_SIZE];
+    alignas(32) double originY[BVH_PACKET_SIZE];
+    alignas(32) double originZ[BVH_PACKET_SIZE];
+    alignas(32) double invDirX[BVH_PACKET_SIZE];
+    alignas(32) double invDirY[BVH_PACKET_SIZE];
+    alignas(32) double invDirZ[BVH_PACKET_SIZE];
+    alignas(32) double tMax[BVH_PACKET_SIZE];
+    Ray *rays[BVH_PACKET_SIZE];
+    int dirIsNeg[3];
+    int nbRays;
+};
+
+//! Packet version of IntersectBox(): tests one node against all rays of activeMask, returns the mask of rays hitting it
+//! Mirrors the scalar comparisons one to one (including NaN behaviour), so each lane gives the same answer as IntersectBox()
+static inline int IntersectBoxPacket(const AxisAlignedBoundingBox &bounds, const BVHRayPacket &packet, int activeMask) {
+    constexpr double precalc_1_2_gamma3 = 1 + 2 * gamma(3);
+    const double nearX = bounds[packet.dirIsNeg[0]].x, farX = bounds[1 - packet.dirIsNeg[0]].x;
+    const double nearY = bounds[packet.dirIsNeg[1]].y, farY = bounds[1 - packet.dirIsNeg[1]].y;
+    const double nearZ = bounds[packet.dirIsNeg[2]].z, farZ = bounds[1 - packet.dirIsNeg[2]].z;
+#if defined(__AVX__)
+    const __m256d gamma3 = _mm256_set1_pd(precalc_1_2_gamma3);
+    const __m256d ox = _mm256_load_pd(packet.originX);
+    const __m256d oy = _mm256_load_pd(packet.originY);
+    const __m256d oz = _mm256_load_pd(packet.originZ);
+    const __m256d ix = _mm256_load_pd(packet.invDirX);
+    const __m256d iy = _mm256_load_pd(packet.invDirY);
+    const __m256d iz = _mm256_load_pd(packet.invDirZ);
+
+    __m256d tMin = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(nearX), ox), ix);
+    __m256d tMax = _mm256_mul_pd(_mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(farX), ox), ix), gamma3);
+    __m256d tyMin = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(nearY), oy), iy);
+    __m256d tyMax = _mm256_mul_pd(_mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(farY), oy), iy), gamma3);
+    __m256d miss = _mm256_or_pd(_mm256_cmp_pd(tMin, tyMax, _CMP_GT_OQ), _mm256_cmp_pd(tyMin, tMax, _CMP_GT_OQ));
+    tMin = _mm256_blendv_pd(tMin, tyMin, _mm256_cmp_pd(tyMin, tMin, _CMP_GT_OQ));
+    tMax = _mm256_blendv_pd(tMax, tyMax, _mm256_cmp_pd(tyMax, tMax, _CMP_LT_OQ));
+
+    __m256d tzMin = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(nearZ), oz), iz);
+    __m256d tzMax = _mm256_mul_pd(_mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(farZ), oz), iz), gamma3);
+    miss = _mm256_or_pd(miss, _mm256_or_pd(_mm256_cmp_pd(tMin, tzMax, _CMP_GT_OQ), _mm256_cmp_pd(tzMin, tMax, _CMP_GT_OQ)));
+    tMin = _mm256_blendv_pd(tMin, tzMin, _mm256_cmp_pd(tzMin, tMin, _CMP_GT_OQ));
+    tMax = _mm256_blendv_pd(tMax, tzMax, _mm256_cmp_pd(tzMax, tMax, _CMP_LT_OQ));
+
+    const __m256d hit = _mm256_and_pd(_mm256_cmp_pd(tMin, _mm256_load_pd(packet.tMax), _CMP_LT_OQ),
+                                      _mm256_cmp_pd(tMax, _mm256_setzero_pd(), _CMP_GT_OQ));
+    return _mm256_movemask_pd(_mm256_andnot_pd(miss, hit)) & activeMask;
+#else
+    int hitMask = 0;
+    for (int lane = 0; lane < BVH_PACKET_SIZE; ++lane) {
+        double tMin = (nearX - packet.originX[lane]) * packet.invDirX[lane];
+        double tMax = (farX - packet.originX[lane]) * packet.invDirX[lane] * precalc_1_2_gamma3;
+        double tyMin = (nearY - packet.originY[lane]) * packet.invDirY[lane];
+        double tyMax = (farY - packet.originY[lane]) * packet.invDirY[lane] * precalc_1_2_gamma3;
+        bool miss = (tMin > tyMax) || (tyMin > tMax);
+        if (tyMin > tMin) tMin = tyMin;
+        if (tyMax < tMax) tMax = tyMax;
+
+        double tzMin = (nearZ - packet.originZ[lane]) * packet.invDirZ[lane];
+        double tzMax = (farZ - packet.originZ[lane]) * packet.invDirZ[lane] * precalc_1_2_gamma3;
+        miss = miss || (tMin > tzMax) || (tzMin > tMax);
+        if (tzMin > tMin) tMin = tzMin;
+        if (tzMax < tMax) tMax = tzMax;
+
+        if (!miss && (tMin < packet.tMax[lane]) && (tMax > 0))
+            hitMask |= (1 << lane);
+    }
+    return hitMask & activeMask;
+#endif
+}
+
+//! Tests one ray against 4 child boxes given as structure-of-arrays, returns the hit mask and entry distances
+//! near/far point to the min or max lanes of each axis, chosen by the ray direction
+static inline int IntersectBoxLanes(const double *nearX, const double *farX, const double *nearY, const double *farY,
+                                    const double *nearZ, const double *farZ, const Ray &ray, const Vector3d &invDir, double *entryDist) {
+    constexpr double precalc_1_2_gamma3 = 1 + 2 * gamma(3);
+#if defined(__AVX__)
+    const __m256d gamma3 = _mm256_set1_pd(precalc_1_2_gamma3);
+    const __m256d ox = _mm256_set1_pd(ray.origin.x), oy = _mm256_set1_pd(ray.origin.y), oz = _mm256_set1_pd(ray.origin.z);
+    const __m256d ix = _mm256_set1_pd(invDir.x), iy = _mm256_set1_pd(invDir.y), iz = _mm256_set1_pd(invDir.z);
+
+    __m256d tMin = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(nearX), ox), ix);
+    __m256d tMax = _mm256_mul_pd(_mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(farX), ox), ix), gamma3);
+    __m256d tyMin = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(nearY), oy), iy);
+    __m256d tyMax = _mm256_mul_pd(_mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(farY), oy), iy), gamma3);
+    __m256d miss = _mm256_or_pd(_mm256_cmp_pd(tMin, tyMax, _CMP_GT_OQ), _mm256_cmp_pd(tyMin, tMax, _CMP_GT_OQ));
+    tMin = _mm256_blendv_pd(tMin, tyMin, _mm256_cmp_pd(tyMin, tMin, _CMP_GT_OQ));
+    tMax = _mm256_blendv_pd(tMax, tyMax, _mm256_cmp_pd(tyMax, tMax, _CMP_LT_OQ));
+
+    __m256d tzMin = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(nearZ), oz), iz);
+    __m256d tzMax = _mm256_mul_pd(_mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(farZ), oz), iz), gamma3);
+    miss = _mm256_or_pd(miss, _mm256_or_pd(_mm256_cmp_pd(tMin, tzMax, _CMP_GT_OQ), _mm256_cmp_pd(tzMin, tMax, _CMP_GT_OQ)));
+    tMin = _mm256_blendv_pd(tMin, tzMin, _mm256_cmp_pd(tzMin, tMin, _CMP_GT_OQ));
+    tMax = _mm256_blendv_pd(tMax, tzMax, _mm256_cmp_pd(tzMax, tMax, _CMP_LT_OQ));
+
+    const __m256d hit = _mm256_and_pd(_mm256_cmp_pd(tMin, _mm256_set1_pd(ray.tMax), _CMP_LT_OQ),
+                                      _mm256_cmp_pd(tMax, _mm256_setzero_pd(), _CMP_GT_OQ));
+    _mm256_storeu_pd(entryDist, tMin);
+    return _mm256_movemask_pd(_mm256_andnot_pd(miss, hit));
+#else
+    int hitMask = 0;
+    for (int lane = 0; lane < 4; ++lane) {
+        double tMin = (nearX[lane] - ray.origin.x) * invDir.x;
+        double tMax = (farX[lane] - ray.origin.x) * invDir.x * precalc_1_2_gamma3;
+        double tyMin = (nearY[lane] - ray.origin.y) * invDir.y;
+        double tyMax = (farY[lane] - ray.origin.y) * invDir.y * precalc_1_2_gamma3;
+        bool miss = (tMin > tyMax) || (tyMin > tMax);
+        if (tyMin > tMin) tMin = tyMin;
+        if (tyMax < tMax) tMax = tyMax;
+
+        double tzMin = (nearZ[lane] - ray.origin.z) * invDir.z;
+        double tzMax = (farZ[lane] - ray.origin.z) * invDir.z * precalc_1_2_gamma3;
+        miss = miss || (tMin > tzMax) || (tzMin > tMax);
+        if (tzMin > tMin) tMin = tzMin;
+        if (tzMax < tMax) tMax = tzMax;
+
+        entryDist[lane] = tMin;
+        if (!miss && (tMin < ray.tMax) && (tMax > 0))
+            hitMask |= (1 << lane);
+    }
+    return hitMask;
+#endif
+}
+
+//! Float counterpart of gamma(): bound on the relative error of n float roundings
+constexpr float gammaFloat(int n) {
+    return (n * std::numeric_limits<float>::epsilon() * 0.5f) / (1 - n * std::numeric_limits<float>::epsilon() * 0.5f);
+}
+
+//! Nearest float not above / not below a double (infinite out of float range), so that boxes and origins can be rounded in a chosen direction
+static inline float RoundDownToFloat(double v) {
+    if (v < -std::numeric_limits<float>::max()) return -std::numeric_limits<float>::infinity();
+    float f = (float) std::min(v, (double) std::numeric_limits<float>::max());
+    return (double) f > v ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+static inline float RoundUpToFloat(double v) {
+    if (v > std::numeric_limits<float>::max()) return std::numeric_limits<float>::infinity();
+    float f = (float) std::max(v, (double) -std::numeric_limits<float>::max());
+    return (double) f < v ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
+/**
+* \brief Ray data for IntersectBoxLanesFloat(), set up once per ray
+ * The origin is rounded once per plane type, so that the distance to a near plane can only be under-, to a far plane only over-estimated
+ * The ray's tMax isn't part of it, as it shrinks with every hit found during traversal
+ */
+struct FloatBoxRay {
+    float nearOrigin[3], farOrigin[3];
+    float invDir[3];
+
+    FloatBoxRay() = default;
+    FloatBoxRay(const Ray &ray, const Vector3d &invDir, const int dirIsNeg[3]) {
+        for (int k = 0; k < 3; ++k) {
+            nearOrigin[k] = dirIsNeg[k] ? RoundDownToFloat(ray.origin[k]) : RoundUpToFloat(ray.origin[k]);
+            farOrigin[k] = dirIsNeg[k] ? RoundUpToFloat(ray.origin[k]) : RoundDownToFloat(ray.origin[k]);
+            this->invDir[k] = (float) invDir[k];
+        }
+    }
+};
+
+/**
+* \brief Tests one ray against 4 or 8 child boxes stored as floats rounded outward, returns the hit mask and entry distances
+ * Conservative: boxes and origins are rounded outward, and entry/exit distances are widened by the float error bound,
+ * so a box hit by the exact ray is never culled. Spurious hits only cost a facet test, which stays in double.
+ * \param tMax current ray.tMax rounded up
+ */
+static inline int IntersectBoxLanesFloat(const float *nearX, const float *farX, const float *nearY, const float *farY,
+                                         const float *nearZ, const float *farZ, const FloatBoxRay &ray, float tMax, float *entryDist, int nbLanes) {
+    constexpr float scaleDown = 1 - 2 * gammaFloat(5), scaleUp = 1 + 2 * gammaFloat(5);
+#if defined(__AVX__)
+    if (nbLanes == 8) {
+        __m256 tNear = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(nearX), _mm256_set1_ps(ray.nearOrigin[0])), _mm256_set1_ps(ray.invDir[0]));
+        __m256 tFar = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(farX), _mm256_set1_ps(ray.farOrigin[0])), _mm256_set1_ps(ray.invDir[0]));
+        tNear = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(nearY), _mm256_set1_ps(ray.nearOrigin[1])), _mm256_set1_ps(ray.invDir[1])), tNear);
+        tFar = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(farY), _mm256_set1_ps(ray.farOrigin[1])), _mm256_set1_ps(ray.invDir[1])), tFar);
+        tNear = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(nearZ), _mm256_set1_ps(ray.nearOrigin[2])), _mm256_set1_ps(ray.invDir[2])), tNear);
+        tFar = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(farZ), _mm256_set1_ps(ray.farOrigin[2])), _mm256_set1_ps(ray.invDir[2])), tFar);
+        tNear = _mm256_mul_ps(tNear, _mm256_set1_ps(scaleDown));
+        tFar = _mm256_mul_ps(tFar, _mm256_set1_ps(scaleUp));
+        const __m256 hit = _mm256_and_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ),
+                                         _mm256_and_ps(_mm256_cmp_ps(tNear, _mm256_set1_ps(tMax), _CMP_LT_OQ),
+                                                       _mm256_cmp_ps(tFar, _mm256_setzero_ps(), _CMP_GT_OQ)));
+        _mm256_storeu_ps(entryDist, tNear);
+        return _mm256_movemask_ps(hit);
+    }
+    __m128 tNear = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearX), _mm_set1_ps(ray.nearOrigin[0])), _mm_set1_ps(ray.invDir[0]));
+    __m128 tFar = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farX), _mm_set1_ps(ray.farOrigin[0])), _mm_set1_ps(ray.invDir[0]));
+    tNear = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearY), _mm_set1_ps(ray.nearOrigin[1])), _mm_set1_ps(ray.invDir[1])), tNear);
+    tFar = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farY), _mm_set1_ps(ray.farOrigin[1])), _mm_set1_ps(ray.invDir[1])), tFar);
+    tNear = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearZ), _mm_set1_ps(ray.nearOrigin[2])), _mm_set1_ps(ray.invDir[2])), tNear);
+    tFar = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farZ), _mm_set1_ps(ray.farOrigin[2])), _mm_set1_ps(ray.invDir[2])), tFar);
+    tNear = _mm_mul_ps(tNear, _mm_set1_ps(scaleDown));
+    tFar = _mm_mul_ps(tFar, _mm_set1_ps(scaleUp));
+    const __m128 hit = _mm_and_ps(_mm_cmple_ps(tNear, tFar),
+                                  _mm_and_ps(_mm_cmplt_ps(tNear, _mm_set1_ps(tMax)), _mm_cmpgt_ps(tFar, _mm_setzero_ps())));
+    _mm_storeu_ps(entryDist, tNear);
+    return _mm_movemask_ps(hit);
+#else
+    int hitMask = 0;
+    for (int lane = 0; lane < nbLanes; ++lane) {
+        // Same NaN behaviour as the max/min instructions above: a NaN candidate never replaces the current distance
+        float tNear = (nearX[lane] - ray.nearOrigin[0]) * ray.invDir[0];
+        float tFar = (farX[lane] - ray.farOrigin[0]) * ray.invDir[0];
+        float t = (nearY[lane] - ray.nearOrigin[1]) * ray.invDir[1];
+        if (t > tNear) tNear = t;
+        t = (farY[lane] - ray.farOrigin[1]) * ray.invDir[1];
+        if (t < tFar) tFar = t;
+        t = (nearZ[lane] - ray.nearOrigin[2]) * ray.invDir[2];
+        if (t > tNear) tNear = t;
+        t = (farZ[lane] - ray.farOrigin[2]) * ray.invDir[2];
+        if (t < tFar) tFar = t;
+        tNear *= scaleDown;
+        tFar *= scaleUp;
+
+        entryDist[lane] = tNear;
+        if ((tNear <= tFar) && (tNear < tMax) && (tFar > 0))
+            hitMask |= (1 << lane);
+    }
+    return hitMask;
+#endif
+}
+
 int BVHAccel::SplitEqualCounts(std::vector<BVHPrimitiveInfo> &primitiveInfo, int start,
                                int end, int dim) {
     //<<Partition primitives into equally sized subsets>>
@@ -286,14 +678,32 @@ int BVHAccel::SplitSAH(std::vector<BVHPrimitiveInfo> &primitiveInfo, int start,
         };
         BucketInfo buckets[nBuckets];
         //<<Initialize BucketInfo for SAH partition buckets>>
-        for (int i = start; i < end; ++i) {
-            int b = nBuckets *
-                    centroidBounds.Offset(primitiveInfo[i].centroid)[dim];
-            if (b == nBuckets) b = nBuckets - 1;
-            assert(b >= 0);
-            assert(b < nBuckets);
-            buckets[b].count++;
-            buckets[b].bounds = AxisAlignedBoundingBox::Union(buckets[b].bounds, primitiveInfo[i].bounds);
+        auto fillBuckets = [&](BucketInfo *bins, int binStart, int binEnd) {
+            for (int i = binStart; i < binEnd; ++i) {
+                int b = nBuckets *
+                        centroidBounds.Offset(primitiveInfo[i].centroid)[dim];
+                if (b == nBuckets) b = nBuckets - 1;
+                assert(b >= 0);
+                assert(b < nBuckets);
+                bins[b].count++;
+                bins[b].bounds = AxisAlignedBoundingBox::Union(bins[b].bounds, primitiveInfo[i].bounds);
+            }
+        };
+        if (nPrimitives > BVH_PARALLEL_BIN_THRESHOLD) {
+            // Counts and box unions are exact, so merged chunks give the same buckets as the serial loop
+            std::vector<std::array<BucketInfo, nBuckets>> partialBuckets;
+            ForEachChunkParallel(start, end, partialBuckets,
+                                 [&](std::array<BucketInfo, nBuckets> &bins, int binStart, int binEnd) {
+                                     fillBuckets(bins.data(), binStart, binEnd);
+                                 });
+            for (const auto &bins : partialBuckets) {
+                for (int b = 0; b < nBuckets; ++b) {
+                    buckets[b].count += bins[b].count;
+                    buckets[b].bounds = AxisAlignedBoundingBox::Union(buckets[b].bounds, bins[b].bounds);
+                }
+            }
+        } else {
+            fillBuckets(buckets, start, end);
         }
 
         //<<Compute costs for splitting after each bucket>>
@@ -341,12 +751,60 @@ int BVHAccel::SplitSAH(std::vector<BVHPrimitiveInfo> &primitiveInfo, int start,
 
 BVHAccel::BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
                    int maxPrimsInNode, SplitMethod splitMethod,
-                   const std::vector<double> &probabilities)
+                   const std::vector<double> &probabilities, int nodeWidth, bool floatBounds)
         : maxPrimsInNode(std::min(255, maxPrimsInNode)),
           splitMethod(splitMethod),
-          primitives(std::move(p)) {
+          primitives(std::move(p)),
+          nodeWidth(nodeWidth <= 2 ? 2 : (nodeWidth <= 4 ? 4 : BVH_MAX_WIDTH)),
+          floatBounds(floatBounds && this->nodeWidth > 2) {
 
     nodes = nullptr;
+    if (splitMethod == SplitMethod::ProbSplit)
+        buildProbabilities = probabilities; // kept for rebuilds from Refit()
+    Build(probabilities);
+}
+
+/**
+* \brief Rebuilds the tree with ProbSplit and the given hit probabilities, keeping leaf size and node width
+ * \param probabilities per-facet hit probabilities (indexed by globalId), see HitCountsToProbabilities()
+ */
+void BVHAccel::Rebuild(const std::vector<double> &probabilities) {
+    splitMethod = SplitMethod::ProbSplit;
+    buildProbabilities = probabilities;
+    Build(buildProbabilities);
+}
+
+/**
+* \brief Normalizes per-facet hit counts into split probabilities for ProbSplit and the kd-tree
+ * Counts are smoothed with one extra hit per facet, so facets missed by a short pilot run keep a small weight
+ * \return probabilities summing up to 1, indexed like hitCounts
+ */
+std::vector<double> HitCountsToProbabilities(const std::vector<size_t> &hitCounts) {
+    std::vector<double> probabilities(hitCounts.size(), 0.0);
+    double total = 0.0;
+    for (const auto count : hitCounts) total += (double) count + 1.0;
+    for (size_t i = 0; i < hitCounts.size(); ++i)
+        probabilities[i] = ((double) hitCounts[i] + 1.0) / total;
+    return probabilities;
+}
+
+/**
+* \brief Builds the tree from scratch over the current primitives, replacing a previous tree
+ * \param probabilities per-facet hit probabilities (indexed by globalId), only used for ProbSplit
+ */
+void BVHAccel::Build(const std::vector<double> &probabilities) {
+    if (nodes) {
+        delete[] nodes;
+        nodes = nullptr;
+    }
+    totalNodes = 0;
+    wideNodes.clear();
+    wideBounds.clear();
+    wideBoundsFloat.clear();
+    compactFacets.clear();
+    compactVertices.clear();
+    compactEdges.clear();
+    compactPolyGrids.clear();
     if (primitives.empty())
         return;
     STATS::_reset();
@@ -365,36 +823,60 @@ BVHAccel::BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
             primitiveInfo[i] = {i, primitives[i]->sh.bb};
     }
     //<<Build BVH tree for primitives using primitiveInfo>>
-    //MemoryArena arena(1024 * 1024);
-    int totalNodes = 0;
-    std::vector<std::shared_ptr<Primitive>> orderedPrims;
+    double buildStart = omp_get_wtime();
+    BVHBuildArena arena(primitives.size());
+    // Leaves write their primitives to their own [start,end) range, so parallel subtrees need no synchronisation
+    std::vector<std::shared_ptr<Primitive>> orderedPrims(primitives.size());
     BVHBuildNode *root;
-    /*if (splitMethod == SplitMethod::HLBVH)
-        root = HLBVHBuild(arena, primitiveInfo, &totalNodes, orderedPrims);
-    else
-        */
-    root = recursiveBuild(/*arena,*/ primitiveInfo, 0, primitives.size(),
-                                     &totalNodes, orderedPrims);
+    if (splitMethod == SplitMethod::HLBVH) {
+        root = HLBVHBuild(arena, primitiveInfo, orderedPrims);
+    }
+    else {
+#pragma omp parallel
+#pragma omp single
+        root = recursiveBuild(arena, primitiveInfo, 0, primitives.size(), orderedPrims);
+    }
     primitives.swap(orderedPrims);
+    totalNodes = arena.NbAllocated();
 
     Log::console_msg_master(4, "BVH created with {} nodes for {} "
-           "primitives ({:.2f} MB)\n",
+           "primitives ({:.2f} MB) in {:.2f} ms\n",
            totalNodes, (int) primitives.size(),
            float(totalNodes * sizeof(LinearBVHNode)) /
-           (1024.f * 1024.f));
+           (1024.f * 1024.f), (omp_get_wtime() - buildStart) * 1000.0);
     //<<Compute representation of depth-first traversal of BVH tree>>
     nodes = new LinearBVHNode[totalNodes]; //AllocAligned<LinearBVHNode>(totalNodes);
     int offset = 0;
     flattenBVHTree(root, &offset);
     assert(totalNodes == offset);
+    buildSAHCost = SAHCost();
+    ComputeBB();
+    buildCompactFacets();
 
-    delete root;
-
+    Log::console_msg_master(4, "BVH leaf facets: {:.2f} MB compact ({} bytes/facet avg.)\n",
+           float(compactFacets.size() * sizeof(CompactFacet) + compactVertices.size() * sizeof(Vector2d)
+                 + compactEdges.size() * sizeof(double)) / (1024.f * 1024.f),
+           (compactFacets.size() * sizeof(CompactFacet) + compactVertices.size() * sizeof(Vector2d)
+            + compactEdges.size() * sizeof(double)) / primitives.size());
     Log::console_msg_master(4,"--- BVH STATS ---\n");
-    Log::console_msg_master(4," Total Primitives: {}\n", STATS::totalPrimitives);
-    Log::console_msg_master(4," Total Leaf Nodes: {}\n", STATS::totalLeafNodes);
-    Log::console_msg_master(4," Interior Nodes:   {}\n", STATS::interiorNodes);
-    Log::console_msg_master(4," Leaf Nodes:       {}\n", STATS::leafNodes);
+    Log::console_msg_master(4," Total Primitives: {}\n", STATS::totalPrimitives.load());
+    Log::console_msg_master(4," Total Leaf Nodes: {}\n", STATS::totalLeafNodes.load());
+    Log::console_msg_master(4," Interior Nodes:   {}\n", STATS::interiorNodes.load());
+    Log::console_msg_master(4," Leaf Nodes:       {}\n", STATS::leafNodes.load());
+
+    if (this->nodeWidth > 2) {
+        //<<Collapse binary tree to nodeWidth children per node>>
+        wideNodes.reserve(totalNodes / (this->nodeWidth - 1) + 1);
+        wideBounds.reserve(wideNodes.capacity() * 6 * this->nodeWidth);
+        collapseToWide(0);
+        if (floatBounds)
+            convertWideBoundsToFloat();
+        Log::console_msg_master(4, "BVH{} collapsed to {} nodes ({:.2f} MB{})\n",
+               this->nodeWidth, wideNodes.size(),
+               float(wideNodes.size() * sizeof(WideBVHNode) + wideBounds.size() * sizeof(double)
+                     + wideBoundsFloat.size() * sizeof(float)) / (1024.f * 1024.f),
+               floatBounds ? ", float bounds" : "");
+    }
 
 }
 
@@ -405,46 +887,61 @@ BVHAccel::~BVHAccel() {
     }
 };
 
-BVHBuildNode *BVHAccel::recursiveBuild(
+/**
+* \brief Builds the subtree over primitiveInfo[start,end), large subtrees are split into OpenMP tasks
+ * Leaf primitives go to orderedPrims[start,end), the same slots a serial depth-first build would fill
+ */
+BVHBuildNode *BVHAccel::recursiveBuild(BVHBuildArena &arena,
         std::vector<BVHPrimitiveInfo> &primitiveInfo, int start,
-        int end, int *totalNodes,
-        std::vector<std::shared_ptr<Primitive>> &orderedPrims) {
+        int end, std::vector<std::shared_ptr<Primitive>> &orderedPrims) {
     assert(start != end);
 
-    BVHBuildNode *node = new BVHBuildNode();//arena.Alloc<BVHBuildNode>();
-    (*totalNodes)++;
+    BVHBuildNode *node = arena.Alloc();
     //<<Compute bounds of all primitives in BVH node>>
+    int nPrimitives = end - start;
     AxisAlignedBoundingBox bounds;
-    for (int i = start; i < end; ++i)
-        bounds = AxisAlignedBoundingBox::Union(bounds, primitiveInfo[i].bounds);
+    AxisAlignedBoundingBox centroidBounds;
+    if (nPrimitives > BVH_PARALLEL_BIN_THRESHOLD) {
+        std::vector<std::pair<AxisAlignedBoundingBox, AxisAlignedBoundingBox>> partialBounds;
+        ForEachChunkParallel(start, end, partialBounds,
+                             [&](std::pair<AxisAlignedBoundingBox, AxisAlignedBoundingBox> &partial, int chunkStart, int chunkEnd) {
+                                 for (int i = chunkStart; i < chunkEnd; ++i) {
+                                     partial.first = AxisAlignedBoundingBox::Union(partial.first, primitiveInfo[i].bounds);
+                                     partial.second = AxisAlignedBoundingBox::Union(partial.second, primitiveInfo[i].centroid);
+                                 }
+                             });
+        for (const auto &partial : partialBounds) {
+            bounds = AxisAlignedBoundingBox::Union(bounds, partial.first);
+            centroidBounds = AxisAlignedBoundingBox::Union(centroidBounds, partial.second);
+        }
+    } else {
+        for (int i = start; i < end; ++i) {
+            bounds = AxisAlignedBoundingBox::Union(bounds, primitiveInfo[i].bounds);
+            centroidBounds = AxisAlignedBoundingBox::Union(centroidBounds, primitiveInfo[i].centroid);
+        }
+    }
 
-    int nPrimitives = end - start;
     if (nPrimitives == 1) {
         //<<Create leaf BVHBuildNode>>
-        int firstPrimOffset = orderedPrims.size();
         for (int i = start; i < end; ++i) {
             int primNum = primitiveInfo[i].primitiveNumber;
-            orderedPrims.push_back(primitives[primNum]);
+            orderedPrims[i] = primitives[primNum];
         }
-        node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
+        node->InitLeaf(start, nPrimitives, bounds);
         return node;
     } else {
-        //<<Compute bound of primitive centroids, choose split dimension dim>>
-        AxisAlignedBoundingBox centroidBounds;
-        for (int i = start; i < end; ++i)
-            centroidBounds = AxisAlignedBoundingBox::Union(centroidBounds, primitiveInfo[i].centroid);
+        //<<Choose split dimension dim>>
         int dim = centroidBounds.MaximumExtent();
 
         //<<Partition primitives into two sets and build children>>
         int mid = (start + end) / 2;
         if (centroidBounds.max[dim] == centroidBounds.min[dim]) {
             //<<Create leaf BVHBuildNode>>
-            int firstPrimOffset = orderedPrims.size();
             for (int i = start; i < end; ++i) {
                 int primNum = primitiveInfo[i].primitiveNumber;
-                orderedPrims.push_back(primitives[primNum]);
+                orderedPrims[i] = primitives[primNum];
             }
-            node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
+            node->InitLeaf(start, nPrimitives, bounds);
             return node;
         } else {
             //<<Partition primitives based on splitMethod>>
@@ -489,25 +986,212 @@ BVHBuildNode *BVHAccel::recursiveBuild(
 
             if (mid < 0 || nPrimitives <= maxPrimsInNode) {
                 // Create leaf node, when max prims are reached
-                int firstPrimOffset = orderedPrims.size();
                 for (int i = start; i < end; ++i) {
                     int primNum = primitiveInfo[i].primitiveNumber;
-                    orderedPrims.push_back(primitives[primNum]);
+                    orderedPrims[i] = primitives[primNum];
                 }
-                node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
+                node->InitLeaf(start, nPrimitives, bounds);
                 return node;
             }
 
-            node->InitInterior(dim,
-                               recursiveBuild(primitiveInfo, start, mid,
-                                              totalNodes, orderedPrims),
-                               recursiveBuild(primitiveInfo, mid, end,
-                                              totalNodes, orderedPrims));
+            // Children work on disjoint ranges, so the left one can run as a task
+            BVHBuildNode *children[2];
+            if (mid - start > BVH_TASK_THRESHOLD) {
+#pragma omp task default(shared)
+                children[0] = recursiveBuild(arena, primitiveInfo, start, mid, orderedPrims);
+                children[1] = recursiveBuild(arena, primitiveInfo, mid, end, orderedPrims);
+#pragma omp taskwait
+            } else {
+                children[0] = recursiveBuild(arena, primitiveInfo, start, mid, orderedPrims);
+                children[1] = recursiveBuild(arena, primitiveInfo, mid, end, orderedPrims);
+            }
+            node->InitInterior(dim, children[0], children[1]);
         }
     }
     return node;
 }
 
+/**
+* \brief Linear BVH build: primitives sorted by Morton code, treelets emitted in parallel, SAH over the treelet roots
+ * Leaf primitives keep their Morton order, so each leaf points to its own range of orderedPrims
+ */
+BVHBuildNode *BVHAccel::HLBVHBuild(BVHBuildArena &arena,
+        const std::vector<BVHPrimitiveInfo> &primitiveInfo,
+        std::vector<std::shared_ptr<Primitive>> &orderedPrims) {
+    //<<Compute bounding box of all primitive centroids>>
+    AxisAlignedBoundingBox bounds;
+    for (const BVHPrimitiveInfo &pi : primitiveInfo)
+        bounds = AxisAlignedBoundingBox::Union(bounds, pi.centroid);
+
+    //<<Compute Morton indices of primitives>>
+    const int bitsPerAxis = primitiveInfo.size() < HLBVH_WIDE_CODE_THRESHOLD ? 10 : 21;
+    const int nbCodeBits = 3 * bitsPerAxis;
+    const double mortonScale = (double) (1 << bitsPerAxis);
+    const uint64_t maxCoord = (1 << bitsPerAxis) - 1;
+    std::vector<MortonPrimitive> mortonPrims(primitiveInfo.size());
+#pragma omp parallel for
+    for (int i = 0; i < (int) primitiveInfo.size(); ++i) {
+        mortonPrims[i].primitiveIndex = (int) primitiveInfo[i].primitiveNumber;
+        Vector3d centroidOffset = bounds.Offset(primitiveInfo[i].centroid);
+        mortonPrims[i].mortonCode = EncodeMorton3(std::min(maxCoord, (uint64_t) (centroidOffset.x * mortonScale)),
+                                                  std::min(maxCoord, (uint64_t) (centroidOffset.y * mortonScale)),
+                                                  std::min(maxCoord, (uint64_t) (centroidOffset.z * mortonScale)));
+    }
+
+    //<<Radix sort primitive Morton indices>>
+    RadixSort(mortonPrims, nbCodeBits);
+
+    //<<Create LBVH treelets at bottom of BVH>>
+    //<<Find intervals of primitives for each treelet>>
+    std::vector<LBVHTreelet> treeletsToBuild;
+    const uint64_t treeletMask = ((uint64_t(1) << HLBVH_TREELET_BITS) - 1) << (nbCodeBits - HLBVH_TREELET_BITS);
+    for (int start = 0, end = 1; end <= (int) mortonPrims.size(); ++end) {
+        if (end == (int) mortonPrims.size() ||
+            ((mortonPrims[start].mortonCode & treeletMask) != (mortonPrims[end].mortonCode & treeletMask))) {
+            treeletsToBuild.push_back({start, end - start, nullptr});
+            start = end;
+        }
+    }
+
+    //<<Create LBVHs for treelets in parallel>>
+    const int firstBitIndex = nbCodeBits - 1 - HLBVH_TREELET_BITS;
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < (int) treeletsToBuild.size(); ++i) {
+        LBVHTreelet &treelet = treeletsToBuild[i];
+        treelet.root = emitLBVH(arena, primitiveInfo, mortonPrims, treelet.startIndex, treelet.nPrimitives,
+                                orderedPrims, firstBitIndex);
+    }
+
+    //<<Create and return SAH BVH from LBVH treelets>>
+    std::vector<BVHBuildNode *> finishedTreelets;
+    finishedTreelets.reserve(treeletsToBuild.size());
+    for (LBVHTreelet &treelet : treeletsToBuild)
+        finishedTreelets.push_back(treelet.root);
+    return buildUpperSAH(arena, finishedTreelets, 0, finishedTreelets.size());
+}
+
+//! Recursively splits a Morton-sorted range at the first code bit that differs, starting from bitIndex
+BVHBuildNode *BVHAccel::emitLBVH(BVHBuildArena &arena,
+        const std::vector<BVHPrimitiveInfo> &primitiveInfo,
+        const std::vector<MortonPrimitive> &mortonPrims, int start, int nPrimitives,
+        std::vector<std::shared_ptr<Primitive>> &orderedPrims, int bitIndex) {
+    assert(nPrimitives > 0);
+    if (bitIndex == -1 || nPrimitives <= maxPrimsInNode) {
+        //<<Create and return leaf node of LBVH treelet>>
+        BVHBuildNode *node = arena.Alloc();
+        AxisAlignedBoundingBox bounds;
+        for (int i = start; i < start + nPrimitives; ++i) {
+            int primitiveIndex = mortonPrims[i].primitiveIndex;
+            orderedPrims[i] = primitives[primitiveIndex];
+            bounds = AxisAlignedBoundingBox::Union(bounds, primitiveInfo[primitiveIndex].bounds);
+        }
+        node->InitLeaf(start, nPrimitives, bounds);
+        return node;
+    } else {
+        const uint64_t mask = uint64_t(1) << bitIndex;
+        //<<Advance to next subtree level if there is no LBVH split for this bit>>
+        if ((mortonPrims[start].mortonCode & mask) == (mortonPrims[start + nPrimitives - 1].mortonCode & mask))
+            return emitLBVH(arena, primitiveInfo, mortonPrims, start, nPrimitives, orderedPrims, bitIndex - 1);
+
+        //<<Find LBVH split point for this dimension>>
+        int searchStart = start, searchEnd = start + nPrimitives - 1;
+        while (searchStart + 1 != searchEnd) {
+            int mid = (searchStart + searchEnd) / 2;
+            if ((mortonPrims[searchStart].mortonCode & mask) == (mortonPrims[mid].mortonCode & mask))
+                searchStart = mid;
+            else
+                searchEnd = mid;
+        }
+        const int splitOffset = searchEnd;
+
+        //<<Create and return interior LBVH node>>
+        BVHBuildNode *node = arena.Alloc();
+        BVHBuildNode *lbvh[2] = {
+                emitLBVH(arena, primitiveInfo, mortonPrims, start, splitOffset - start, orderedPrims, bitIndex - 1),
+                emitLBVH(arena, primitiveInfo, mortonPrims, splitOffset, start + nPrimitives - splitOffset, orderedPrims, bitIndex - 1)};
+        int axis = bitIndex % 3;
+        node->InitInterior(axis, lbvh[0], lbvh[1]);
+        return node;
+    }
+}
+
+//! Binned SAH build over the treelet roots, forming the upper levels of the HLBVH
+BVHBuildNode *BVHAccel::buildUpperSAH(BVHBuildArena &arena,
+        std::vector<BVHBuildNode *> &treeletRoots, int start, int end) {
+    assert(start < end);
+    int nNodes = end - start;
+    if (nNodes == 1) return treeletRoots[start];
+
+    BVHBuildNode *node = arena.Alloc();
+    //<<Compute bounds of all nodes under this HLBVH node>>
+    AxisAlignedBoundingBox bounds;
+    AxisAlignedBoundingBox centroidBounds;
+    for (int i = start; i < end; ++i) {
+        bounds = AxisAlignedBoundingBox::Union(bounds, treeletRoots[i]->bounds);
+        centroidBounds = AxisAlignedBoundingBox::Union(centroidBounds,
+                                                       .5 * treeletRoots[i]->bounds.min + .5 * treeletRoots[i]->bounds.max);
+    }
+    int dim = centroidBounds.MaximumExtent();
+
+    int mid = (start + end) / 2;
+    if (centroidBounds.max[dim] != centroidBounds.min[dim]) {
+        //<<Compute costs for splitting after each bucket>>
+        constexpr int nBuckets = 12;
+        struct BucketInfo {
+            int count = 0;
+            AxisAlignedBoundingBox bounds;
+        };
+        BucketInfo buckets[nBuckets];
+        auto bucketOf = [&](const BVHBuildNode *n) {
+            double centroid = (n->bounds.min[dim] + n->bounds.max[dim]) * 0.5;
+            int b = nBuckets * ((centroid - centroidBounds.min[dim]) / (centroidBounds.max[dim] - centroidBounds.min[dim]));
+            if (b == nBuckets) b = nBuckets - 1;
+            assert(b >= 0);
+            assert(b < nBuckets);
+            return b;
+        };
+        for (int i = start; i < end; ++i) {
+            int b = bucketOf(treeletRoots[i]);
+            buckets[b].count++;
+            buckets[b].bounds = AxisAlignedBoundingBox::Union(buckets[b].bounds, treeletRoots[i]->bounds);
+        }
+
+        double minCost = 1.0e99;
+        int minCostSplitBucket = 0;
+        for (int i = 0; i < nBuckets - 1; ++i) {
+            AxisAlignedBoundingBox b0, b1;
+            int count0 = 0, count1 = 0;
+            for (int j = 0; j <= i; ++j) {
+                b0 = AxisAlignedBoundingBox::Union(b0, buckets[j].bounds);
+                count0 += buckets[j].count;
+            }
+            for (int j = i + 1; j < nBuckets; ++j) {
+                b1 = AxisAlignedBoundingBox::Union(b1, buckets[j].bounds);
+                count1 += buckets[j].count;
+            }
+            if (count0 == 0 || count1 == 0) continue;
+            double cost = .125 + (count0 * b0.SurfaceArea() + count1 * b1.SurfaceArea()) / bounds.SurfaceArea();
+            if (cost < minCost) {
+                minCost = cost;
+                minCostSplitBucket = i;
+            }
+        }
+
+        //<<Split nodes and create interior HLBVH SAH node>>
+        BVHBuildNode **pmid = std::partition(&treeletRoots[start], &treeletRoots[end - 1] + 1,
+                                             [=](const BVHBuildNode *n) {
+                                                 return bucketOf(n) <= minCostSplitBucket;
+                                             });
+        if (pmid != &treeletRoots[start] && pmid != &treeletRoots[end - 1] + 1)
+            mid = pmid - &treeletRoots[0];
+    }
+
+    node->InitInterior(dim,
+                       buildUpperSAH(arena, treeletRoots, start, mid),
+                       buildUpperSAH(arena, treeletRoots, mid, end));
+    return node;
+}
+
 int BVHAccel::flattenBVHTree(BVHBuildNode *node, int *offset) {
     LinearBVHNode *linearNode = &nodes[*offset];
     linearNode->bounds = node->bounds;
@@ -528,14 +1212,248 @@ int BVHAccel::flattenBVHTree(BVHBuildNode *node, int *offset) {
     return myOffset;
 }
 
+/**
+* \brief Creates a wide node from a binary subtree, by repeatedly opening the child with the largest surface area
+ * \return index of the new node in wideNodes
+ */
+int BVHAccel::collapseToWide(int binaryNodeIndex) {
+    int children[BVH_MAX_WIDTH];
+    int nbChildren = 0;
+    const LinearBVHNode &binaryNode = nodes[binaryNodeIndex];
+    if (binaryNode.nPrimitives > 0) {
+        children[nbChildren++] = binaryNodeIndex; // single leaf tree
+    } else {
+        children[nbChildren++] = binaryNodeIndex + 1;
+        children[nbChildren++] = binaryNode.secondChildOffset;
+    }
+    while (nbChildren < nodeWidth) {
+        int bestChild = -1;
+        double bestArea = -1.0;
+        for (int c = 0; c < nbChildren; ++c) {
+            const LinearBVHNode &child = nodes[children[c]];
+            if (child.nPrimitives == 0 && child.bounds.SurfaceArea() > bestArea) {
+                bestArea = child.bounds.SurfaceArea();
+                bestChild = c;
+            }
+        }
+        if (bestChild < 0) break; // only leaves left
+        const int opened = children[bestChild];
+        children[bestChild] = opened + 1;
+        children[nbChildren++] = nodes[opened].secondChildOffset;
+    }
+
+    const int wideIndex = (int) wideNodes.size();
+    wideNodes.emplace_back();
+    wideBounds.resize(wideBounds.size() + 6 * nodeWidth);
+    // Pad unused lanes with a degenerate box, they are masked out by nbChildren anyway
+    for (int c = nbChildren; c < nodeWidth; ++c) {
+        for (int k = 0; k < 6; ++k)
+            wideBounds[(size_t) wideIndex * 6 * nodeWidth + k * nodeWidth + c] = 0.0;
+    }
+
+    wideNodes[wideIndex].nbChildren = (uint8_t) nbChildren;
+    for (int c = 0; c < nbChildren; ++c) {
+        const LinearBVHNode &child = nodes[children[c]];
+        double *lanes = &wideBounds[(size_t) wideIndex * 6 * nodeWidth];
+        lanes[0 * nodeWidth + c] = child.bounds.min.x;
+        lanes[1 * nodeWidth + c] = child.bounds.min.y;
+        lanes[2 * nodeWidth + c] = child.bounds.min.z;
+        lanes[3 * nodeWidth + c] = child.bounds.max.x;
+        lanes[4 * nodeWidth + c] = child.bounds.max.y;
+        lanes[5 * nodeWidth + c] = child.bounds.max.z;
+        if (child.nPrimitives > 0) {
+            wideNodes[wideIndex].childOffset[c] = child.primitivesOffset;
+            wideNodes[wideIndex].nPrimitives[c] = child.nPrimitives;
+        } else {
+            const int grandChild = collapseToWide(children[c]); // may reallocate wideNodes
+            wideNodes[wideIndex].childOffset[c] = grandChild;
+            wideNodes[wideIndex].nPrimitives[c] = 0;
+        }
+    }
+    return wideIndex;
+}
+
+/**
+* \brief Surface area heuristic cost of the whole tree, relative to the area of the root box
+ * Uses the same relative traversal cost (0.5) as the SAH split evaluation
+ */
+double BVHAccel::SAHCost() const {
+    if (!nodes) return 0.0;
+    const double rootArea = nodes[0].bounds.SurfaceArea();
+    if (rootArea <= 0.0) return 0.0;
+    double cost = 0.0;
+    for (int i = 0; i < totalNodes; ++i) {
+        const LinearBVHNode &node = nodes[i];
+        cost += node.bounds.SurfaceArea() * (node.nPrimitives > 0 ? (double) node.nPrimitives : 0.5);
+    }
+    return cost / rootArea;
+}
+
+/**
+* \brief Replaces the double child boxes of the wide tree by floats, min planes rounded down and max planes rounded up
+ * Rounding outward only grows the boxes, so together with IntersectBoxLanesFloat() no hit is ever missed
+ */
+void BVHAccel::convertWideBoundsToFloat() {
+    wideBoundsFloat.resize(wideBounds.size());
+    const size_t blockSize = nodeWidth;
+    for (size_t i = 0; i < wideBounds.size(); ++i) {
+        const bool isMax = (i / blockSize) % 6 >= 3;
+        wideBoundsFloat[i] = isMax ? RoundUpToFloat(wideBounds[i]) : RoundDownToFloat(wideBounds[i]);
+    }
+    wideBounds.clear();
+    wideBounds.shrink_to_fit();
+}
+
+size_t BVHAccel::GetMemSize() const {
+    size_t sum = sizeof(*this);
+    sum += totalNodes * sizeof(LinearBVHNode);
+    sum += primitives.capacity() * sizeof(std::shared_ptr<Primitive>);
+    sum += buildProbabilities.capacity() * sizeof(double);
+    sum += wideNodes.capacity() * sizeof(WideBVHNode);
+    sum += wideBounds.capacity() * sizeof(double);
+    sum += wideBoundsFloat.capacity() * sizeof(float);
+    sum += compactFacets.capacity() * sizeof(CompactFacet);
+    sum += compactVertices.capacity() * sizeof(Vector2d);
+    sum += compactEdges.capacity() * sizeof(double);
+    sum += compactPolyGrids.capacity() * sizeof(std::shared_ptr<PolyGrid>);
+    return sum;
+}
+
+/**
+* \brief Updates node bounds after primitives moved (their sh.bb has to be up to date), keeping the tree topology
+ * If the SAH cost grew by more than maxCostRatio compared to the last build, the tree is rebuilt instead
+ * \return true if refitted, false if a full rebuild was done
+ */
+bool BVHAccel::Refit(double maxCostRatio) {
+    if (!nodes) return true;
+    double refitStart = omp_get_wtime();
+    //<<Recompute bounds bottom-up, children are stored after their parent in depth-first order>>
+    for (int i = totalNodes - 1; i >= 0; --i) {
+        LinearBVHNode &node = nodes[i];
+        if (node.nPrimitives > 0) {
+            AxisAlignedBoundingBox bounds;
+            for (int p = 0; p < node.nPrimitives; ++p)
+                bounds = AxisAlignedBoundingBox::Union(bounds, primitives[node.primitivesOffset + p]->sh.bb);
+            node.bounds = bounds;
+        } else {
+            node.bounds = AxisAlignedBoundingBox::Union(nodes[i + 1].bounds, nodes[node.secondChildOffset].bounds);
+        }
+    }
+
+    const double cost = SAHCost();
+    if (buildSAHCost <= 0.0) {
+        buildSAHCost = cost; // degenerate (flat) build bounds, the first refit gives the reference
+    }
+    else if (cost > maxCostRatio * buildSAHCost) {
+        Log::console_msg_master(4, "BVH refit degraded SAH cost from {:.2f} to {:.2f}, rebuilding\n",
+               buildSAHCost, cost);
+        Build(buildProbabilities);
+        return false;
+    }
+    ComputeBB();
+    buildCompactFacets();
+
+    if (!wideNodes.empty()) {
+        //<<Collapse again, child selection depends on the refitted areas>>
+        wideNodes.clear();
+        wideBounds.clear();
+        collapseToWide(0);
+        if (floatBounds)
+            convertWideBoundsToFloat();
+    }
+    Log::console_msg_master(4, "BVH refitted {} nodes in {:.2f} ms (SAH cost {:.2f}, at build {:.2f})\n",
+           totalNodes, (omp_get_wtime() - refitStart) * 1000.0, cost, buildSAHCost);
+    return true;
+}
+
+/**
+* \brief Replaces the primitives by new objects with the same globalIds, keeping the tree, e.g. after the model was sent again
+ * Call Refit() afterwards, the node bounds and compact data still describe the old objects
+ * \return false (and nothing replaced) if newPrimitives isn't the same set of facets
+ */
+bool BVHAccel::ReplacePrimitives(const std::vector<std::shared_ptr<Primitive>> &newPrimitives) {
+    if (newPrimitives.size() != primitives.size())
+        return false;
+    size_t maxId = 0;
+    for (const auto &prim : newPrimitives)
+        maxId = std::max(maxId, prim->globalId);
+    std::vector<std::shared_ptr<Primitive>> byId(maxId + 1);
+    for (const auto &prim : newPrimitives)
+        byId[prim->globalId] = prim;
+
+    std::vector<std::shared_ptr<Primitive>> replaced(primitives.size());
+    for (size_t i = 0; i < primitives.size(); ++i) {
+        const size_t id = primitives[i]->globalId;
+        if (id > maxId || !byId[id])
+            return false;
+        replaced[i] = std::move(byId[id]); // taken only once, so duplicate ids fail too
+    }
+    primitives.swap(replaced);
+    return true;
+}
+
+/**
+* \brief Copies the intersection data of all primitives, in leaf order, to compactFacets and compactVertices
+ */
+void BVHAccel::buildCompactFacets() {
+    compactFacets.resize(primitives.size());
+    size_t nbVertices = 0;
+    for (const auto &prim : primitives)
+        nbVertices += prim->vertices2.size();
+    compactVertices.resize(nbVertices);
+    size_t nbEdgeEntries = 0;
+    for (const auto &prim : primitives) {
+        if (prim->shape == FacetShape::Polygon && prim->vertices2.size() <= COMPACT_MAX_VERTICES)
+            nbEdgeEntries += PolyEdgeTableSize(prim->vertices2.size());
+    }
+    compactEdges.resize(nbEdgeEntries);
+    compactPolyGrids.clear();
+
+    uint32_t vertexOffset = 0;
+    uint32_t edgeOffset = 0;
+    for (size_t i = 0; i < primitives.size(); ++i) {
+        const RTFacet &prim = *primitives[i];
+        CompactFacet &f = compactFacets[i];
+        f.shape = prim.shape;
+        if (prim.shape == FacetShape::Triangle) {
+            f.O = prim.triP0;
+            f.U = prim.triE1;
+            f.V = prim.triE2;
+        } else {
+            f.O = prim.sh.O;
+            f.U = prim.sh.U;
+            f.V = prim.sh.V;
+        }
+        f.Nuv = prim.sh.Nuv;
+        f.facet = &prim;
+        f.polyGrid = prim.polyGrid.get();
+        if (prim.polyGrid) compactPolyGrids.push_back(prim.polyGrid);
+        f.globalId = (int) prim.globalId;
+        f.vertexOffset = vertexOffset;
+        const bool hasEdgeTable = prim.shape == FacetShape::Polygon && prim.vertices2.size() <= COMPACT_MAX_VERTICES;
+        f.nbVertices = prim.vertices2.size() <= COMPACT_MAX_VERTICES ? (uint16_t) prim.vertices2.size() : 0;
+        f.is2sided = prim.sh.is2sided;
+        std::copy(prim.vertices2.begin(), prim.vertices2.end(), compactVertices.begin() + vertexOffset);
+        vertexOffset += (uint32_t) prim.vertices2.size();
+        f.edgeOffset = edgeOffset;
+        if (hasEdgeTable) {
+            BuildPolyEdgeTable(prim.vertices2.data(), prim.vertices2.size(), &compactEdges[edgeOffset]);
+            edgeOffset += (uint32_t) PolyEdgeTableSize(prim.vertices2.size());
+        }
+    }
+}
+
 void BVHAccel::ComputeBB() {
     bb = nodes ? nodes[0].bounds : AxisAlignedBoundingBox();
 }
 
 bool BVHAccel::Intersect(Ray &ray) {
     if (!nodes) return false;
+    if (!wideNodes.empty()) return IntersectWide(ray);
 
     bool hit = false;
+    size_t nbTransparent = ray.transparentHits.size();
+    uint64_t nbNodes = 0, nbTests = 0;
     Vector3d invDir(1.0 / ray.direction.x, 1.0 / ray.direction.y, 1.0 / ray.direction.z);
     int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
     // Follow ray through BVH nodes to find primitive intersections
@@ -543,15 +1461,18 @@ bool BVHAccel::Intersect(Ray &ray) {
     int nodesToVisit[64];
     while (true) {
         const LinearBVHNode *node = &nodes[currentNodeIndex];
+        ++nbNodes;
         // Check ray against BVH node
         if (IntersectBox(node->bounds,ray, invDir, dirIsNeg)) {
             if (node->nPrimitives > 0) {
                 // Intersect ray with primitives in leaf BVH node
                 for (int i = 0; i < node->nPrimitives; ++i) {
 
-                    const std::shared_ptr<Primitive> &p = primitives[node->primitivesOffset + i];
+                    const CompactFacet &f = compactFacets[node->primitivesOffset + i];
                     // Do not check last collided facet to prevent self intersections
-                    if (p->globalId != ray.lastIntersectedId && p->Intersect(ray)) {
+                    if (f.globalId == ray.lastIntersectedId) continue;
+                    ++nbTests;
+                    if (IntersectCompactFacet(f, compactVertices.data(), compactEdges.data(), ray)) {
                         hit = true;
                     }
                 }
@@ -573,17 +1494,239 @@ bool BVHAccel::Intersect(Ray &ray) {
             currentNodeIndex = nodesToVisit[--toVisitOffset];
         }
     }
+    threadTelemetry.raysTraced++;
+    threadTelemetry.nodesVisited += nbNodes;
+    threadTelemetry.primitiveTests += nbTests;
+    threadTelemetry.transparentPasses += ray.transparentHits.size() - nbTransparent;
+    return hit;
+}
+
+//! Traversal of the collapsed tree: all children of a node are tested at once, then visited near to far
+bool BVHAccel::IntersectWide(Ray &ray) {
+    bool hit = false;
+    Vector3d invDir(1.0 / ray.direction.x, 1.0 / ray.direction.y, 1.0 / ray.direction.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    // Per axis, lane block (min or max) holding the near and far planes
+    const int nearBlock[3] = {dirIsNeg[0] ? 3 : 0, dirIsNeg[1] ? 4 : 1, dirIsNeg[2] ? 5 : 2};
+    FloatBoxRay floatRay;
+    if (floatBounds)
+        floatRay = FloatBoxRay(ray, invDir, dirIsNeg);
+    size_t nbTransparent = ray.transparentHits.size();
+    uint64_t nbNodes = 0, nbTests = 0;
+
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesToVisit[64 * (BVH_MAX_WIDTH - 1) + 1];
+    while (true) {
+        const WideBVHNode &node = wideNodes[currentNodeIndex];
+
+        double entryDist[BVH_MAX_WIDTH];
+        int hitMask = 0;
+        if (floatBounds) {
+            // Check ray against all child boxes at once
+            const float *lanes = &wideBoundsFloat[(size_t) currentNodeIndex * 6 * nodeWidth];
+            float entryDistFloat[BVH_MAX_WIDTH];
+            hitMask = IntersectBoxLanesFloat(lanes + nearBlock[0] * nodeWidth, lanes + (3 + nearBlock[0]) % 6 * nodeWidth,
+                                             lanes + nearBlock[1] * nodeWidth, lanes + (3 + nearBlock[1]) % 6 * nodeWidth,
+                                             lanes + nearBlock[2] * nodeWidth, lanes + (3 + nearBlock[2]) % 6 * nodeWidth,
+                                             floatRay, RoundUpToFloat(ray.tMax), entryDistFloat, nodeWidth);
+            for (int c = 0; c < node.nbChildren; ++c)
+                entryDist[c] = entryDistFloat[c];
+        } else {
+            // Check ray against all child boxes, 4 lanes at a time
+            const double *lanes = &wideBounds[(size_t) currentNodeIndex * 6 * nodeWidth];
+            for (int first = 0; first < nodeWidth; first += 4) {
+                hitMask |= IntersectBoxLanes(lanes + nearBlock[0] * nodeWidth + first, lanes + (3 + nearBlock[0]) % 6 * nodeWidth + first,
+                                             lanes + nearBlock[1] * nodeWidth + first, lanes + (3 + nearBlock[1]) % 6 * nodeWidth + first,
+                                             lanes + nearBlock[2] * nodeWidth + first, lanes + (3 + nearBlock[2]) % 6 * nodeWidth + first,
+                                             ray, invDir, entryDist + first) << first;
+            }
+        }
+        hitMask &= (1 << node.nbChildren) - 1;
+        nbNodes += node.nbChildren;
+
+        // Sort hit children by entry distance (insertion sort, at most BVH_MAX_WIDTH)
+        int order[BVH_MAX_WIDTH];
+        int nbHit = 0;
+        for (int c = 0; c < node.nbChildren; ++c) {
+            if (!(hitMask & (1 << c))) continue;
+            int pos = nbHit++;
+            while (pos > 0 && entryDist[order[pos - 1]] > entryDist[c]) {
+                order[pos] = order[pos - 1];
+                --pos;
+            }
+            order[pos] = c;
+        }
+
+        // Leaves right away near to far, interior children pushed far to near
+        for (int i = 0; i < nbHit; ++i) {
+            const int c = order[i];
+            if (node.nPrimitives[c] == 0) continue;
+            for (int p = 0; p < node.nPrimitives[c]; ++p) {
+                const CompactFacet &f = compactFacets[node.childOffset[c] + p];
+                // Do not check last collided facet to prevent self intersections
+                if (f.globalId == ray.lastIntersectedId) continue;
+                ++nbTests;
+                if (IntersectCompactFacet(f, compactVertices.data(), compactEdges.data(), ray)) {
+                    hit = true;
+                }
+            }
+        }
+        for (int i = nbHit - 1; i >= 0; --i) {
+            const int c = order[i];
+            if (node.nPrimitives[c] == 0)
+                nodesToVisit[toVisitOffset++] = node.childOffset[c];
+        }
+
+        if (toVisitOffset == 0) break;
+        currentNodeIndex = nodesToVisit[--toVisitOffset];
+    }
+    threadTelemetry.raysTraced++;
+    threadTelemetry.nodesVisited += nbNodes;
+    threadTelemetry.primitiveTests += nbTests;
+    threadTelemetry.transparentPasses += ray.transparentHits.size() - nbTransparent;
     return hit;
 }
 
-BVHAccel::BVHAccel(BVHAccel &&src) noexcept: maxPrimsInNode(src.maxPrimsInNode), splitMethod(src.splitMethod) {
+//! Number of rays set in a packet lane mask
+static inline int PopCount(int mask) {
+    int count = 0;
+    for (; mask; mask &= mask - 1) ++count;
+    return count;
+}
+
+/**
+* \brief Traverses the tree once for all rays of a packet, each ray only descending where its own box tests succeed
+ * \return bit mask of the rays that had a hard hit
+ */
+int BVHAccel::IntersectPacket(BVHRayPacket &packet) {
+    int hitMask = 0;
+    // Follow packet through BVH nodes, carrying along which rays are still inside the parent box
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int currentMask = (1 << packet.nbRays) - 1;
+    int nodesToVisit[64];
+    int masksToVisit[64];
+    uint64_t nbNodes = 0, nbTests = 0;
+    while (true) {
+        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        // Check rays against BVH node
+        const int nodeMask = IntersectBoxPacket(node->bounds, packet, currentMask);
+        nbNodes += PopCount(currentMask);
+        if (nodeMask) {
+            if (node->nPrimitives > 0) {
+                // Intersect each ray hitting the leaf with its primitives, in the same order as the scalar path
+                for (int lane = 0; lane < packet.nbRays; ++lane) {
+                    if (!(nodeMask & (1 << lane))) continue;
+                    Ray &ray = *packet.rays[lane];
+                    for (int i = 0; i < node->nPrimitives; ++i) {
+                        const CompactFacet &f = compactFacets[node->primitivesOffset + i];
+                        // Do not check last collided facet to prevent self intersections
+                        if (f.globalId == ray.lastIntersectedId) continue;
+                        ++nbTests;
+                        if (IntersectCompactFacet(f, compactVertices.data(), compactEdges.data(), ray)) {
+                            hitMask |= (1 << lane);
+                        }
+                    }
+                    packet.tMax[lane] = ray.tMax;
+                }
+                if (toVisitOffset == 0) break;
+                --toVisitOffset;
+                currentNodeIndex = nodesToVisit[toVisitOffset];
+                currentMask = masksToVisit[toVisitOffset];
+            } else {
+                // All rays share dirIsNeg, so near/far order is the same for the whole packet
+                masksToVisit[toVisitOffset] = nodeMask;
+                if (packet.dirIsNeg[node->axis]) {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                } else {
+                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+                currentMask = nodeMask;
+            }
+        } else {
+            if (toVisitOffset == 0) break;
+            --toVisitOffset;
+            currentNodeIndex = nodesToVisit[toVisitOffset];
+            currentMask = masksToVisit[toVisitOffset];
+        }
+    }
+    threadTelemetry.nodesVisited += nbNodes;
+    threadTelemetry.primitiveTests += nbTests;
+    return hitMask;
+}
+
+/**
+* \brief Intersects a batch of rays, grouped into packets of BVH_PACKET_SIZE rays with the same direction octant
+ * Rays sharing one RNG (semi-transparent facets) draw their random numbers in a different interleaving than sequential Intersect() calls
+ * \return per ray, true if it had a hard hit (same as Intersect())
+ */
+std::vector<bool> BVHAccel::IntersectBatch(Ray *rays, size_t nbRays) {
+    std::vector<bool> hits(nbRays, false);
+    if (!nodes || nbRays == 0) return hits;
+    size_t nbTransparent = 0;
+    for (size_t r = 0; r < nbRays; ++r) nbTransparent += rays[r].transparentHits.size();
+
+    // Bucket rays by octant: dirIsNeg decides the near child, so it has to be uniform inside a packet
+    std::vector<size_t> octantRays[8];
+    for (size_t r = 0; r < nbRays; ++r) {
+        const Vector3d &dir = rays[r].direction;
+        int octant = ((1.0 / dir.x) < 0) | (((1.0 / dir.y) < 0) << 1) | (((1.0 / dir.z) < 0) << 2);
+        octantRays[octant].push_back(r);
+    }
+
+    BVHRayPacket packet;
+    for (int octant = 0; octant < 8; ++octant) {
+        const std::vector<size_t> &ids = octantRays[octant];
+        packet.dirIsNeg[0] = octant & 1;
+        packet.dirIsNeg[1] = (octant >> 1) & 1;
+        packet.dirIsNeg[2] = (octant >> 2) & 1;
+        for (size_t first = 0; first < ids.size(); first += BVH_PACKET_SIZE) {
+            packet.nbRays = (int) std::min((size_t) BVH_PACKET_SIZE, ids.size() - first);
+            for (int lane = 0; lane < BVH_PACKET_SIZE; ++lane) {
+                // Unused lanes repeat the first ray, they are masked out of every result
+                Ray &ray = rays[ids[first + (lane < packet.nbRays ? lane : 0)]];
+                packet.rays[lane] = &ray;
+                packet.originX[lane] = ray.origin.x;
+                packet.originY[lane] = ray.origin.y;
+                packet.originZ[lane] = ray.origin.z;
+                packet.invDirX[lane] = 1.0 / ray.direction.x;
+                packet.invDirY[lane] = 1.0 / ray.direction.y;
+                packet.invDirZ[lane] = 1.0 / ray.direction.z;
+                packet.tMax[lane] = ray.tMax;
+            }
+            const int hitMask = IntersectPacket(packet);
+            for (int lane = 0; lane < packet.nbRays; ++lane) {
+                hits[ids[first + lane]] = hitMask & (1 << lane);
+            }
+        }
+    }
+    threadTelemetry.raysTraced += nbRays;
+    for (size_t r = 0; r < nbRays; ++r) threadTelemetry.transparentPasses += rays[r].transparentHits.size();
+    threadTelemetry.transparentPasses -= nbTransparent;
+    return hits;
+}
+
+BVHAccel::BVHAccel(BVHAccel &&src) noexcept: maxPrimsInNode(src.maxPrimsInNode), splitMethod(src.splitMethod),
+                                              nodeWidth(src.nodeWidth), floatBounds(src.floatBounds) {
     primitives = std::move(src.primitives);
+    wideNodes = std::move(src.wideNodes);
+    wideBounds = std::move(src.wideBounds);
+    wideBoundsFloat = std::move(src.wideBoundsFloat);
+    compactFacets = std::move(src.compactFacets);
+    compactVertices = std::move(src.compactVertices);
+    compactEdges = std::move(src.compactEdges);
+    compactPolyGrids = std::move(src.compactPolyGrids);
+    buildProbabilities = std::move(src.buildProbabilities);
     nodes = src.nodes;
+    totalNodes = src.totalNodes;
+    buildSAHCost = src.buildSAHCost;
     src.nodes = nullptr;
     bb = src.bb;
 }
 
-BVHAccel::BVHAccel(const BVHAccel &src) noexcept: maxPrimsInNode(src.maxPrimsInNode), splitMethod(src.splitMethod) {
+BVHAccel::BVHAccel(const BVHAccel &src) noexcept: maxPrimsInNode(src.maxPrimsInNode), splitMethod(src.splitMethod),
+                                                   nodeWidth(src.nodeWidth), floatBounds(src.floatBounds) {
     if (nodes)
         exit(44);
 }
@@ -9,10 +9,19 @@
 using Primitive = RTFacet;
 
 struct BVHBuildNode;
+struct BVHBuildArena;
+struct MortonPrimitive;
 
 // BVHAccel Forward Declarations
 struct BVHPrimitiveInfo;
 struct LinearBVHNode;
+struct BVHRayPacket;
+struct WideBVHNode;
+struct CompactFacet;
+
+constexpr int BVH_PACKET_SIZE = 4; // One AVX register of doubles
+constexpr int BVH_MAX_WIDTH = 8; // Max. children per node of the collapsed (wide) tree
+constexpr double BVH_REFIT_MAX_COST_RATIO = 1.5; // Refit() rebuilds when the SAH cost grows past this factor
 
 class BVHAccel : public RTPrimitive {
 public:
@@ -23,7 +32,8 @@ public:
     // BVHAccel Public Methods
     BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
              int maxPrimsInNode = 1,
-             SplitMethod splitMethod = SplitMethod::SAH, const std::vector<double>& probabilities = std::vector<double>{});
+             SplitMethod splitMethod = SplitMethod::SAH, const std::vector<double>& probabilities = std::vector<double>{},
+             int nodeWidth = 2, bool floatBounds = false);
     BVHAccel(BVHAccel && src) noexcept;
     BVHAccel(const BVHAccel & src) noexcept;
 
@@ -31,21 +41,67 @@ public:
     ~BVHAccel() override;
 
     bool Intersect(Ray &ray);
+    // Packet traversal: walks the tree once for up to BVH_PACKET_SIZE rays of the same direction octant
+    // Per ray, the sequence of node and primitive tests is the same as with Intersect(), so results are identical
+    std::vector<bool> IntersectBatch(Ray *rays, size_t nbRays);
+    // Updates bounds after primitives moved, rebuilds instead if the tree quality degraded too much
+    bool Refit(double maxCostRatio = BVH_REFIT_MAX_COST_RATIO);
+    // Takes new objects of the same facets (e.g. of a re-sent model), matched by globalId, to be refitted; false if the facets differ
+    bool ReplacePrimitives(const std::vector<std::shared_ptr<Primitive>> &newPrimitives);
+    // Switches to ProbSplit, e.g. with probabilities from a pilot run's hit counts
+    void Rebuild(const std::vector<double> &probabilities);
+    double SAHCost() const;
+    int NodeWidth() const { return nodeWidth; } // 2 for the binary tree
+    size_t GetMemSize() const; // bytes of the tree and its compact primitive data, primitives themselves excluded
 
 private:
     void ComputeBB() override;
     // BVHAccel Private Methods
-    BVHBuildNode *recursiveBuild(
+    void Build(const std::vector<double> &probabilities);
+    BVHBuildNode *recursiveBuild(BVHBuildArena &arena,
             std::vector<BVHPrimitiveInfo> &primitiveInfo,
-            int start, int end, int *totalNodes,
+            int start, int end,
+            std::vector<std::shared_ptr<Primitive>> &orderedPrims);
+    BVHBuildNode *HLBVHBuild(BVHBuildArena &arena,
+            const std::vector<BVHPrimitiveInfo> &primitiveInfo,
             std::vector<std::shared_ptr<Primitive>> &orderedPrims);
+    BVHBuildNode *emitLBVH(BVHBuildArena &arena,
+            const std::vector<BVHPrimitiveInfo> &primitiveInfo,
+            const std::vector<MortonPrimitive> &mortonPrims, int start, int nPrimitives,
+            std::vector<std::shared_ptr<Primitive>> &orderedPrims, int bitIndex);
+    BVHBuildNode *buildUpperSAH(BVHBuildArena &arena,
+            std::vector<BVHBuildNode *> &treeletRoots, int start, int end);
     int flattenBVHTree(BVHBuildNode *node, int *offset);
+    int IntersectPacket(BVHRayPacket &packet);
+    int collapseToWide(int binaryNodeIndex);
+    void convertWideBoundsToFloat();
+    bool IntersectWide(Ray &ray);
+    void buildCompactFacets();
 
 private:
     const int maxPrimsInNode;
-    const SplitMethod splitMethod;
+    SplitMethod splitMethod; // changed to ProbSplit by Rebuild()
     std::vector<std::shared_ptr<Primitive>> primitives;
     LinearBVHNode *nodes = nullptr;
+    int totalNodes = 0;
+    double buildSAHCost = 0.0; // reference for Refit()
+    std::vector<double> buildProbabilities; // ProbSplit only
+
+    // Wide tree (nodeWidth 4 or 8), collapsed from nodes, child boxes as structure-of-arrays
+    const int nodeWidth;
+    std::vector<WideBVHNode> wideNodes;
+    std::vector<double> wideBounds; // per wide node: minX[w], minY[w], minZ[w], maxX[w], maxY[w], maxZ[w]
+    // Optional float child boxes rounded outward, replacing wideBounds (half the memory, twice the lanes per test)
+    // Facet intersections stay in double, only box culling becomes slightly more conservative
+    const bool floatBounds;
+    std::vector<float> wideBoundsFloat;
+
+    // Intersection data of primitives, in the same (leaf) order, with their 2D polygons and polygon edge tables in one array each
+    std::vector<CompactFacet> compactFacets;
+    std::vector<Vector2d> compactVertices;
+    std::vector<double> compactEdges;
+    // Owners of the grids compactFacets point to: facets may replace theirs (InitializeFacets) before the next Refit() or rebuild
+    std::vector<std::shared_ptr<PolyGrid>> compactPolyGrids;
 
     int SplitEqualCounts(std::vector<BVHPrimitiveInfo> &primitiveInfo, int start, int end, int dim);
 
@@ -61,4 +117,7 @@ private:
     int SplitMiddleProb(std::vector<BVHPrimitiveInfo> &primitiveInfo, int start, int end, int dim);
 };
 
+// Per-facet split probabilities from hit counts, for BVHAccel::Rebuild() and KdTreeAccel::Rebuild()
+std::vector<double> HitCountsToProbabilities(const std::vector<size_t> &hitCounts);
+
 #endif //MOLFLOW_PROJ_BVH_H
@@ -0,0 +1,377 @@
+#include "Instancing.h"
+#include "BVH.h"
+#include "KDTree.h"
+#include "Ray.h"
+#include "IntersectAABB_shared.h"
+#include "ThreadTelemetry.h"
+#include <Helper/ConsoleLogger.h>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <numeric>
+#include <omp.h>
+
+//! Node of the top-level BVH over instances
+struct InstanceNode {
+    AxisAlignedBoundingBox bounds;
+    int offset = 0; // leaf: first entry in instanceOrder, interior: second child
+    int nInstances = 0; // 0 for interior nodes
+    int axis = 0;
+};
+
+/**
+* \brief Union-find over the vertex indices of the facets: facets sharing a vertex are in the same group
+ * \return group of each primitive, numbered from 0 in order of first appearance
+ */
+std::vector<size_t> ConnectedFacetGroups(const std::vector<std::shared_ptr<Primitive>> &primitives) {
+    std::vector<size_t> parent(primitives.size());
+    std::iota(parent.begin(), parent.end(), 0);
+    auto find = [&parent](size_t i) {
+        while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    };
+
+    size_t maxIndex = 0;
+    for (const auto &prim : primitives)
+        for (const auto index : prim->indices) maxIndex = std::max(maxIndex, index);
+    std::vector<size_t> vertexFacet(maxIndex + 1, primitives.size()); // first facet using each vertex
+    for (size_t i = 0; i < primitives.size(); ++i) {
+        for (const auto index : primitives[i]->indices) {
+            if (vertexFacet[index] == primitives.size()) {
+                vertexFacet[index] = i;
+            } else {
+                const size_t a = find(vertexFacet[index]), b = find(i);
+                if (a != b) parent[std::max(a, b)] = std::min(a, b);
+            }
+        }
+    }
+
+    std::vector<size_t> groups(primitives.size());
+    std::vector<size_t> groupOfRoot(primitives.size(), primitives.size());
+    size_t nbGroups = 0;
+    for (size_t i = 0; i < primitives.size(); ++i) {
+        const size_t root = find(i);
+        if (groupOfRoot[root] == primitives.size()) groupOfRoot[root] = nbGroups++;
+        groups[i] = groupOfRoot[root];
+    }
+    return groups;
+}
+
+//! Orthonormal frame of a facet: U direction, in-plane normal to U, facet normal
+static bool FacetFrame(const RTFacet &facet, Vector3d frame[3]) {
+    if (facet.sh.U.Norme() == 0.0 || facet.sh.Nuv.Norme() == 0.0)
+        return false;
+    frame[0] = facet.sh.U.Normalized();
+    frame[2] = facet.sh.Nuv.Normalized();
+    frame[1] = CrossProduct(frame[2], frame[0]);
+    return true;
+}
+
+/**
+* \brief Finds the rigid transform moving the prototype facets onto the candidate facets, facet by facet
+ * The transform is taken from the frames of the first facets, then every facet is checked: same surface, sidedness and polygon,
+ * and (O,U,V) within tolerance, so hit distances and (u,v) coordinates are the same on both
+ */
+static bool MatchInstance(const std::vector<std::shared_ptr<Primitive>> &primitives, const std::vector<size_t> &prototype,
+                          const std::vector<size_t> &candidate, double tolerance, RigidTransform &toWorld) {
+    Vector3d prototypeFrame[3], candidateFrame[3];
+    if (!FacetFrame(*primitives[prototype[0]], prototypeFrame) || !FacetFrame(*primitives[candidate[0]], candidateFrame))
+        return false;
+    // Rotation = candidateFrame * transpose(prototypeFrame), column by column
+    for (int j = 0; j < 3; ++j) {
+        toWorld.axes[j] = prototypeFrame[0][j] * candidateFrame[0] + prototypeFrame[1][j] * candidateFrame[1]
+                          + prototypeFrame[2][j] * candidateFrame[2];
+    }
+    toWorld.translation = primitives[candidate[0]]->sh.O - toWorld.ToWorldVector(primitives[prototype[0]]->sh.O);
+
+    for (size_t k = 0; k < prototype.size(); ++k) {
+        const RTFacet &p = *primitives[prototype[k]];
+        const RTFacet &c = *primitives[candidate[k]];
+        if (p.surf != c.surf || p.sh.is2sided != c.sh.is2sided || p.shape != c.shape || p.vertices2.size() != c.vertices2.size())
+            return false;
+        for (size_t v = 0; v < p.vertices2.size(); ++v) {
+            if (std::abs(p.vertices2[v].u - c.vertices2[v].u) > INSTANCE_MATCH_TOLERANCE
+                || std::abs(p.vertices2[v].v - c.vertices2[v].v) > INSTANCE_MATCH_TOLERANCE)
+                return false;
+        }
+        if ((toWorld.ToWorldPoint(p.sh.O) - c.sh.O).Norme() > tolerance
+            || (toWorld.ToWorldVector(p.sh.U) - c.sh.U).Norme() > tolerance
+            || (toWorld.ToWorldVector(p.sh.V) - c.sh.V).Norme() > tolerance)
+            return false;
+    }
+    return true;
+}
+
+/**
+* \brief Finds the facet groups that are rigidly transformed copies of an earlier group
+ * Copies must list their facets in the same order as the first occurrence (as copy/paste or cloning does).
+ * Groups smaller than minFacets, or without any copy, are put together in a last prototype traced as is.
+ * \param facetGroups group of each primitive, see ConnectedFacetGroups()
+ */
+InstanceSet FindInstances(const std::vector<std::shared_ptr<Primitive>> &primitives, const std::vector<size_t> &facetGroups,
+                          size_t minFacets) {
+    std::vector<std::vector<size_t>> groups;
+    for (size_t i = 0; i < primitives.size() && i < facetGroups.size(); ++i) {
+        if (facetGroups[i] >= groups.size()) groups.resize(facetGroups[i] + 1);
+        groups[facetGroups[i]].push_back(i);
+    }
+
+    struct Candidate {
+        size_t group; // owner
+        double tolerance;
+        std::vector<GeometryInstance> instances;
+    };
+    std::vector<Candidate> candidates;
+    std::map<std::vector<size_t>, std::vector<size_t>> candidatesBySignature; // vertex count of each facet -> candidates
+    std::vector<size_t> remainder;
+    for (size_t g = 0; g < groups.size(); ++g) {
+        const auto &group = groups[g];
+        if (group.size() < std::max<size_t>(minFacets, 1)) {
+            remainder.insert(remainder.end(), group.begin(), group.end());
+            continue;
+        }
+        std::vector<size_t> signature;
+        signature.reserve(group.size());
+        for (const auto i : group) signature.push_back(primitives[i]->vertices2.size());
+        auto &sameSignature = candidatesBySignature[signature];
+
+        GeometryInstance instance;
+        bool matched = false;
+        for (const auto c : sameSignature) {
+            if (MatchInstance(primitives, groups[candidates[c].group], group, candidates[c].tolerance, instance.toWorld)) {
+                for (const auto i : group) instance.facetIds.push_back(primitives[i]->globalId);
+                candidates[c].instances.push_back(std::move(instance));
+                matched = true;
+                break;
+            }
+        }
+        if (!matched) {
+            AxisAlignedBoundingBox bounds;
+            for (const auto i : group) bounds = AxisAlignedBoundingBox::Union(bounds, primitives[i]->sh.bb);
+            instance.isOwner = true;
+            instance.toWorld = RigidTransform();
+            for (const auto i : group) instance.facetIds.push_back(primitives[i]->globalId);
+            sameSignature.push_back(candidates.size());
+            candidates.push_back({g, INSTANCE_MATCH_TOLERANCE * bounds.Diagonal().Norme(), {instance}});
+        }
+    }
+
+    InstanceSet instanceSet;
+    for (auto &candidate : candidates) {
+        const auto &group = groups[candidate.group];
+        if (candidate.instances.size() < 2) {
+            remainder.insert(remainder.end(), group.begin(), group.end());
+            continue;
+        }
+        const int prototype = (int) instanceSet.prototypes.size();
+        auto &facets = instanceSet.prototypes.emplace_back();
+        for (const auto i : group) facets.push_back(primitives[i]);
+        for (auto &instance : candidate.instances) {
+            instance.prototype = prototype;
+            instanceSet.instances.push_back(std::move(instance));
+        }
+    }
+    if (!remainder.empty()) {
+        std::sort(remainder.begin(), remainder.end());
+        GeometryInstance instance;
+        instance.prototype = (int) instanceSet.prototypes.size();
+        instance.isOwner = true;
+        auto &facets = instanceSet.prototypes.emplace_back();
+        for (const auto i : remainder) {
+            facets.push_back(primitives[i]);
+            instance.facetIds.push_back(primitives[i]->globalId);
+        }
+        instanceSet.instances.push_back(std::move(instance));
+    }
+
+    // World bounds of each instance from its own facets, grown by the match tolerance as the prototype is traced instead
+    std::vector<size_t> facetIndex; // globalId -> primitive
+    for (size_t i = 0; i < primitives.size(); ++i) {
+        if (primitives[i]->globalId >= facetIndex.size()) facetIndex.resize(primitives[i]->globalId + 1, primitives.size());
+        facetIndex[primitives[i]->globalId] = i;
+    }
+    for (auto &instance : instanceSet.instances) {
+        instance.bounds = AxisAlignedBoundingBox();
+        for (const auto id : instance.facetIds)
+            instance.bounds = AxisAlignedBoundingBox::Union(instance.bounds, primitives[facetIndex[id]]->sh.bb);
+        if (!instance.isOwner) {
+            const double margin = INSTANCE_MATCH_TOLERANCE * instance.bounds.Diagonal().Norme();
+            instance.bounds.min = instance.bounds.min - Vector3d(margin, margin, margin);
+            instance.bounds.max = instance.bounds.max + Vector3d(margin, margin, margin);
+        }
+    }
+    return instanceSet;
+}
+
+/**
+* \brief Builds one accel structure per prototype with makeAccel, and the top-level BVH over all instances
+ */
+InstancedAccel::InstancedAccel(InstanceSet instanceSet, const AccelFactory &makeAccel)
+        : instances(std::move(instanceSet.instances)) {
+    double buildStart = omp_get_wtime();
+    size_t nbPrototypeFacets = 0, nbFacets = 0;
+    for (auto &facets : instanceSet.prototypes) {
+        nbPrototypeFacets += facets.size();
+        prototypeAccels.push_back(makeAccel(std::move(facets)));
+    }
+
+    size_t maxId = 0;
+    prototypeOwners.resize(prototypeAccels.size(), -1);
+    for (size_t i = 0; i < instances.size(); ++i) {
+        if (instances[i].isOwner) prototypeOwners[instances[i].prototype] = (int) i;
+        for (const auto id : instances[i].facetIds) maxId = std::max(maxId, id);
+        nbFacets += instances[i].facetIds.size();
+    }
+    facetInstance.assign(maxId + 1, -1);
+    facetPrototypeIndex.assign(maxId + 1, -1);
+    for (size_t i = 0; i < instances.size(); ++i) {
+        for (size_t k = 0; k < instances[i].facetIds.size(); ++k) {
+            facetInstance[instances[i].facetIds[k]] = (int) i;
+            facetPrototypeIndex[instances[i].facetIds[k]] = (int) k;
+        }
+    }
+
+    instanceOrder.resize(instances.size());
+    std::iota(instanceOrder.begin(), instanceOrder.end(), 0);
+    nodes.reserve(2 * instances.size());
+    if (!instances.empty())
+        buildTopLevel(0, (int) instances.size());
+    ComputeBB();
+
+    Log::console_msg_master(4, "Instanced accel created with {} prototypes ({} facets) for {} instances ({} facets) in {:.2f} ms\n",
+                            prototypeAccels.size(), nbPrototypeFacets, instances.size(), nbFacets,
+                            (omp_get_wtime() - buildStart) * 1000.0);
+}
+
+InstancedAccel::~InstancedAccel() = default;
+
+//! Median split on the instance centers along the largest extent, at most 2 instances per leaf
+int InstancedAccel::buildTopLevel(int start, int end) {
+    const int nodeIndex = (int) nodes.size();
+    nodes.emplace_back();
+    AxisAlignedBoundingBox bounds, centroidBounds;
+    for (int i = start; i < end; ++i) {
+        const auto &instanceBounds = instances[instanceOrder[i]].bounds;
+        bounds = AxisAlignedBoundingBox::Union(bounds, instanceBounds);
+        centroidBounds = AxisAlignedBoundingBox::Union(centroidBounds, 0.5 * (instanceBounds.min + instanceBounds.max));
+    }
+    nodes[nodeIndex].bounds = bounds;
+    if (end - start <= 2) {
+        nodes[nodeIndex].offset = start;
+        nodes[nodeIndex].nInstances = end - start;
+        return nodeIndex;
+    }
+
+    const int axis = centroidBounds.MaximumExtent();
+    const int mid = (start + end) / 2;
+    std::nth_element(instanceOrder.begin() + start, instanceOrder.begin() + mid, instanceOrder.begin() + end, [&](int a, int b) {
+        return instances[a].bounds.min[axis] + instances[a].bounds.max[axis]
+               < instances[b].bounds.min[axis] + instances[b].bounds.max[axis];
+    });
+    nodes[nodeIndex].axis = axis;
+    buildTopLevel(start, mid);
+    const int secondChild = buildTopLevel(mid, end);
+    nodes[nodeIndex].offset = secondChild;
+    return nodeIndex;
+}
+
+void InstancedAccel::ComputeBB() {
+    bb = AxisAlignedBoundingBox();
+    for (const auto &instance : instances)
+        bb = AxisAlignedBoundingBox::Union(bb, instance.bounds);
+}
+
+/**
+* \brief Traces the ray through the prototype of one instance, in the instance space
+ * The last intersected facet is only skipped if it belongs to this instance, new hits get the instance facet ids
+ */
+bool InstancedAccel::intersectInstance(int instanceIndex, Ray &ray) {
+    const GeometryInstance &instance = instances[instanceIndex];
+    if (instance.isOwner)
+        return prototypeAccels[instance.prototype]->Intersect(ray);
+
+    const Vector3d origin = ray.origin, direction = ray.direction;
+    const int lastIntersectedId = ray.lastIntersectedId;
+    const size_t nbTransparent = ray.transparentHits.size();
+    const double tMax = ray.tMax;
+    ray.origin = instance.toWorld.ToLocalPoint(origin);
+    ray.direction = instance.toWorld.ToLocalVector(direction);
+    ray.lastIntersectedId = -1;
+    if (lastIntersectedId >= 0 && (size_t) lastIntersectedId < facetInstance.size() && facetInstance[lastIntersectedId] == instanceIndex) {
+        const GeometryInstance &owner = instances[prototypeOwners[instance.prototype]];
+        ray.lastIntersectedId = (int) owner.facetIds[facetPrototypeIndex[lastIntersectedId]];
+    }
+
+    const bool hit = prototypeAccels[instance.prototype]->Intersect(ray);
+
+    if (ray.tMax < tMax)
+        ray.hardHit.facetId = instance.facetIds[facetPrototypeIndex[ray.hardHit.facetId]];
+    for (size_t i = nbTransparent; i < ray.transparentHits.size(); ++i)
+        ray.transparentHits[i].facetId = instance.facetIds[facetPrototypeIndex[ray.transparentHits[i].facetId]];
+    ray.origin = origin;
+    ray.direction = direction;
+    ray.lastIntersectedId = lastIntersectedId;
+    return hit;
+}
+
+bool InstancedAccel::Intersect(Ray &ray) {
+    if (nodes.empty()) return false;
+    bool hit = false;
+    Vector3d invDir(1.0 / ray.direction.x, 1.0 / ray.direction.y, 1.0 / ray.direction.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    const uint64_t raysTraced = threadTelemetry.raysTraced;
+    uint64_t nbNodes = 0;
+
+    // Same traversal as BVHAccel::Intersect(), instances of a leaf are traced in their prototype accel structure
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesToVisit[64];
+    while (true) {
+        const InstanceNode &node = nodes[currentNodeIndex];
+        ++nbNodes;
+        if (IntersectBox(node.bounds, ray, invDir, dirIsNeg)) {
+            if (node.nInstances > 0) {
+                for (int i = 0; i < node.nInstances; ++i) {
+                    if (intersectInstance(instanceOrder[node.offset + i], ray))
+                        hit = true;
+                }
+                if (toVisitOffset == 0) break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            } else {
+                if (dirIsNeg[node.axis]) {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node.offset;
+                } else {
+                    nodesToVisit[toVisitOffset++] = node.offset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
+        } else {
+            if (toVisitOffset == 0) break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+    // Prototype traversals count as one ray
+    threadTelemetry.raysTraced = raysTraced + 1;
+    threadTelemetry.nodesVisited += nbNodes;
+    return hit;
+}
+
+size_t InstancedAccel::GetMemSize() const {
+    size_t sum = sizeof(*this);
+    sum += nodes.capacity() * sizeof(InstanceNode);
+    sum += instanceOrder.capacity() * sizeof(int);
+    sum += prototypeOwners.capacity() * sizeof(int);
+    sum += (facetInstance.capacity() + facetPrototypeIndex.capacity()) * sizeof(int);
+    for (const auto &instance : instances)
+        sum += sizeof(GeometryInstance) + instance.facetIds.capacity() * sizeof(size_t);
+    for (const auto &accel : prototypeAccels) {
+        if (auto bvh = dynamic_cast<const BVHAccel *>(accel.get()))
+            sum += bvh->GetMemSize();
+        else if (auto kdTree = dynamic_cast<const KdTreeAccel *>(accel.get()))
+            sum += kdTree->GetMemSize();
+    }
+    return sum;
+}
@@ -0,0 +1,87 @@
+#ifndef MOLFLOW_PROJ_INSTANCING_H
+#define MOLFLOW_PROJ_INSTANCING_H
+
+#include <functional>
+#include <vector>
+#include <memory>
+#include <FacetData.h>
+#include "Primitive.h"
+
+using Primitive = RTFacet;
+
+constexpr size_t INSTANCE_MIN_FACETS = 8; // Smaller sub-geometries stay in the flat remainder structure
+constexpr double INSTANCE_MATCH_TOLERANCE = 1e-9; // Relative to the sub-geometry size, max. deviation of a copy from its prototype
+
+//! Rigid placement of a prototype in the world: world = rotation * local + translation
+struct RigidTransform {
+    Vector3d axes[3]{{1.0, 0.0, 0.0}, {0.0, 1.0, 0.0}, {0.0, 0.0, 1.0}}; // columns of the rotation, images of the local x,y,z axes
+    Vector3d translation;
+
+    Vector3d ToLocalVector(const Vector3d &v) const { return {Dot(axes[0], v), Dot(axes[1], v), Dot(axes[2], v)}; }
+    Vector3d ToLocalPoint(const Vector3d &p) const { return ToLocalVector(p - translation); }
+    Vector3d ToWorldVector(const Vector3d &v) const { return v.x * axes[0] + v.y * axes[1] + v.z * axes[2]; }
+    Vector3d ToWorldPoint(const Vector3d &p) const { return ToWorldVector(p) + translation; }
+};
+
+//! One placement of a prototype, with the globalIds of its own facets
+struct GeometryInstance {
+    int prototype = 0;
+    bool isOwner = false; // the prototype's facets are this instance's facets: identity transform, no id remapping
+    RigidTransform toWorld;
+    AxisAlignedBoundingBox bounds; // world space
+    std::vector<size_t> facetIds; // globalId of the instance facet matching each prototype facet
+};
+
+/**
+* \brief Repeated sub-geometries of a facet set, see FindInstances()
+ * Each prototype is a list of facets of the geometry itself (those of its owner instance), in matching order for all its instances
+ */
+struct InstanceSet {
+    std::vector<std::vector<std::shared_ptr<Primitive>>> prototypes;
+    std::vector<GeometryInstance> instances;
+
+    bool HasRepetitions() const { return instances.size() > prototypes.size(); }
+};
+
+// Groups facets sharing vertices (by RTFacet::indices), returns the group of each primitive
+std::vector<size_t> ConnectedFacetGroups(const std::vector<std::shared_ptr<Primitive>> &primitives);
+// Finds groups that are rigidly transformed copies of each other, facet by facet in primitive order
+InstanceSet FindInstances(const std::vector<std::shared_ptr<Primitive>> &primitives, const std::vector<size_t> &facetGroups,
+                          size_t minFacets = INSTANCE_MIN_FACETS);
+
+struct InstanceNode;
+
+/**
+* \brief Two-level accel structure: one accel structure per prototype, and a top-level BVH over the transformed instances
+ * Rays are moved into the instance space for the prototype traversal (rigid transforms keep distances),
+ * hits are then mapped back to the globalIds of the instance facets
+ */
+class InstancedAccel : public RTPrimitive {
+public:
+    using AccelFactory = std::function<std::unique_ptr<RTPrimitive>(std::vector<std::shared_ptr<Primitive>>)>;
+
+    InstancedAccel(InstanceSet instanceSet, const AccelFactory &makeAccel);
+    ~InstancedAccel() override;
+
+    bool Intersect(Ray &ray) override;
+    size_t GetMemSize() const; // bytes of the top-level tree and the prototype accel structures, primitives themselves excluded
+    size_t NbPrototypes() const { return prototypeAccels.size(); }
+    size_t NbInstances() const { return instances.size(); }
+
+private:
+    void ComputeBB() override;
+    int buildTopLevel(int start, int end);
+    bool intersectInstance(int instanceIndex, Ray &ray);
+
+    std::vector<std::unique_ptr<RTPrimitive>> prototypeAccels;
+    std::vector<GeometryInstance> instances;
+    std::vector<int> prototypeOwners; // instance whose facets are the prototype's
+    std::vector<InstanceNode> nodes; // top-level BVH, depth-first order, leaves reference instanceOrder
+    std::vector<int> instanceOrder;
+
+    // Per globalId of an instanced facet: its instance and its index in the prototype, -1 for other facets
+    std::vector<int> facetInstance;
+    std::vector<int> facetPrototypeIndex;
+};
+
+#endif //MOLFLOW_PROJ_INSTANCING_H
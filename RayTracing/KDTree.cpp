@@ -5,13 +5,17 @@
 
 
 #include <BoundingBox.h>
+#include <atomic>
 #include <cmath>
-#include <set>
 #include <cassert>
 #include <cstring>
+#include <deque>
+#include <omp.h>
+#include <Helper/ConsoleLogger.h>
 
 #include "KDTree.h"
 #include "Ray.h"
+#include "ThreadTelemetry.h"
 
 namespace STATS {
     //STAT_MEMORY_COUNTER("Memory/BVH tree", treeBytes);
@@ -58,10 +62,11 @@ namespace STATS_KD {
     //STAT_MEMORY_COUNTER("Memory/BVH tree", treeBytes);
     //STAT_RATIO("BVH/Primitives per leaf node", totalPrimitives, totalLeafNodes);
 
-    static int totalPrimitives = 0;
-    static int totalLeafNodes = 0;
-    static int interiorNodes = 0;
-    static int leafNodes = 0;
+    // Atomic, as subtrees are built in parallel tasks
+    static std::atomic<int> totalPrimitives{0};
+    static std::atomic<int> totalLeafNodes{0};
+    static std::atomic<int> interiorNodes{0};
+    static std::atomic<int> leafNodes{0};
 
     void _reset() {
         totalPrimitives = 0;
@@ -74,13 +79,20 @@ namespace STATS_KD {
 // KdTreeAccel Local Declarations
 struct KdAccelNode {
     // KdAccelNode Methods
-    void InitLeaf(int *primNums, int np, std::vector<int> *primitiveIndices);
+    void InitLeaf(const BoundEdge *edges, int np, std::vector<int> *primitiveIndices);
     void InitInterior(int axis, int ac, double s) {
         split = s;
         flags = axis;
         aboveChild |= (ac << 2);
         STATS_KD::interiorNodes++;
     }
+    //! Shifts the node's child and primitive list offsets, when copying a subtree built on its own into the tree
+    void Relocate(int nodeOffset, int primOffset) {
+        if (!IsLeaf())
+            aboveChild += (nodeOffset << 2);
+        else if (nPrimitives() > 1)
+            primitiveIndicesOffset += primOffset;
+    }
     double SplitPos() const { return split; }
     int nPrimitives() const { return nPrims >> 2; }
     int SplitAxis() const { return flags & 3; }
@@ -112,6 +124,59 @@ struct BoundEdge {
     EdgeType type;
 };
 
+//! Subtree built serially by one thread, in the final depth-first layout with offsets local to the subtree
+struct KdSubtree {
+    std::vector<KdAccelNode> nodes;
+    std::vector<int> primitiveIndices;
+};
+
+//! Node of the top of the tree, above the subtrees small enough to be built serially
+struct KdBuildNode {
+    KdBuildNode *children[2] = {nullptr, nullptr}; // below, above; none when the node holds a subtree
+    int axis = 0;
+    double split = 0.0;
+    KdSubtree subtree;
+};
+
+/**
+* \brief Storage of a kd-tree build, shared by the OpenMP tasks building subtrees
+ * Top nodes come from a per-thread deque, which grows by blocks without moving the nodes already handed out.
+ * Serial subtrees are built in a per-thread scratch reused from one subtree to the next, then copied at their exact size.
+ */
+struct KdBuildArena {
+    struct alignas(64) ThreadData {
+        std::deque<KdBuildNode> nodes;
+        KdSubtree scratch;
+        std::vector<BoundEdge> aboveEdges; // workspace of buildSubtree()
+        std::vector<uint8_t> side; // per primitive number, 1: below, 2: above the split being classified, reset after use
+
+        std::vector<uint8_t> &Side(size_t nbPrimitives) {
+            if (side.empty()) side.resize(nbPrimitives, 0);
+            return side;
+        }
+    };
+
+    explicit KdBuildArena(std::vector<double> &&probabilities)
+            : threads(omp_get_max_threads()), probabilities(std::move(probabilities)) {}
+    ThreadData &Local() { return threads[omp_get_thread_num()]; }
+    //! Number of nodes and of leaf primitive indices of the flattened tree
+    std::pair<size_t, size_t> TreeSize() const {
+        size_t nbNodes = 0, nbIndices = 0;
+        for (const auto &t : threads) {
+            for (const auto &node : t.nodes) {
+                nbNodes += node.children[0] ? 1 : node.subtree.nodes.size();
+                nbIndices += node.subtree.primitiveIndices.size();
+            }
+        }
+        return {nbNodes, nbIndices};
+    }
+
+    std::vector<ThreadData> threads;
+    std::vector<double> probabilities; // by primitive number, empty for a purely geometric split
+};
+
+constexpr int KD_TASK_THRESHOLD = 4096; // Subtrees with more primitives are split into OpenMP tasks, smaller ones are built serially
+
 void KdTreeAccel::ComputeBB() {
     bb = AxisAlignedBoundingBox();
     if(nodes) {
@@ -129,51 +194,109 @@ KdTreeAccel::KdTreeAccel(std::vector<std::shared_ptr<Primitive>> p, const std::v
           traversalCost(traversalCost),
           maxPrims(maxPrims),
           emptyBonus(emptyBonus),
+          maxDepth(maxDepth),
           primitives(std::move(p)) {
 
     nodes = nullptr;
+    Build(probabilities);
+}
+
+/**
+* \brief Builds the tree from scratch over the current primitives, replacing a previous tree
+ * \param probabilities per-facet hit probabilities (indexed by globalId), empty for a purely geometric split
+ */
+void KdTreeAccel::Build(const std::vector<double> &probabilities) {
+    if (nodes) {
+        delete[] nodes;
+        nodes = nullptr;
+    }
+    primitiveIndices.clear();
+    bounds = AxisAlignedBoundingBox();
     if (primitives.empty())
         return;
     STATS_KD::_reset();
 
     // Build kd-tree for accelerator
     nextFreeNode = nAllocedNodes = 0;
-    if (maxDepth <= 0)
-        maxDepth = std::round(8 + 1.3f * Log2Int(int64_t(primitives.size())));
-
-    // Compute bounds for kd-tree construction
-    std::vector<AxisAlignedBoundingBox> primBounds;
-    primBounds.reserve(primitives.size());
-    for (const std::shared_ptr<Primitive> &prim : primitives) {
-        AxisAlignedBoundingBox b = prim->sh.bb;
-        bounds = AxisAlignedBoundingBox::Union(bounds, b);
-        primBounds.push_back(b);
+    int depthLimit = maxDepth;
+    if (depthLimit <= 0)
+        depthLimit = std::round(8 + 1.3f * Log2Int(int64_t(primitives.size())));
+
+    // Split costs look probabilities up by primitive number
+    std::vector<double> primProbabilities;
+    if (!probabilities.empty()) {
+        primProbabilities.resize(primitives.size(), 0.0);
+        for (size_t i = 0; i < primitives.size(); ++i) {
+            if (primitives[i]->globalId < probabilities.size())
+                primProbabilities[i] = probabilities[primitives[i]->globalId];
+        }
     }
 
-    // Allocate working memory for kd-tree construction
-    std::unique_ptr<BoundEdge[]> edges[3];
-    for (int i = 0; i < 3; ++i)
-        edges[i].reset(new BoundEdge[2 * primitives.size()]);
-    std::unique_ptr<int[]> prims0(new int[primitives.size()]);
-    std::unique_ptr<int[]> prims1(new int[(maxDepth + 1) * primitives.size()]);
+    // Compute bounds for kd-tree construction
+    for (const std::shared_ptr<Primitive> &prim : primitives)
+        bounds = AxisAlignedBoundingBox::Union(bounds, prim->sh.bb);
+
+    double buildStart = omp_get_wtime();
+    KdBuildArena arena(std::move(primProbabilities));
+    const int nPrimitives = (int) primitives.size();
+    std::unique_ptr<BoundEdge[]> edges(new BoundEdge[6 * primitives.size()]);
+    KdBuildNode *root;
+#pragma omp parallel
+#pragma omp single
+    {
+        // Sort the edges of every axis once, children keep them sorted when partitioned
+        for (int axis = 0; axis < 3; ++axis) {
+#pragma omp task default(shared) firstprivate(axis)
+            {
+                BoundEdge *axisEdges = &edges[2 * primitives.size() * axis];
+                for (int i = 0; i < nPrimitives; ++i) {
+                    const AxisAlignedBoundingBox &primBounds = primitives[i]->sh.bb;
+                    axisEdges[2 * i] = BoundEdge(primBounds.min[axis], i, true);
+                    axisEdges[2 * i + 1] = BoundEdge(primBounds.max[axis], i, false);
+                }
+                std::sort(axisEdges, axisEdges + 2 * nPrimitives,
+                          [](const BoundEdge &e0, const BoundEdge &e1) -> bool {
+                              if (e0.t == e1.t)
+                                  return (int)e0.type < (int)e1.type;
+                              else
+                                  return e0.t < e1.t;
+                          });
+            }
+        }
+#pragma omp taskwait
 
-    // Initialize _primNums_ for kd-tree construction
-    std::unique_ptr<int[]> primNums(new int[primitives.size()]);
-    for (size_t i = 0; i < primitives.size(); ++i) primNums[i] = (int)i;
+        // Start recursive construction of kd-tree
+        root = buildTree(arena, bounds, std::move(edges), nPrimitives, depthLimit, 0, -1);
+    }
 
-    // Start recursive construction of kd-tree
-    buildTree(0, bounds, primBounds, primNums.get(), primitives.size(),
-              maxDepth, edges, prims0.get(), prims1.get(), 0, probabilities, -1);
+    // Lay the tree out depth-first in a single allocation of the exact size
+    auto [nbNodes, nbIndices] = arena.TreeSize();
+    nAllocedNodes = (int) nbNodes;
+    nodes = new KdAccelNode[nAllocedNodes];
+    primitiveIndices.reserve(nbIndices);
+    flattenTree(root);
+    assert(nextFreeNode == nAllocedNodes);
+    Log::console_msg_master(4, "KD tree created with {} nodes for {} primitives ({:.2f} MB) in {:.2f} ms\n",
+                            nAllocedNodes, nPrimitives, float(nAllocedNodes * sizeof(KdAccelNode)) / (1024.f * 1024.f),
+                            (omp_get_wtime() - buildStart) * 1000.0);
+
+    Log::console_msg_master(4, "--- KD STATS ---\n");
+    Log::console_msg_master(4, " Total Primitives: {}\n", STATS_KD::totalPrimitives.load());
+    Log::console_msg_master(4, " Total Leaf Nodes: {}\n", STATS_KD::totalLeafNodes.load());
+    Log::console_msg_master(4, " Interior Nodes:   {}\n", STATS_KD::interiorNodes.load());
+    Log::console_msg_master(4, " Leaf Nodes:       {}\n", STATS_KD::leafNodes.load());
 
-    printf("--- KD STATS ---\n");
-    printf(" Total Primitives: %d\n", STATS_KD::totalPrimitives);
-    printf(" Total Leaf Nodes: %d\n", STATS_KD::totalLeafNodes);
-    printf(" Interior Nodes:   %d\n", STATS_KD::interiorNodes);
-    printf(" Leaf Nodes:       %d\n", STATS_KD::leafNodes);
+}
 
+/**
+* \brief Rebuilds the tree with hit probabilities, e.g. from a pilot run, see HitCountsToProbabilities()
+ */
+void KdTreeAccel::Rebuild(const std::vector<double> &probabilities) {
+    Build(probabilities);
 }
 
-void KdAccelNode::InitLeaf(int *primNums, int np,
+//! Leaf over the primitives of a node's bound edges, taken from their Start edges along the first axis
+void KdAccelNode::InitLeaf(const BoundEdge *edges, int np,
                            std::vector<int> *primitiveIndices) {
     flags = 3;
     nPrims |= (np << 2);
@@ -181,10 +304,12 @@ void KdAccelNode::InitLeaf(int *primNums, int np,
     if (np == 0)
         onePrimitive = 0;
     else if (np == 1)
-        onePrimitive = primNums[0];
+        onePrimitive = edges[0].primNum;
     else {
         primitiveIndicesOffset = primitiveIndices->size();
-        for (int i = 0; i < np; ++i) primitiveIndices->push_back(primNums[i]);
+        for (int i = 0; i < 2 * np; ++i)
+            if (edges[i].type == EdgeType::Start)
+                primitiveIndices->push_back(edges[i].primNum);
     }
     STATS_KD::leafNodes++;
     STATS_KD::totalPrimitives += np;
@@ -197,95 +322,59 @@ KdTreeAccel::~KdTreeAccel() {
     }
 }
 
-void KdTreeAccel::buildTree(int nodeNum, const AxisAlignedBoundingBox &nodeBounds,
-                            const std::vector<AxisAlignedBoundingBox> &allPrimBounds, int *primNums, int nPrimitives,
-                            int depth, const std::unique_ptr<BoundEdge[]> edges[3], int *prims0, int *prims1,
-                            int badRefines, const std::vector<double> &probabilities, int prevSplitAxis) {
-    //CHECK_EQ(nodeNum, nextFreeNode);
-    assert(nodeNum == nextFreeNode);
-    // Get next free node from _nodes_ array
-    if (nextFreeNode == nAllocedNodes) {
-        int nNewAllocNodes = std::max(2 * nAllocedNodes, 512);
-        KdAccelNode *n = new KdAccelNode[nNewAllocNodes];
-        if (nAllocedNodes > 0) {
-            memcpy(n, nodes, nAllocedNodes * sizeof(KdAccelNode));
-            delete[] nodes;
-        }
-        nodes = n;
-        nAllocedNodes = nNewAllocNodes;
-    }
-    ++nextFreeNode;
-
-    // Initialize leaf node if termination criteria met
-    if (nPrimitives <= maxPrims || depth == 0) {
-        nodes[nodeNum].InitLeaf(primNums, nPrimitives, &primitiveIndices);
-        return;
-    }
-
-    // Initialize interior node and continue recursion
+size_t KdTreeAccel::GetMemSize() const {
+    size_t sum = sizeof(*this);
+    sum += nAllocedNodes * sizeof(KdAccelNode);
+    sum += primitives.capacity() * sizeof(std::shared_ptr<Primitive>);
+    sum += primitiveIndices.capacity() * sizeof(int);
+    return sum;
+}
 
-    // Choose split axis position for interior node
-    int bestAxis = -1, bestOffset = -1;
+/**
+* \brief Chooses the split of a node with the surface area heuristic, weighted by hit probabilities if any
+ * \param edges the node's bound edges, sorted for each axis: [2n*axis, 2n*(axis+1)) holds the edges along axis
+ * \return false if the node should be a leaf
+ */
+bool KdTreeAccel::findSplit(const AxisAlignedBoundingBox &nodeBounds, const BoundEdge *edges, int nPrimitives,
+                            const std::vector<double> &probabilities, int prevSplitAxis, int &badRefines,
+                            int &bestAxis, int &bestOffset) const {
+    bestAxis = -1;
+    bestOffset = -1;
     double bestCost = 1.0e99;
     double oldCost = isectCost * double(nPrimitives);
     double totalSA = nodeBounds.SurfaceArea();
     double invTotalSA = 1.0 / totalSA;
     Vector3d d = nodeBounds.max - nodeBounds.min;
 
+    // Total hit probability of the node's primitives, one End edge per primitive
+    double probNode = 0.0;
+    if (!probabilities.empty()) {
+        for (int i = 0; i < 2 * nPrimitives; ++i)
+            if (edges[i].type == EdgeType::End)
+                probNode += probabilities[edges[i].primNum];
+    }
+
     // Choose which axis to split along
     int axis = nodeBounds.MaximumExtent();
     int retries = 0;
     retrySplit:
 
-    // Initialize edges for _axis_
-    for (int i = 0; i < nPrimitives; ++i) {
-        int pn = primNums[i];
-        const AxisAlignedBoundingBox &apBounds = allPrimBounds[pn];
-        edges[axis][2 * i] = BoundEdge(apBounds.min[axis], pn, true);
-        edges[axis][2 * i + 1] = BoundEdge(apBounds.max[axis], pn, false);
-    }
-
-    // Sort _edges_ for _axis_
-    std::sort(&edges[axis][0], &edges[axis][2 * nPrimitives],
-              [](const BoundEdge &e0, const BoundEdge &e1) -> bool {
-                  if (e0.t == e1.t)
-                      return (int)e0.type < (int)e1.type;
-                  else
-                      return e0.t < e1.t;
-              });
+    // Edges of _axis_ were sorted once at the root and kept in order while partitioning
+    const BoundEdge *axisEdges = &edges[2 * nPrimitives * axis];
 
     // Compute cost of all splits for _axis_ to find best
     int nBelow = 0, nAbove = nPrimitives;
     // w/ probability
     double probBelow = 0.0;
-    double probAbove = 0.0;
-
-    // add probability for all edges going in
-    std::set<int> edgeIn;
-    if(!probabilities.empty()) {
-        for (int i = 0; i < 2 * nPrimitives; ++i) {
-            auto inside = edgeIn.find(edges[axis][i].primNum);
-            if(inside != edgeIn.end()) {
-                //probAbove += edges[axis][i].type == EdgeType::End ? probabilities[edges[axis][i].primNum] : 0.0;
-                probAbove += probabilities[edges[axis][i].primNum];
-                edgeIn.erase(inside);
-            }
-            else {
-                edgeIn.insert(edges[axis][i].primNum);
-            }
-        }
-    }
+    double probAbove = probNode;
 
     for (int i = 0; i < 2 * nPrimitives; ++i) {
-        if (edges[axis][i].type == EdgeType::End) {
+        if (axisEdges[i].type == EdgeType::End) {
             --nAbove;
-            if(!probabilities.empty()) {
-                auto inside = edgeIn.find(edges[axis][i].primNum);
-                if(inside == edgeIn.end())
-                    probAbove -= probabilities[edges[axis][i].primNum];
-            }
+            if (!probabilities.empty())
+                probAbove -= probabilities[axisEdges[i].primNum];
         }
-        double edgeT = edges[axis][i].t;
+        double edgeT = axisEdges[i].t;
         if (edgeT > nodeBounds.min[axis] && edgeT < nodeBounds.max[axis]) {
             // Compute cost for split at _i_th edge
 
@@ -316,13 +405,10 @@ void KdTreeAccel::buildTree(int nodeNum, const AxisAlignedBoundingBox &nodeBound
                 bestOffset = i;
             }
         }
-        if (edges[axis][i].type == EdgeType::Start) {
+        if (axisEdges[i].type == EdgeType::Start) {
             ++nBelow;
-            if(!probabilities.empty()) {
-                auto inside = edgeIn.find(edges[axis][i].primNum);
-                if(inside == edgeIn.end())
-                    probBelow += probabilities[edges[axis][i].primNum];
-            }
+            if (!probabilities.empty())
+                probBelow += probabilities[axisEdges[i].primNum];
         }
     }
     //CHECK(nBelow == nPrimitives && nAbove == 0);
@@ -344,31 +430,149 @@ void KdTreeAccel::buildTree(int nodeNum, const AxisAlignedBoundingBox &nodeBound
         goto retrySplit;
     }
     if (bestCost > oldCost) ++badRefines;
-    if ((bestCost > 4 * oldCost && nPrimitives < 16) || bestAxis == -1 ||
-        badRefines == 3) {
-        nodes[nodeNum].InitLeaf(primNums, nPrimitives, &primitiveIndices);
-        return;
-    }
+    return !((bestCost > 4 * oldCost && nPrimitives < 16) || bestAxis == -1 ||
+             badRefines == 3);
+}
 
-    // Classify primitives with respect to split
-    int n0 = 0, n1 = 0;
+//! Marks the primitives below (1) and above (2) the split in side, straddling primitives get both
+static void ClassifyPrimitives(std::vector<uint8_t> &side, const BoundEdge *edges, int nPrimitives,
+                               int bestAxis, int bestOffset, int &n0, int &n1) {
+    const BoundEdge *splitEdges = &edges[2 * nPrimitives * bestAxis];
+    n0 = n1 = 0;
     for (int i = 0; i < bestOffset; ++i)
-        if (edges[bestAxis][i].type == EdgeType::Start)
-            prims0[n0++] = edges[bestAxis][i].primNum;
+        if (splitEdges[i].type == EdgeType::Start) {
+            side[splitEdges[i].primNum] |= 1;
+            ++n0;
+        }
     for (int i = bestOffset + 1; i < 2 * nPrimitives; ++i)
-        if (edges[bestAxis][i].type == EdgeType::End)
-            prims1[n1++] = edges[bestAxis][i].primNum;
+        if (splitEdges[i].type == EdgeType::End) {
+            side[splitEdges[i].primNum] |= 2;
+            ++n1;
+        }
+}
+
+/**
+* \brief Partitions the sorted edges of every axis between the children, and clears side for the next node
+ * A stable pass keeps each child's lists sorted. The below child's edges are compacted in place in edges,
+ * never ahead of the edge being read; the above child's go to edges1.
+ */
+static void PartitionEdges(std::vector<uint8_t> &side, BoundEdge *edges, int nPrimitives,
+                           int n0, int n1, BoundEdge *edges1) {
+    for (int a = 0; a < 3; ++a) {
+        BoundEdge *out0 = &edges[2 * size_t(n0) * a], *out1 = &edges1[2 * size_t(n1) * a];
+        for (int i = 2 * nPrimitives * a; i < 2 * nPrimitives * (a + 1); ++i) {
+            const BoundEdge edge = edges[i];
+            uint8_t s = side[edge.primNum];
+            if (s & 1) *out0++ = edge;
+            if (s & 2) *out1++ = edge;
+            if (a == 2 && edge.type == EdgeType::End) side[edge.primNum] = 0; // last edge of the primitive
+        }
+    }
+}
+
+/**
+* \brief Builds the top of the tree, splitting subtrees over more than KD_TASK_THRESHOLD primitives into OpenMP tasks
+ * \param edges the node's bound edges, sorted for each axis: [2n*axis, 2n*(axis+1)) holds the edges along axis
+ */
+KdBuildNode *KdTreeAccel::buildTree(KdBuildArena &arena, const AxisAlignedBoundingBox &nodeBounds,
+                                    std::unique_ptr<BoundEdge[]> edges, int nPrimitives, int depth,
+                                    int badRefines, int prevSplitAxis) {
+    KdBuildArena::ThreadData &local = arena.Local();
+    KdBuildNode *node = &local.nodes.emplace_back();
+    std::vector<uint8_t> &side = local.Side(primitives.size());
+
+    if (nPrimitives <= KD_TASK_THRESHOLD) {
+        // Children never have more primitives than their parent: one slice of 6n edges per level holds the above children
+        local.scratch.nodes.clear();
+        local.scratch.primitiveIndices.clear();
+        local.aboveEdges.resize(6 * size_t(nPrimitives) * (depth + 1));
+        buildSubtree(local.scratch, side, arena.probabilities, nodeBounds, edges.get(), local.aboveEdges.data(),
+                     nPrimitives, depth, badRefines, prevSplitAxis);
+        node->subtree = local.scratch;
+        return node;
+    }
+
+    int bestAxis, bestOffset;
+    if (nPrimitives <= maxPrims || depth == 0 ||
+        !findSplit(nodeBounds, edges.get(), nPrimitives, arena.probabilities, prevSplitAxis, badRefines, bestAxis, bestOffset)) {
+        node->subtree.nodes.emplace_back().InitLeaf(edges.get(), nPrimitives, &node->subtree.primitiveIndices);
+        return node;
+    }
+
+    // Recursively initialize children nodes
+    node->axis = bestAxis;
+    node->split = edges[2 * nPrimitives * bestAxis + bestOffset].t;
+    int n0, n1;
+    ClassifyPrimitives(side, edges.get(), nPrimitives, bestAxis, bestOffset, n0, n1);
+    std::unique_ptr<BoundEdge[]> edges1(new BoundEdge[6 * size_t(n1)]);
+    PartitionEdges(side, edges.get(), nPrimitives, n0, n1, edges1.get());
+    AxisAlignedBoundingBox bounds0 = nodeBounds, bounds1 = nodeBounds;
+    bounds0.max[bestAxis] = bounds1.min[bestAxis] = node->split;
+
+    // Children own their edge lists, the below one reusing the node's, so it can run as a task
+    if (n0 > KD_TASK_THRESHOLD) {
+#pragma omp task default(shared)
+        node->children[0] = buildTree(arena, bounds0, std::move(edges), n0, depth - 1, badRefines, bestAxis);
+        node->children[1] = buildTree(arena, bounds1, std::move(edges1), n1, depth - 1, badRefines, bestAxis);
+#pragma omp taskwait
+    } else {
+        node->children[0] = buildTree(arena, bounds0, std::move(edges), n0, depth - 1, badRefines, bestAxis);
+        node->children[1] = buildTree(arena, bounds1, std::move(edges1), n1, depth - 1, badRefines, bestAxis);
+    }
+    return node;
+}
+
+/**
+* \brief Builds a subtree serially, appending its nodes depth-first to subtree (below child right after its parent)
+ * \param edges the node's sorted bound edges, reused in place by the below child
+ * \param aboveEdges workspace: the above child's edges go to its start, descendants use what follows the first 6n edges
+ */
+void KdTreeAccel::buildSubtree(KdSubtree &subtree, std::vector<uint8_t> &side, const std::vector<double> &probabilities,
+                               const AxisAlignedBoundingBox &nodeBounds, BoundEdge *edges, BoundEdge *aboveEdges,
+                               int nPrimitives, int depth, int badRefines, int prevSplitAxis) const {
+    const int nodeNum = (int) subtree.nodes.size();
+    subtree.nodes.emplace_back();
+
+    // Initialize leaf node if termination criteria met
+    int bestAxis, bestOffset;
+    if (nPrimitives <= maxPrims || depth == 0 ||
+        !findSplit(nodeBounds, edges, nPrimitives, probabilities, prevSplitAxis, badRefines, bestAxis, bestOffset)) {
+        subtree.nodes[nodeNum].InitLeaf(edges, nPrimitives, &subtree.primitiveIndices);
+        return;
+    }
 
     // Recursively initialize children nodes
-    double tSplit = edges[bestAxis][bestOffset].t;
+    double tSplit = edges[2 * nPrimitives * bestAxis + bestOffset].t;
+    int n0, n1;
+    ClassifyPrimitives(side, edges, nPrimitives, bestAxis, bestOffset, n0, n1);
+    PartitionEdges(side, edges, nPrimitives, n0, n1, aboveEdges);
     AxisAlignedBoundingBox bounds0 = nodeBounds, bounds1 = nodeBounds;
     bounds0.max[bestAxis] = bounds1.min[bestAxis] = tSplit;
-    buildTree(nodeNum + 1, bounds0, allPrimBounds, prims0, n0, depth - 1, edges,
-              prims0, prims1 + nPrimitives, badRefines, probabilities, bestAxis);
-    int aboveChild = nextFreeNode;
-    nodes[nodeNum].InitInterior(bestAxis, aboveChild, tSplit);
-    buildTree(aboveChild, bounds1, allPrimBounds, prims1, n1, depth - 1, edges,
-              prims0, prims1 + nPrimitives, badRefines, probabilities, bestAxis);
+    BoundEdge *childAboveEdges = aboveEdges + 6 * size_t(nPrimitives);
+    buildSubtree(subtree, side, probabilities, bounds0, edges, childAboveEdges, n0, depth - 1, badRefines, bestAxis);
+    int aboveChild = (int) subtree.nodes.size();
+    subtree.nodes[nodeNum].InitInterior(bestAxis, aboveChild, tSplit);
+    buildSubtree(subtree, side, probabilities, bounds1, aboveEdges, childAboveEdges, n1, depth - 1, badRefines, bestAxis);
+}
+
+//! Writes the tree in depth-first order from its top nodes and serial subtrees, returns the node number of node
+int KdTreeAccel::flattenTree(const KdBuildNode *node) {
+    int nodeNum = nextFreeNode;
+    if (!node->children[0]) {
+        int primOffset = (int) primitiveIndices.size();
+        primitiveIndices.insert(primitiveIndices.end(), node->subtree.primitiveIndices.begin(),
+                                node->subtree.primitiveIndices.end());
+        for (const KdAccelNode &subtreeNode : node->subtree.nodes) {
+            nodes[nextFreeNode] = subtreeNode;
+            nodes[nextFreeNode++].Relocate(nodeNum, primOffset);
+        }
+    } else {
+        ++nextFreeNode;
+        flattenTree(node->children[0]);
+        int aboveChild = flattenTree(node->children[1]);
+        nodes[nodeNum].InitInterior(node->axis, aboveChild, node->split);
+    }
+    return nodeNum;
 }
 
 bool KdTreeAccel::Intersect(Ray &ray) {
@@ -387,10 +591,13 @@ bool KdTreeAccel::Intersect(Ray &ray) {
 
     // Traverse kd-tree nodes in order for ray
     bool hit = false;
+    size_t nbTransparent = ray.transparentHits.size();
+    uint64_t nbNodes = 0, nbTests = 0;
     const KdAccelNode *node = &nodes[0];
     while (node != nullptr) {
         // Bail out if we found a hit closer than the current node
         if (ray.tMax < tMin) break;
+        ++nbNodes;
         if (!node->IsLeaf()) {
             // Process kd-tree interior node
 
@@ -433,16 +640,20 @@ bool KdTreeAccel::Intersect(Ray &ray) {
                         primitives[node->onePrimitive];
 
                 // Check one primitive inside leaf node
-                if (p->globalId != ray.lastIntersectedId && p->Intersect(ray))
-                    hit = true;
+                if (p->globalId != ray.lastIntersectedId) {
+                    ++nbTests;
+                    if (p->Intersect(ray)) hit = true;
+                }
             } else {
                 for (int i = 0; i < nPrimitives; ++i) {
                     int index =
                             primitiveIndices[node->primitiveIndicesOffset + i];
                     const std::shared_ptr<Primitive> &p = primitives[index];
                     // Check one primitive inside leaf node
-                    if (p->globalId != ray.lastIntersectedId && p->Intersect(ray))
-                        hit = true;
+                    if (p->globalId != ray.lastIntersectedId) {
+                        ++nbTests;
+                        if (p->Intersect(ray)) hit = true;
+                    }
                 }
             }
 
@@ -456,6 +667,10 @@ bool KdTreeAccel::Intersect(Ray &ray) {
                 break;
         }
     }
+    threadTelemetry.raysTraced++;
+    threadTelemetry.nodesVisited += nbNodes;
+    threadTelemetry.primitiveTests += nbTests;
+    threadTelemetry.transparentPasses += ray.transparentHits.size() - nbTransparent;
     return hit;
 }
 
@@ -463,6 +678,7 @@ KdTreeAccel::KdTreeAccel(KdTreeAccel &&src) noexcept : isectCost(src.isectCost),
                                                        traversalCost(src.traversalCost),
                                                        maxPrims(src.maxPrims),
                                                        emptyBonus(src.emptyBonus),
+                                                       maxDepth(src.maxDepth),
                                                        primitives(std::move(src.primitives)),
                                                        primitiveIndices(std::move(src.primitiveIndices)){
     nodes = src.nodes;
@@ -476,6 +692,7 @@ KdTreeAccel::KdTreeAccel(const KdTreeAccel &src) noexcept : isectCost(src.isectC
                                                             traversalCost(src.traversalCost),
                                                             maxPrims(src.maxPrims),
                                                             emptyBonus(src.emptyBonus),
+                                                            maxDepth(src.maxDepth),
                                                             primitives(src.primitives),
                                                             primitiveIndices(src.primitiveIndices) {
     if(nodes)
@@ -1,6 +1,7 @@
 #ifndef MOLFLOW_PROJ_KDTREE_H
 #define MOLFLOW_PROJ_KDTREE_H
 
+#include <cstdint>
 #include <vector>
 #include <memory>
 #include <FacetData.h>
@@ -11,6 +12,9 @@ using Primitive = RTFacet;
 // KdTreeAccel Forward Declarations
 struct KdAccelNode;
 struct BoundEdge;
+struct KdBuildNode;
+struct KdBuildArena;
+struct KdSubtree;
 class KdTreeAccel : public RTPrimitive {
 public:
     // KdTreeAccel Public Methods
@@ -24,19 +28,29 @@ public:
     ~KdTreeAccel() override;
 
     bool Intersect(Ray &ray);
+    void Rebuild(const std::vector<double> &probabilities);
+    size_t GetMemSize() const; // bytes of the tree and its primitive index lists, primitives themselves excluded
 
 private:
     void ComputeBB() override;
     // KdTreeAccel Private Methods
-    void buildTree(int nodeNum, const AxisAlignedBoundingBox &nodeBounds,
-                   const std::vector<AxisAlignedBoundingBox> &allPrimBounds, int *primNums, int nPrimitives,
-                   int depth, const std::unique_ptr<BoundEdge[]> edges[3], int *prims0, int *prims1,
-                   int badRefines, const std::vector<double> &probabilities, int prevSplitAxis);
+    void Build(const std::vector<double> &probabilities);
+    bool findSplit(const AxisAlignedBoundingBox &nodeBounds, const BoundEdge *edges, int nPrimitives,
+                   const std::vector<double> &probabilities, int prevSplitAxis, int &badRefines,
+                   int &bestAxis, int &bestOffset) const;
+    KdBuildNode *buildTree(KdBuildArena &arena, const AxisAlignedBoundingBox &nodeBounds,
+                           std::unique_ptr<BoundEdge[]> edges, int nPrimitives, int depth,
+                           int badRefines, int prevSplitAxis);
+    void buildSubtree(KdSubtree &subtree, std::vector<uint8_t> &side, const std::vector<double> &probabilities,
+                      const AxisAlignedBoundingBox &nodeBounds, BoundEdge *edges, BoundEdge *aboveEdges,
+                      int nPrimitives, int depth, int badRefines, int prevSplitAxis) const;
+    int flattenTree(const KdBuildNode *node);
 
 private:
     // KdTreeAccel Private Data
     const int isectCost, traversalCost, maxPrims;
     const double emptyBonus;
+    const int maxDepth; // <= 0: chosen from the number of primitives
     std::vector<std::shared_ptr<Primitive>> primitives;
     std::vector<int> primitiveIndices;
     KdAccelNode *nodes;
@@ -0,0 +1,479 @@
+#include "RTBenchmark.h"
+#include "KDTree.h"
+#include "Instancing.h"
+#include "Ray.h"
+#include "Random.h"
+#include "STLImport.h"
+#include "Helper/GLProgress_abstract.hpp"
+#include "Helper/MathTools.h" //Next
+#include "ThreadTelemetry.h"
+#include "GLApp/GLTypes.h" //Error
+#include <algorithm>
+#include <cmath>
+#include <fmt/core.h>
+#include <omp.h>
+
+/**
+* \brief Computes the facet parameters from its 3D polygon, same as SimulationModel::CalculateFacetParams()
+ * \param id globalId of the facet, index into ProbSplit probabilities
+ */
+RTBenchmark::BenchmarkFacet::BenchmarkFacet(const std::vector<Vector3d> &polygon, size_t id) : RTFacet(polygon.size()) {
+    static const auto opaqueSurface = std::make_shared<Surface>();
+    const size_t nbIndex = polygon.size();
+    indices.resize(nbIndex);
+    vertices2.resize(nbIndex);
+    for (size_t i = 0; i < nbIndex; ++i) indices[i] = i;
+    globalId = id;
+    surf = opaqueSurface;
+
+    // Normal from the first non-collinear consecutive edges
+    for (size_t i = 2; i < nbIndex; ++i) {
+        sh.N = CrossProduct(polygon[i - 1] - polygon[i - 2], polygon[i] - polygon[i - 1]);
+        if (sh.N.Norme() > 1e-12) break;
+    }
+    sh.N = sh.N.Normalized();
+
+    for (const auto &p : polygon) sh.bb = AxisAlignedBoundingBox::Union(sh.bb, p);
+    sh.center = 0.5 * (sh.bb.max + sh.bb.min);
+
+    const Vector3d &p0 = polygon[0];
+    Vector3d U = (polygon[1] - p0).Normalized();
+    Vector3d V = CrossProduct(sh.N, U);
+
+    Vector2d BBmin(0.0, 0.0), BBmax(0.0, 0.0);
+    for (size_t j = 0; j < nbIndex; ++j) {
+        const Vector3d v = polygon[j] - p0;
+        vertices2[j] = Vector2d(Dot(U, v), Dot(V, v));
+        BBmax.u = std::max(BBmax.u, vertices2[j].u);
+        BBmax.v = std::max(BBmax.v, vertices2[j].v);
+        BBmin.u = std::min(BBmin.u, vertices2[j].u);
+        BBmin.v = std::min(BBmin.v, vertices2[j].v);
+    }
+
+    double area = 0.0;
+    for (size_t j = 0; j < nbIndex; ++j) {
+        const size_t jNext = Next(j, nbIndex);
+        area += vertices2[j].u * vertices2[jNext].v - vertices2[jNext].u * vertices2[j].v;
+    }
+    if (area < 0.0) { // Concave polygon whose first turn is against the outline rotation
+        sh.N = -1.0 * sh.N;
+        V = -1.0 * V;
+        BBmin.v = BBmax.v = 0.0;
+        for (auto &v : vertices2) {
+            v.v = -1.0 * v.v;
+            BBmax.v = std::max(BBmax.v, v.v);
+            BBmin.v = std::min(BBmin.v, v.v);
+        }
+    }
+    sh.area = std::abs(0.5 * area);
+
+    const double uD = BBmax.u - BBmin.u;
+    const double vD = BBmax.v - BBmin.v;
+    sh.O = p0 + BBmin.u * U + BBmin.v * V;
+    sh.nU = U;
+    sh.U = U * uD;
+    sh.nV = V;
+    sh.V = V * vD;
+    sh.Nuv = CrossProduct(sh.U, sh.V);
+    for (auto &p : vertices2) {
+        p.u = (p.u - BBmin.u) / uD;
+        p.v = (p.v - BBmin.v) / vD;
+    }
+
+    InitShape();
+    InitPolyGrid();
+}
+
+// Adds the polygon with its normal turned towards inside (flips the vertex order if needed)
+static void AddInwardFacet(std::vector<std::shared_ptr<Primitive>> &primitives, std::vector<Vector3d> polygon, const Vector3d &inside) {
+    Vector3d center;
+    for (const auto &p : polygon) center = center + p;
+    center = center * (1.0 / (double) polygon.size());
+    const Vector3d normal = CrossProduct(polygon[1] - polygon[0], polygon[2] - polygon[1]);
+    if (Dot(normal, inside - center) < 0.0)
+        std::reverse(polygon.begin() + 1, polygon.end());
+    primitives.push_back(std::make_shared<RTBenchmark::BenchmarkFacet>(polygon, primitives.size()));
+}
+
+/**
+* \brief Closed tube along z, made of nbSides x nbSegments rectangles and two end caps (nbSides-gons)
+ * Long tubes are the typical Molflow vacuum chamber: long thin leaves, most rays travelling along the axis
+ */
+std::vector<std::shared_ptr<Primitive>> RTBenchmark::MakeTube(size_t nbSides, size_t nbSegments, double length, double radius) {
+    std::vector<std::shared_ptr<Primitive>> primitives;
+    nbSides = std::max<size_t>(nbSides, 3);
+    nbSegments = std::max<size_t>(nbSegments, 1);
+    auto ringPoint = [&](size_t side, size_t segment) {
+        const double phi = 2.0 * 3.14159265358979323846 * (double) (side % nbSides) / (double) nbSides;
+        return Vector3d(radius * std::cos(phi), radius * std::sin(phi), length * (double) segment / (double) nbSegments);
+    };
+    for (size_t seg = 0; seg < nbSegments; ++seg) {
+        const Vector3d axisPoint(0.0, 0.0, length * ((double) seg + 0.5) / (double) nbSegments);
+        for (size_t side = 0; side < nbSides; ++side) {
+            AddInwardFacet(primitives, {ringPoint(side, seg), ringPoint(side + 1, seg),
+                                        ringPoint(side + 1, seg + 1), ringPoint(side, seg + 1)}, axisPoint);
+        }
+    }
+    const Vector3d middle(0.0, 0.0, 0.5 * length);
+    std::vector<Vector3d> cap0, cap1;
+    for (size_t side = 0; side < nbSides; ++side) {
+        cap0.push_back(ringPoint(side, 0));
+        cap1.push_back(ringPoint(side, nbSegments));
+    }
+    AddInwardFacet(primitives, cap0, middle);
+    AddInwardFacet(primitives, cap1, middle);
+    return primitives;
+}
+
+/**
+* \brief Latitude/longitude triangulation of the unit sphere
+ * With r bands and 2r meridians, the sphere has 4r(r-1) triangles, r is chosen to be closest to nbTriangles
+ */
+std::vector<std::shared_ptr<Primitive>> RTBenchmark::MakeSphere(size_t nbTriangles) {
+    std::vector<std::shared_ptr<Primitive>> primitives;
+    const size_t nbBands = std::max<size_t>(2, (size_t) std::lround(0.5 + std::sqrt(0.25 + (double) nbTriangles / 4.0)));
+    const size_t nbMeridians = 2 * nbBands;
+    auto spherePoint = [&](size_t band, size_t meridian) {
+        const double theta = 3.14159265358979323846 * (double) band / (double) nbBands;
+        const double phi = 2.0 * 3.14159265358979323846 * (double) (meridian % nbMeridians) / (double) nbMeridians;
+        return Vector3d(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta));
+    };
+    const Vector3d center(0.0, 0.0, 0.0);
+    for (size_t band = 0; band < nbBands; ++band) {
+        for (size_t m = 0; m < nbMeridians; ++m) {
+            if (band != nbBands - 1) // no degenerate triangle at the south pole
+                AddInwardFacet(primitives, {spherePoint(band, m), spherePoint(band + 1, m), spherePoint(band + 1, m + 1)}, center);
+            if (band != 0) // nor at the north pole
+                AddInwardFacet(primitives, {spherePoint(band, m), spherePoint(band + 1, m + 1), spherePoint(band, m + 1)}, center);
+        }
+    }
+    return primitives;
+}
+
+/**
+* \brief Randomly placed and oriented two-sided triangles in the unit cube
+ * Edge length scales with the mean spacing of the triangles, so the overlap stays similar for any nbTriangles
+ */
+std::vector<std::shared_ptr<Primitive>> RTBenchmark::MakeSoup(size_t nbTriangles, unsigned long seed) {
+    std::vector<std::shared_ptr<Primitive>> primitives;
+    MersenneTwister rng;
+    rng.SetSeed(seed);
+    const double size = 2.0 / std::cbrt((double) std::max<size_t>(nbTriangles, 1));
+    auto randomPoint = [&](const Vector3d &center) {
+        return center + size * Vector3d(rng.rnd() - 0.5, rng.rnd() - 0.5, rng.rnd() - 0.5);
+    };
+    while (primitives.size() < nbTriangles) {
+        const Vector3d center(rng.rnd(), rng.rnd(), rng.rnd());
+        std::vector<Vector3d> triangle{randomPoint(center), randomPoint(center), randomPoint(center)};
+        if (CrossProduct(triangle[1] - triangle[0], triangle[2] - triangle[0]).Norme() < 1e-6 * size * size)
+            continue;
+        auto facet = std::make_shared<BenchmarkFacet>(triangle, primitives.size());
+        facet->sh.is2sided = true;
+        primitives.push_back(facet);
+    }
+    return primitives;
+}
+
+/**
+* \brief Periodic chamber: nbCells copies of a closed nbSides x nbSegments tube cell of length 10, put end to end along z
+ * Each cell is turned around the axis by a different angle, so copies are rotated as well as translated
+ */
+std::vector<std::shared_ptr<Primitive>> RTBenchmark::MakeLattice(size_t nbCells, size_t nbSides, size_t nbSegments,
+                                                                 std::vector<size_t> &facetGroups) {
+    const double cellLength = 10.0;
+    const auto cell = MakeTube(nbSides, nbSegments, cellLength, 1.0);
+    std::vector<std::shared_ptr<Primitive>> primitives;
+    facetGroups.clear();
+    for (size_t c = 0; c < nbCells; ++c) {
+        const double angle = 0.7 * (double) c;
+        const double cosA = std::cos(angle), sinA = std::sin(angle);
+        for (const auto &facet : cell) {
+            // 3D polygon back from the (u,v) vertices, then turned and shifted
+            std::vector<Vector3d> polygon;
+            for (const auto &p : facet->vertices2) {
+                const Vector3d v = facet->sh.O + p.u * facet->sh.U + p.v * facet->sh.V;
+                polygon.emplace_back(cosA * v.x - sinA * v.y, sinA * v.x + cosA * v.y, v.z + cellLength * (double) c);
+            }
+            primitives.push_back(std::make_shared<BenchmarkFacet>(polygon, primitives.size()));
+            facetGroups.push_back(c);
+        }
+    }
+    return primitives;
+}
+
+namespace {
+    //! Progress sink for the STL reader, the benchmark only reports timings
+    class SilentProgress : public GLProgress_Abstract {
+    public:
+        void SetMessage(const std::string&, const bool = false, const bool = false) override {}
+        void SetProgress(const double) override {}
+    };
+}
+
+/**
+* \brief Reads the triangles of an STL file with the application's STL reader, degenerate triangles are skipped
+ * Only vertices with identical coordinates are merged, so every triangle keeps the coordinates of the file
+ */
+std::vector<std::shared_ptr<Primitive>> RTBenchmark::LoadSTL(const std::string &filePath) {
+    SilentProgress prg;
+    const RawSTLfile stl = LoadRawSTL(filePath, prg);
+
+    std::vector<std::shared_ptr<Primitive>> primitives;
+    primitives.reserve(stl.triangleCount);
+    for (const auto &body : stl.bodies) {
+        for (const auto &tri : body.triangles) {
+            std::vector<Vector3d> triangle{stl.vertices[tri.indices[0]], stl.vertices[tri.indices[1]], stl.vertices[tri.indices[2]]};
+            if (CrossProduct(triangle[1] - triangle[0], triangle[2] - triangle[1]).Norme() > 0.0)
+                primitives.push_back(std::make_shared<BenchmarkFacet>(triangle, primitives.size()));
+        }
+    }
+    return primitives;
+}
+
+void RTBenchmark::GenerateRays(RTPrimitive &accel, std::vector<Ray> &rays, unsigned long seed) {
+    accel.ComputeBB();
+    GenerateRays(accel.bb, rays, seed);
+}
+
+void RTBenchmark::GenerateRays(const AxisAlignedBoundingBox &bounds, std::vector<Ray> &rays, unsigned long seed) {
+    MersenneTwister rng;
+    rng.SetSeed(seed);
+    const Vector3d extent = bounds.Diagonal();
+    for (auto &ray : rays) {
+        ray.origin = Vector3d(bounds.min.x + rng.rnd() * extent.x,
+                              bounds.min.y + rng.rnd() * extent.y,
+                              bounds.min.z + rng.rnd() * extent.z);
+        const double cosTheta = 2.0 * rng.rnd() - 1.0;
+        const double sinTheta = std::sqrt(1.0 - cosTheta * cosTheta);
+        const double phi = 2.0 * 3.14159265358979323846 * rng.rnd();
+        ray.direction = Vector3d(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+        ray.tMax = inf_d;
+    }
+}
+
+/**
+* \brief Traces the same ray set through the scalar and the packet traversal
+ * \return rays/s of both paths and the number of rays with differing results
+ */
+RTBenchmark::BatchComparison RTBenchmark::CompareBatchTraversal(BVHAccel &bvh, size_t nbRays, unsigned long seed) {
+    BatchComparison result;
+    result.nbRays = nbRays;
+
+    // Ray is not copyable (owns its payload), so construct both sets in place
+    std::vector<Ray> scalarRays(nbRays);
+    std::vector<Ray> batchRays(nbRays);
+    GenerateRays(bvh, scalarRays, seed);
+    GenerateRays(bvh, batchRays, seed);
+
+    // Identical RNG streams for semi-transparent facets
+    RandomEngine scalarRng, batchRng;
+    scalarRng.SetSeed(seed);
+    batchRng.SetSeed(seed);
+    for (size_t i = 0; i < nbRays; ++i) {
+        scalarRays[i].rng = &scalarRng;
+        batchRays[i].rng = &batchRng;
+    }
+
+    std::vector<bool> scalarHits(nbRays);
+    double start = omp_get_wtime();
+    for (size_t i = 0; i < nbRays; ++i) {
+        scalarHits[i] = bvh.Intersect(scalarRays[i]);
+    }
+    double elapsed = omp_get_wtime() - start;
+    result.scalarRaysPerSec = elapsed > 0.0 ? (double) nbRays / elapsed : 0.0;
+
+    start = omp_get_wtime();
+    std::vector<bool> batchHits = bvh.IntersectBatch(batchRays.data(), nbRays);
+    elapsed = omp_get_wtime() - start;
+    result.batchRaysPerSec = elapsed > 0.0 ? (double) nbRays / elapsed : 0.0;
+
+    for (size_t i = 0; i < nbRays; ++i) {
+        if (scalarHits[i] != batchHits[i]
+            || scalarRays[i].tMax != batchRays[i].tMax
+            || scalarRays[i].hardHit.facetId != batchRays[i].hardHit.facetId
+            || scalarRays[i].transparentHits.size() != batchRays[i].transparentHits.size())
+            ++result.nbMismatches;
+    }
+    return result;
+}
+
+/**
+* \brief Build time and trace throughput per split method, on the same primitives and ray set
+ * Rays are generated in the bounding box of the first built tree, so all builders see identical rays
+ */
+std::vector<RTBenchmark::BuilderComparison> RTBenchmark::CompareSplitMethods(const std::vector<std::shared_ptr<Primitive>> &primitives,
+                                                                             const std::vector<BVHAccel::SplitMethod> &splitMethods,
+                                                                             size_t nbRays, unsigned long seed) {
+    std::vector<BuilderComparison> results;
+    for (const auto splitMethod : splitMethods) {
+        BuilderComparison result;
+        result.splitMethod = splitMethod;
+
+        double start = omp_get_wtime();
+        BVHAccel bvh(primitives, 1, splitMethod);
+        result.buildTimeMs = (omp_get_wtime() - start) * 1000.0;
+
+        std::vector<Ray> rays(nbRays);
+        GenerateRays(bvh, rays, seed);
+        RandomEngine rng;
+        rng.SetSeed(seed);
+        for (auto &ray : rays) ray.rng = &rng;
+
+        start = omp_get_wtime();
+        for (auto &ray : rays) {
+            if (bvh.Intersect(ray)) ++result.nbHits;
+        }
+        double elapsed = omp_get_wtime() - start;
+        result.raysPerSec = elapsed > 0.0 ? (double) nbRays / elapsed : 0.0;
+        results.push_back(result);
+    }
+    return results;
+}
+
+// Traces a fresh copy of the ray set through accel, counting node visits and facet tests via the thread telemetry
+template <typename Accel>
+static void TraceRays(Accel &accel, const AxisAlignedBoundingBox &bounds, size_t nbRays, unsigned long seed,
+                      RTBenchmark::AccelResult &result) {
+    std::vector<Ray> rays(nbRays);
+    RTBenchmark::GenerateRays(bounds, rays, seed);
+    RandomEngine rng;
+    rng.SetSeed(seed);
+    for (auto &ray : rays) ray.rng = &rng;
+
+    const TelemetryCounts before = threadTelemetry;
+    double start = omp_get_wtime();
+    for (auto &ray : rays) {
+        if (accel.Intersect(ray)) ++result.nbHits;
+    }
+    double elapsed = omp_get_wtime() - start;
+    result.raysPerSec = elapsed > 0.0 ? (double) nbRays / elapsed : 0.0;
+    if (nbRays > 0) {
+        result.nodesPerRay = (double) (threadTelemetry.nodesVisited - before.nodesVisited) / (double) nbRays;
+        result.testsPerRay = (double) (threadTelemetry.primitiveTests - before.primitiveTests) / (double) nbRays;
+    }
+}
+
+static std::string SplitMethodName(BVHAccel::SplitMethod splitMethod) {
+    switch (splitMethod) {
+        case BVHAccel::SplitMethod::SAH:
+            return "SAH";
+        case BVHAccel::SplitMethod::HLBVH:
+            return "HLBVH";
+        case BVHAccel::SplitMethod::Middle:
+            return "Middle";
+        case BVHAccel::SplitMethod::EqualCounts:
+            return "EqualCounts";
+        case BVHAccel::SplitMethod::MolflowSplit:
+            return "MolflowSplit";
+        case BVHAccel::SplitMethod::ProbSplit:
+            return "ProbSplit";
+    }
+    return "Unknown";
+}
+
+/**
+* \brief Build time, memory and trace statistics of every accel structure variant, on the same primitives and ray set
+ * ProbSplit and the probability-guided kd-tree get hit probabilities from a pilot trace of a second ray set (seed+1) through the SAH BVH,
+ * the same way a simulation rebuilds its accel structure after a pilot run (see SimulationController::RebuildAccelFromHits())
+ */
+std::vector<RTBenchmark::AccelResult> RTBenchmark::CompareAccelStructures(const std::vector<std::shared_ptr<Primitive>> &primitives,
+                                                                          size_t nbRays, unsigned long seed,
+                                                                          const std::vector<size_t> &facetGroups) {
+    std::vector<AccelResult> results;
+    AxisAlignedBoundingBox bounds;
+    size_t maxId = 0;
+    for (const auto &prim : primitives) {
+        bounds = AxisAlignedBoundingBox::Union(bounds, prim->sh.bb);
+        maxId = std::max(maxId, prim->globalId);
+    }
+
+    std::vector<size_t> hitCounts(maxId + 1, 0);
+    {
+        BVHAccel pilotBVH(primitives);
+        std::vector<Ray> pilotRays(nbRays);
+        GenerateRays(bounds, pilotRays, seed + 1);
+        RandomEngine rng;
+        rng.SetSeed(seed + 1);
+        for (auto &ray : pilotRays) {
+            ray.rng = &rng;
+            if (pilotBVH.Intersect(ray) && ray.hardHit.facetId <= maxId) ++hitCounts[ray.hardHit.facetId];
+        }
+    }
+    const std::vector<double> probabilities = HitCountsToProbabilities(hitCounts);
+
+    struct BVHVariant {
+        BVHAccel::SplitMethod splitMethod;
+        int nodeWidth;
+        bool floatBounds = false;
+    };
+    const std::vector<BVHVariant> bvhVariants{
+            {BVHAccel::SplitMethod::SAH, 2}, {BVHAccel::SplitMethod::HLBVH, 2}, {BVHAccel::SplitMethod::Middle, 2},
+            {BVHAccel::SplitMethod::EqualCounts, 2}, {BVHAccel::SplitMethod::MolflowSplit, 2},
+            {BVHAccel::SplitMethod::ProbSplit, 2}, {BVHAccel::SplitMethod::SAH, 4}, {BVHAccel::SplitMethod::SAH, 8},
+            {BVHAccel::SplitMethod::SAH, 4, true}, {BVHAccel::SplitMethod::SAH, 8, true}};
+    for (const auto &variant : bvhVariants) {
+        AccelResult result;
+        result.name = "BVH_" + SplitMethodName(variant.splitMethod);
+        if (variant.nodeWidth > 2) result.name += "_W" + std::to_string(variant.nodeWidth);
+        if (variant.floatBounds) result.name += "_F32";
+
+        double start = omp_get_wtime();
+        BVHAccel bvh(primitives, 1, variant.splitMethod, probabilities, variant.nodeWidth, variant.floatBounds);
+        result.buildTimeMs = (omp_get_wtime() - start) * 1000.0;
+        result.memBytes = bvh.GetMemSize();
+        TraceRays(bvh, bounds, nbRays, seed, result);
+        results.push_back(result);
+    }
+
+    for (const bool withProbabilities : {false, true}) {
+        AccelResult result;
+        result.name = withProbabilities ? "KdTree_Prob" : "KdTree";
+        double start = omp_get_wtime();
+        KdTreeAccel kdTree(primitives, withProbabilities ? probabilities : std::vector<double>{});
+        result.buildTimeMs = (omp_get_wtime() - start) * 1000.0;
+        result.memBytes = kdTree.GetMemSize();
+        TraceRays(kdTree, bounds, nbRays, seed, result);
+        results.push_back(result);
+    }
+
+    if (!facetGroups.empty()) {
+        AccelResult result;
+        result.name = "Instanced_BVH_SAH";
+        double start = omp_get_wtime();
+        InstancedAccel instanced(FindInstances(primitives, facetGroups), [](std::vector<std::shared_ptr<Primitive>> facets) {
+            return std::make_unique<BVHAccel>(std::move(facets), 1, BVHAccel::SplitMethod::SAH);
+        });
+        result.buildTimeMs = (omp_get_wtime() - start) * 1000.0;
+        result.memBytes = instanced.GetMemSize();
+        TraceRays(instanced, bounds, nbRays, seed, result);
+        results.push_back(result);
+    }
+    return results;
+}
+
+std::string RTBenchmark::AccelResultsToJson(const std::string &geometry, size_t nbPrimitives, size_t nbRays,
+                                            const std::vector<AccelResult> &results) {
+    std::string json = fmt::format("{{\"geometry\":\"{}\",\"primitives\":{},\"rays\":{},\"accels\":[", geometry, nbPrimitives, nbRays);
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto &r = results[i];
+        json += fmt::format("{}{{\"name\":\"{}\",\"buildTimeMs\":{:.3f},\"memBytes\":{},\"raysPerSec\":{:.1f},"
+                            "\"nodesPerRay\":{:.3f},\"testsPerRay\":{:.3f},\"hits\":{}}}",
+                            i ? "," : "", r.name, r.buildTimeMs, r.memBytes, r.raysPerSec, r.nodesPerRay, r.testsPerRay, r.nbHits);
+    }
+    json += "]}";
+    return json;
+}
+
+std::string RTBenchmark::AccelResultsCsvHeader() {
+    return "geometry,primitives,rays,accel,buildTimeMs,memBytes,raysPerSec,nodesPerRay,testsPerRay,hits";
+}
+
+std::string RTBenchmark::AccelResultsToCsv(const std::string &geometry, size_t nbPrimitives, size_t nbRays,
+                                           const std::vector<AccelResult> &results) {
+    std::string csv;
+    for (const auto &r : results) {
+        csv += fmt::format("{},{},{},{},{:.3f},{},{:.1f},{:.3f},{:.3f},{}\n", geometry, nbPrimitives, nbRays,
+                           r.name, r.buildTimeMs, r.memBytes, r.raysPerSec, r.nodesPerRay, r.testsPerRay, r.nbHits);
+    }
+    return csv;
+}
@@ -0,0 +1,75 @@
+#ifndef MOLFLOW_PROJ_RTBENCHMARK_H
+#define MOLFLOW_PROJ_RTBENCHMARK_H
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstddef>
+#include "BVH.h"
+
+class RTPrimitive;
+class Ray;
+
+// Throughput measurements of the ray tracing accel structures, independent of a full simulation run
+namespace RTBenchmark {
+    struct BatchComparison {
+        size_t nbRays = 0;
+        double scalarRaysPerSec = 0.0; // BVHAccel::Intersect(), one ray at a time
+        double batchRaysPerSec = 0.0; // BVHAccel::IntersectBatch()
+        size_t nbMismatches = 0; // rays whose hit result differs between the two paths
+    };
+
+    struct BuilderComparison {
+        BVHAccel::SplitMethod splitMethod = BVHAccel::SplitMethod::SAH;
+        double buildTimeMs = 0.0;
+        double raysPerSec = 0.0;
+        size_t nbHits = 0;
+    };
+
+    // One accel structure variant (BVH split method / node width, or kd-tree) on a geometry
+    struct AccelResult {
+        std::string name;
+        double buildTimeMs = 0.0;
+        size_t memBytes = 0; // see BVHAccel::GetMemSize()
+        double raysPerSec = 0.0;
+        double nodesPerRay = 0.0; // node bounds tested, from threadTelemetry
+        double testsPerRay = 0.0; // facet intersection tests, from threadTelemetry
+        size_t nbHits = 0; // must be equal for all variants of a geometry
+    };
+
+    // Facet built directly from its 3D polygon, for geometries that don't come with a SimulationModel
+    class BenchmarkFacet : public RTFacet {
+    public:
+        BenchmarkFacet(const std::vector<Vector3d> &polygon, size_t id);
+    };
+
+    // Synthetic geometries, facet normals pointing inwards (the gas side) for the closed ones
+    std::vector<std::shared_ptr<Primitive>> MakeTube(size_t nbSides, size_t nbSegments, double length, double radius);
+    std::vector<std::shared_ptr<Primitive>> MakeSphere(size_t nbTriangles); // unit sphere, approximately nbTriangles
+    std::vector<std::shared_ptr<Primitive>> MakeSoup(size_t nbTriangles, unsigned long seed); // two-sided triangles in the unit cube
+    // Chain of identical tube cells along z, each turned around the axis, facetGroups receives the cell of each facet
+    std::vector<std::shared_ptr<Primitive>> MakeLattice(size_t nbCells, size_t nbSides, size_t nbSegments, std::vector<size_t> &facetGroups);
+    std::vector<std::shared_ptr<Primitive>> LoadSTL(const std::string &filePath); // ascii or binary, one facet per triangle, throws Error
+
+    // Reproducible ray set: origins uniform in the bounding box of accel, isotropic directions
+    void GenerateRays(RTPrimitive &accel, std::vector<Ray> &rays, unsigned long seed);
+    void GenerateRays(const AxisAlignedBoundingBox &bounds, std::vector<Ray> &rays, unsigned long seed);
+    BatchComparison CompareBatchTraversal(BVHAccel &bvh, size_t nbRays, unsigned long seed);
+    // Builds a BVH with each split method and traces the same ray set through it
+    std::vector<BuilderComparison> CompareSplitMethods(const std::vector<std::shared_ptr<Primitive>> &primitives,
+                                                       const std::vector<BVHAccel::SplitMethod> &splitMethods,
+                                                       size_t nbRays, unsigned long seed);
+    // Builds every BVH split method, the wide BVH and the kd-tree (with and without hit probabilities), and traces the same ray set through each
+    // With facetGroups, also the instanced BVH over the repeated groups
+    std::vector<AccelResult> CompareAccelStructures(const std::vector<std::shared_ptr<Primitive>> &primitives,
+                                                    size_t nbRays, unsigned long seed,
+                                                    const std::vector<size_t> &facetGroups = std::vector<size_t>{});
+
+    std::string AccelResultsToJson(const std::string &geometry, size_t nbPrimitives, size_t nbRays,
+                                   const std::vector<AccelResult> &results); // single line JSON object
+    std::string AccelResultsCsvHeader();
+    std::string AccelResultsToCsv(const std::string &geometry, size_t nbPrimitives, size_t nbRays,
+                                  const std::vector<AccelResult> &results); // one line per variant
+}
+
+#endif //MOLFLOW_PROJ_RTBENCHMARK_H
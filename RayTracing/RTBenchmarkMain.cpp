@@ -0,0 +1,90 @@
+// Standalone ray tracing benchmark: builds every accel structure variant on a loaded or synthetic geometry
+// and reports build time, memory, rays/s, nodes visited and facet tests per ray as JSON lines or CSV
+
+#include "RTBenchmark.h"
+#include "AppSettings.h"
+#include <CLI11/CLI11.hpp>
+#include <fmt/core.h>
+#include <fstream>
+#include <iostream>
+#include <tuple>
+
+int main(int argc, char **argv) {
+    CLI::App app{"Molflow/Synrad ray tracing benchmark"};
+    std::string stlFile, outputFile, format = "json";
+    size_t tubeSides = 0, tubeSegments = 1000, sphereTriangles = 0, soupTriangles = 0, latticeCells = 0, latticeSegments = 50;
+    double tubeLength = 100.0, tubeRadius = 1.0;
+    size_t nbRays = 200000;
+    unsigned long seed = 42;
+    app.add_option("-f,--file", stlFile, "STL geometry to benchmark");
+    app.add_option("--tube", tubeSides, "Long tube with this many sides");
+    app.add_option("--tubeSegments", tubeSegments, "Number of segments along the tube");
+    app.add_option("--tubeLength", tubeLength, "Tube length (radius 1 by default)");
+    app.add_option("--tubeRadius", tubeRadius, "Tube radius");
+    app.add_option("--sphere", sphereTriangles, "Sphere of approximately this many triangles");
+    app.add_option("--soup", soupTriangles, "Random soup of this many triangles");
+    app.add_option("--lattice", latticeCells, "Chain of this many identical 32-sided tube cells, also benchmarked instanced");
+    app.add_option("--latticeSegments", latticeSegments, "Number of segments along each lattice cell");
+    app.add_option("-r,--rays", nbRays, "Number of rays traced per accel structure");
+    app.add_option("-s,--seed", seed, "Seed of the ray set and of the random soup");
+    app.add_option("--format", format, "Output format: json (one line per geometry) or csv")->check(CLI::IsMember({"json", "csv"}));
+    app.add_option("-o,--output", outputFile, "Output file, standard output if not set");
+    CLI11_PARSE(app, argc, argv);
+
+    AppSettings::verbosity = 0; // keep standard output machine readable
+
+    // Without a geometry argument, run the standard synthetic set
+    if (stlFile.empty() && !tubeSides && !sphereTriangles && !soupTriangles && !latticeCells) {
+        tubeSides = 32;
+        sphereTriangles = 100000;
+        soupTriangles = 100000;
+    }
+
+    // Name, facets and, for repeated geometries, the facet groups to instance
+    std::vector<std::tuple<std::string, std::vector<std::shared_ptr<Primitive>>, std::vector<size_t>>> geometries;
+    try {
+        if (!stlFile.empty()) geometries.emplace_back(stlFile, RTBenchmark::LoadSTL(stlFile), std::vector<size_t>{});
+    }
+    catch (const std::exception &e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    if (tubeSides)
+        geometries.emplace_back(fmt::format("tube_{}x{}", tubeSides, tubeSegments),
+                                RTBenchmark::MakeTube(tubeSides, tubeSegments, tubeLength, tubeRadius), std::vector<size_t>{});
+    if (sphereTriangles)
+        geometries.emplace_back(fmt::format("sphere_{}", sphereTriangles), RTBenchmark::MakeSphere(sphereTriangles), std::vector<size_t>{});
+    if (soupTriangles)
+        geometries.emplace_back(fmt::format("soup_{}", soupTriangles), RTBenchmark::MakeSoup(soupTriangles, seed), std::vector<size_t>{});
+    if (latticeCells) {
+        std::vector<size_t> facetGroups;
+        auto primitives = RTBenchmark::MakeLattice(latticeCells, 32, latticeSegments, facetGroups);
+        geometries.emplace_back(fmt::format("lattice_{}x32x{}", latticeCells, latticeSegments), std::move(primitives), std::move(facetGroups));
+    }
+
+    std::ofstream file;
+    if (!outputFile.empty()) {
+        file.open(outputFile);
+        if (!file.is_open()) {
+            std::cerr << "Couldn't open output file " << outputFile << '\n';
+            return 1;
+        }
+    }
+    std::ostream &out = outputFile.empty() ? std::cout : file;
+
+    const bool csv = (format == "csv");
+    if (csv) out << RTBenchmark::AccelResultsCsvHeader() << '\n';
+    for (const auto &[name, primitives, facetGroups] : geometries) {
+        if (primitives.empty()) {
+            std::cerr << "No facets in geometry " << name << '\n';
+            return 1;
+        }
+        auto results = RTBenchmark::CompareAccelStructures(primitives, nbRays, seed, facetGroups);
+        if (csv)
+            out << RTBenchmark::AccelResultsToCsv(name, primitives.size(), nbRays, results);
+        else
+            out << RTBenchmark::AccelResultsToJson(name, primitives.size(), nbRays, results) << '\n';
+        out.flush();
+    }
+    return 0;
+}
@@ -2,8 +2,7 @@
 
 #include "Vector.h"
 #include "RTHelper.h"
-
-class MersenneTwister;
+#include "Random.h" // RandomEngine
 
 //! Keep track of temporary/transparent hits; corresponds to an individual hit
 struct HitDescriptor {
@@ -76,5 +75,5 @@ public:
 
     std::vector<HitDescriptor> transparentHits;
     HitDescriptor hardHit;
-    MersenneTwister *rng;
+    RandomEngine *rng;
 };
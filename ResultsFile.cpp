@@ -0,0 +1,381 @@
+
+
+#include "ResultsFile.h"
+#include "GLApp/GLTypes.h" //Error
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <tuple>
+#include <ziplib/Source/ZipLib/extlibs/zlib/zlib.h>
+
+#ifdef _WIN32
+#include <io.h> //_commit
+#else
+#include <fcntl.h>
+#include <unistd.h> //fsync
+#endif
+
+#ifdef MOLFLOW
+#include "../src/Simulation/MolflowSimulation.h"
+#endif
+
+#ifdef SYNRAD
+#include "../src/Simulation/SynradSimulation.h"
+#endif
+
+constexpr char RESULTS_FILE_MAGIC[8] = {'M', 'F', 'R', 'E', 'S', 'U', 'L', 'T'};
+constexpr size_t RESULTS_BLOCK_ALIGNMENT = 8; //blocks start at multiples of this, so stored arrays are aligned in the mapping
+static_assert(sizeof(ResultsFileHeader) == 48 && sizeof(ResultsBlockEntry) == 56, "results file layout must not depend on the compiler");
+
+namespace {
+    auto EntryKey(const ResultsBlockEntry& entry) {
+        return std::make_tuple(entry.type, entry.facet, entry.moment);
+    }
+
+    // Flushes the stream and the OS cache of the file to the storage device
+    bool SyncFile(FILE* file) {
+        if (fflush(file) != 0) return false;
+#ifdef _WIN32
+        return _commit(_fileno(file)) == 0;
+#else
+        return fsync(fileno(file)) == 0;
+#endif
+    }
+
+    // Makes a rename in the directory durable. Not needed on Windows, where NTFS journals metadata changes
+    void SyncParentDirectory(const std::string& fileName) {
+#ifndef _WIN32
+        std::string directory = std::filesystem::path(fileName).parent_path().string();
+        if (directory.empty()) directory = ".";
+        const int fd = open(directory.c_str(), O_RDONLY);
+        if (fd < 0) return; //best effort: the file itself is already complete on disk
+        fsync(fd);
+        close(fd);
+#endif
+    }
+}
+
+ResultsFileWriter::ResultsFileWriter(const std::string& fileName, size_t nbFacets, size_t nbMoments, bool compress)
+    : fileName(fileName), compress(compress) {
+    file = fopen(fileName.c_str(), "wb");
+    if (!file) {
+        throw Error("Cannot open file for writing ({})", fileName);
+    }
+    std::memcpy(header.magic, RESULTS_FILE_MAGIC, sizeof(header.magic));
+    header.version = RESULTS_FILE_VERSION;
+    header.nbFacets = nbFacets;
+    header.nbMoments = nbMoments;
+    WriteRaw(&header, sizeof(header)); //completed by Finish()
+}
+
+ResultsFileWriter::~ResultsFileWriter() {
+    if (file) fclose(file);
+}
+
+void ResultsFileWriter::WriteRaw(const void* data, size_t size) {
+    if (size && fwrite(data, 1, size, file) != size) {
+        throw Error("Error writing results file {}", fileName);
+    }
+    position += size;
+}
+
+void ResultsFileWriter::WriteBlock(ResultsBlockType type, uint64_t facet, uint64_t moment, const void* data, size_t size, size_t elementSize) {
+    if (!file) {
+        throw Error("Results file {} already finished", fileName);
+    }
+    if (size == 0) return;
+
+    static const char padding[RESULTS_BLOCK_ALIGNMENT] = {};
+    WriteRaw(padding, (RESULTS_BLOCK_ALIGNMENT - position % RESULTS_BLOCK_ALIGNMENT) % RESULTS_BLOCK_ALIGNMENT);
+
+    ResultsBlockEntry entry{};
+    entry.type = static_cast<uint32_t>(type);
+    entry.facet = facet;
+    entry.moment = moment;
+    entry.offset = position;
+    entry.rawSize = size;
+    entry.elementSize = elementSize;
+
+    std::vector<Bytef> compressed;
+    if (compress && size >= RESULTS_COMPRESS_MIN_SIZE && size <= std::numeric_limits<uLong>::max()) {
+        uLongf compressedSize = compressBound(static_cast<uLong>(size));
+        compressed.resize(compressedSize);
+        if (compress2(compressed.data(), &compressedSize, static_cast<const Bytef*>(data), static_cast<uLong>(size), Z_BEST_SPEED) == Z_OK
+            && compressedSize < size) {
+            compressed.resize(compressedSize);
+        }
+        else {
+            compressed.clear(); //incompressible, stored as is
+        }
+    }
+    if (!compressed.empty()) {
+        entry.compression = 1;
+        entry.storedSize = compressed.size();
+        WriteRaw(compressed.data(), compressed.size());
+    }
+    else {
+        entry.compression = 0;
+        entry.storedSize = size;
+        WriteRaw(data, size);
+    }
+    table.push_back(entry);
+}
+
+void ResultsFileWriter::Finish(bool durable) {
+    if (!file) return;
+    std::sort(table.begin(), table.end(), [](const ResultsBlockEntry& a, const ResultsBlockEntry& b) {
+        return EntryKey(a) < EntryKey(b);
+    });
+    header.tableOffset = position;
+    header.nbBlocks = table.size();
+    WriteRaw(table.data(), table.size() * sizeof(ResultsBlockEntry));
+    const bool headerWritten = fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1
+                               && (!durable || SyncFile(file));
+    const bool closed = fclose(file) == 0; //on every path: an open handle would keep the file locked on Windows
+    file = nullptr;
+    if (!headerWritten || !closed) {
+        throw Error("Error writing results file {}", fileName);
+    }
+}
+
+ResultsFileReader::ResultsFileReader(const std::string& fileName) : file(fileName), fileName(fileName) {
+    ResultsFileHeader header;
+    if (file.Size() < sizeof(header)) {
+        throw Error("{} is not a results file", fileName);
+    }
+    std::memcpy(&header, file.Data(), sizeof(header));
+    if (std::memcmp(header.magic, RESULTS_FILE_MAGIC, sizeof(header.magic)) != 0) {
+        throw Error("{} is not a results file", fileName);
+    }
+    if (header.version > RESULTS_FILE_VERSION) {
+        throw Error("Results file {} has version {}, this version reads up to {}", fileName, header.version, RESULTS_FILE_VERSION);
+    }
+    if (header.tableOffset == 0) {
+        throw Error("Results file {} is incomplete, it wasn't closed properly", fileName);
+    }
+    if (header.tableOffset > file.Size() || header.nbBlocks > (file.Size() - header.tableOffset) / sizeof(ResultsBlockEntry)) {
+        throw Error("Results file {} is truncated", fileName);
+    }
+    nbFacets = header.nbFacets;
+    nbMoments = header.nbMoments;
+    table.resize(header.nbBlocks);
+    std::memcpy(table.data(), file.Data() + header.tableOffset, table.size() * sizeof(ResultsBlockEntry));
+    for (const auto& entry : table) {
+        if (entry.offset > header.tableOffset || entry.storedSize > header.tableOffset - entry.offset
+            || entry.elementSize == 0 || entry.rawSize % entry.elementSize != 0 || entry.compression > 1) {
+            throw Error("Results file {} has a corrupt block table", fileName);
+        }
+    }
+}
+
+const ResultsBlockEntry* ResultsFileReader::Find(ResultsBlockType type, uint64_t facet, uint64_t moment) const {
+    ResultsBlockEntry key{};
+    key.type = static_cast<uint32_t>(type);
+    key.facet = facet;
+    key.moment = moment;
+    auto it = std::lower_bound(table.begin(), table.end(), key, [](const ResultsBlockEntry& a, const ResultsBlockEntry& b) {
+        return EntryKey(a) < EntryKey(b);
+    });
+    if (it == table.end() || EntryKey(*it) != EntryKey(key)) return nullptr;
+    return &*it;
+}
+
+const ResultsBlockEntry* ResultsFileReader::Locate(ResultsBlockType type, uint64_t facet, uint64_t moment, size_t elementSize) const {
+    const ResultsBlockEntry* entry = Find(type, facet, moment);
+    if (entry && entry->elementSize != elementSize) {
+        throw Error("Results file {}: block {} of facet {} has {} byte elements, {} expected (written by a different version?)",
+                    fileName, entry->type, facet, entry->elementSize, elementSize);
+    }
+    return entry;
+}
+
+bool ResultsFileReader::Has(ResultsBlockType type, uint64_t facet, uint64_t moment) const {
+    return Find(type, facet, moment) != nullptr;
+}
+
+void ResultsFileReader::ReadBlock(const ResultsBlockEntry& entry, void* out) const {
+    const char* stored = file.Data() + entry.offset;
+    if (entry.compression == 0) {
+        if (entry.storedSize != entry.rawSize) {
+            throw Error("Results file {} has a corrupt block at offset {}", fileName, entry.offset);
+        }
+        std::memcpy(out, stored, entry.rawSize);
+        return;
+    }
+    uLongf rawSize = static_cast<uLongf>(entry.rawSize);
+    if (uncompress(static_cast<Bytef*>(out), &rawSize, reinterpret_cast<const Bytef*>(stored), static_cast<uLong>(entry.storedSize)) != Z_OK
+        || rawSize != entry.rawSize) {
+        throw Error("Results file {} has a corrupt block at offset {}", fileName, entry.offset);
+    }
+}
+
+#if defined(MOLFLOW) || defined(SYNRAD)
+namespace {
+    // Calls visit(type, facet, moment, data, count) for every result array of state, in file order
+    template<typename Visitor>
+    void ForEachResultsBlock(const GlobalSimuState& state, Visitor&& visit) {
+        visit(ResultsBlockType::GlobalHits, RESULTS_GLOBAL, RESULTS_GLOBAL, &state.globalStats, 1);
+        for (size_t m = 0; m < state.globalHistograms.size(); m++) {
+            const FacetHistogramBuffer& histogram = state.globalHistograms[m];
+            visit(ResultsBlockType::GlobalHistogramHits, RESULTS_GLOBAL, m, histogram.nbHitsHistogram.data(), histogram.nbHitsHistogram.size());
+            visit(ResultsBlockType::GlobalHistogramDistance, RESULTS_GLOBAL, m, histogram.distanceHistogram.data(), histogram.distanceHistogram.size());
+#ifdef MOLFLOW
+            visit(ResultsBlockType::GlobalHistogramTime, RESULTS_GLOBAL, m, histogram.timeHistogram.data(), histogram.timeHistogram.size());
+#endif
+        }
+
+        for (size_t f = 0; f < state.facetStates.size(); f++) {
+            const auto& facetState = state.facetStates[f];
+            for (size_t m = 0; m < facetState.momentResults.size(); m++) {
+                const auto& snapshot = facetState.momentResults[m];
+                visit(ResultsBlockType::FacetHits, f, m, &snapshot.hits, 1);
+                visit(ResultsBlockType::FacetProfile, f, m, snapshot.profile.data(), snapshot.profile.size());
+                visit(ResultsBlockType::FacetTexture, f, m, snapshot.texture.data(), snapshot.texture.size());
+#ifdef MOLFLOW
+                visit(ResultsBlockType::FacetDirection, f, m, snapshot.direction.data(), snapshot.direction.size());
+#endif
+                visit(ResultsBlockType::FacetHistogramHits, f, m, snapshot.histogram.nbHitsHistogram.data(), snapshot.histogram.nbHitsHistogram.size());
+                visit(ResultsBlockType::FacetHistogramDistance, f, m, snapshot.histogram.distanceHistogram.data(), snapshot.histogram.distanceHistogram.size());
+#ifdef MOLFLOW
+                visit(ResultsBlockType::FacetHistogramTime, f, m, snapshot.histogram.timeHistogram.data(), snapshot.histogram.timeHistogram.size());
+#endif
+            }
+#ifdef MOLFLOW
+            visit(ResultsBlockType::FacetAngleMap, f, RESULTS_GLOBAL, facetState.recordedAngleMapPdf.data(), facetState.recordedAngleMapPdf.size());
+#endif
+        }
+    }
+
+    size_t NbMoments(const GlobalSimuState& state) {
+        return state.facetStates.empty() ? state.globalHistograms.size() : state.facetStates[0].momentResults.size();
+    }
+}
+
+void SaveResultsBinary(const GlobalSimuState& state, const std::string& fileName, bool compress) {
+    ResultsFileWriter writer(fileName, state.facetStates.size(), NbMoments(state), compress);
+    ForEachResultsBlock(state, [&](ResultsBlockType type, uint64_t facet, uint64_t moment, const auto* data, size_t count) {
+        writer.Write(type, facet, moment, data, count);
+    });
+    writer.Finish();
+}
+
+size_t ResultsSnapshot::Capture(const GlobalSimuState& state, size_t maxBytes) {
+    size_t totalSize = 0;
+    ForEachResultsBlock(state, [&](ResultsBlockType, uint64_t, uint64_t, const auto* data, size_t count) {
+        totalSize += count * sizeof(*data);
+    });
+    if (totalSize > maxBytes) return 0;
+
+    size_t nbBlocks = 0;
+    ForEachResultsBlock(state, [&](ResultsBlockType type, uint64_t facet, uint64_t moment, const auto* data, size_t count) {
+        if (count == 0) return;
+        if (nbBlocks == blocks.size()) blocks.emplace_back();
+        Block& block = blocks[nbBlocks++];
+        block.type = type;
+        block.facet = facet;
+        block.moment = moment;
+        block.elementSize = sizeof(*data);
+        const char* bytes = reinterpret_cast<const char*>(data);
+        block.data.assign(bytes, bytes + count * sizeof(*data)); //reuses the buffer of the previous capture
+    });
+    blocks.resize(nbBlocks); //frees buffers left from a larger capture
+    nbFacets = state.facetStates.size();
+    nbMoments = NbMoments(state);
+    return totalSize;
+}
+#endif
+
+void ResultsSnapshot::Save(const std::string& fileName, bool compress, bool durable) const {
+    ResultsFileWriter writer(fileName, nbFacets, nbMoments, compress);
+    for (const Block& block : blocks) {
+        writer.WriteBlock(block.type, block.facet, block.moment, block.data.data(), block.data.size(), block.elementSize);
+    }
+    writer.Finish(durable);
+}
+
+ResultsAutosaver::ResultsAutosaver(size_t memoryBudget) : memoryBudget(memoryBudget) {
+}
+
+ResultsAutosaver::~ResultsAutosaver() {
+    if (writing.valid()) {
+        try { writing.get(); } catch (...) {} //only waiting for the thread
+    }
+}
+
+bool ResultsAutosaver::IsBusy() const {
+    return writing.valid() && writing.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+}
+
+void ResultsAutosaver::Wait() {
+    if (writing.valid()) lastWriteSeconds = writing.get();
+}
+
+#if defined(MOLFLOW) || defined(SYNRAD)
+bool ResultsAutosaver::Start(const GlobalSimuState& state, const std::string& fileName, bool compress) {
+    if (IsBusy()) return false;
+    Wait(); //rethrows the error of the previous autosave, if any
+
+    const auto captureStart = std::chrono::steady_clock::now();
+    if (snapshot.Capture(state, memoryBudget) == 0) return false;
+    lastCaptureSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - captureStart).count();
+
+    writing = std::async(std::launch::async, [this, fileName, compress]() {
+        const auto writeStart = std::chrono::steady_clock::now();
+        const std::string tempName = fileName + RESULTS_TEMP_SUFFIX;
+        try {
+            snapshot.Save(tempName, compress, true); //on disk before it replaces the previous autosave
+            std::filesystem::rename(tempName, fileName); //replaces the previous autosave in one step
+            SyncParentDirectory(fileName);
+        }
+        catch (const std::exception& e) {
+            std::error_code ignored;
+            std::filesystem::remove(tempName, ignored);
+            throw Error("Autosave to {} failed: {}", fileName, e.what());
+        }
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - writeStart).count();
+    });
+    return true;
+}
+
+void LoadResultsBinary(const std::string& fileName, GlobalSimuState& state) {
+    ResultsFileReader reader(fileName);
+
+    auto globalHits = reader.Read<GlobalHitBuffer>(ResultsBlockType::GlobalHits, RESULTS_GLOBAL, RESULTS_GLOBAL);
+    state.globalStats = globalHits.empty() ? GlobalHitBuffer() : globalHits[0];
+    state.globalHistograms.resize(reader.NbMoments());
+    for (size_t m = 0; m < reader.NbMoments(); m++) {
+        FacetHistogramBuffer& histogram = state.globalHistograms[m];
+        histogram.nbHitsHistogram = reader.Read<double>(ResultsBlockType::GlobalHistogramHits, RESULTS_GLOBAL, m);
+        histogram.distanceHistogram = reader.Read<double>(ResultsBlockType::GlobalHistogramDistance, RESULTS_GLOBAL, m);
+#ifdef MOLFLOW
+        histogram.timeHistogram = reader.Read<double>(ResultsBlockType::GlobalHistogramTime, RESULTS_GLOBAL, m);
+#endif
+    }
+
+    state.facetStates.resize(reader.NbFacets());
+    for (size_t f = 0; f < reader.NbFacets(); f++) {
+        auto& facetState = state.facetStates[f];
+        facetState.momentResults.resize(reader.NbMoments());
+        for (size_t m = 0; m < reader.NbMoments(); m++) {
+            auto& snapshot = facetState.momentResults[m];
+            auto hits = reader.Read<FacetHitBuffer>(ResultsBlockType::FacetHits, f, m);
+            snapshot.hits = hits.empty() ? FacetHitBuffer() : hits[0];
+            snapshot.profile = reader.Read<ProfileSlice>(ResultsBlockType::FacetProfile, f, m);
+            snapshot.texture = reader.Read<TextureCell>(ResultsBlockType::FacetTexture, f, m);
+#ifdef MOLFLOW
+            snapshot.direction = reader.Read<DirectionCell>(ResultsBlockType::FacetDirection, f, m);
+#endif
+            snapshot.histogram.nbHitsHistogram = reader.Read<double>(ResultsBlockType::FacetHistogramHits, f, m);
+            snapshot.histogram.distanceHistogram = reader.Read<double>(ResultsBlockType::FacetHistogramDistance, f, m);
+#ifdef MOLFLOW
+            snapshot.histogram.timeHistogram = reader.Read<double>(ResultsBlockType::FacetHistogramTime, f, m);
+#endif
+        }
+#ifdef MOLFLOW
+        facetState.recordedAngleMapPdf = reader.Read<size_t>(ResultsBlockType::FacetAngleMap, f, RESULTS_GLOBAL);
+#endif
+    }
+}
+#endif
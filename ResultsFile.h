@@ -0,0 +1,184 @@
+
+
+#pragma once
+
+#include "File.h" //MappedFile
+#include <cstdint>
+#include <cstdio>
+#include <future>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+class GlobalSimuState;
+
+//! Contents of a results file block, each an array of plain structs
+enum class ResultsBlockType : uint32_t {
+	GlobalHits = 0, //GlobalHitBuffer
+	GlobalHistogramHits, //per moment
+	GlobalHistogramDistance,
+	GlobalHistogramTime,
+	FacetHits, //FacetHitBuffer, per facet and moment
+	FacetProfile,
+	FacetTexture,
+	FacetDirection,
+	FacetHistogramHits,
+	FacetHistogramDistance,
+	FacetHistogramTime,
+	FacetAngleMap //recorded angle map pdf, per facet, not time-dependent
+};
+
+constexpr uint64_t RESULTS_FILE_VERSION = 1;
+constexpr uint64_t RESULTS_GLOBAL = UINT64_MAX; //facet index of global blocks, moment index of blocks that aren't time-dependent
+constexpr size_t RESULTS_COMPRESS_MIN_SIZE = 4096; //smaller blocks are always stored uncompressed
+constexpr const char* RESULTS_TEMP_SUFFIX = ".tmp"; //autosaves are written under this name, then renamed over the previous one
+
+//! Fixed size header at the start of a results file, the block table is at its end
+struct ResultsFileHeader {
+	char magic[8];
+	uint64_t version;
+	uint64_t nbFacets;
+	uint64_t nbMoments;
+	uint64_t tableOffset; //0 while the file is being written
+	uint64_t nbBlocks;
+};
+
+//! Location of one block in a results file
+struct ResultsBlockEntry {
+	uint32_t type; //ResultsBlockType
+	uint32_t compression; //0: stored, 1: zlib
+	uint64_t facet;
+	uint64_t moment;
+	uint64_t offset;
+	uint64_t storedSize;
+	uint64_t rawSize;
+	uint64_t elementSize; //sizeof the struct, checked on read
+};
+
+/**
+* \brief Writes results as independent blocks, located by a table at the end of the file
+ * Empty arrays aren't written, readers get them back as empty.
+ */
+class ResultsFileWriter {
+public:
+	ResultsFileWriter(const std::string& fileName, size_t nbFacets, size_t nbMoments, bool compress); //throws Error
+	~ResultsFileWriter(); //without Finish(), leaves an incomplete file that readers reject
+	ResultsFileWriter(const ResultsFileWriter&) = delete;
+	ResultsFileWriter& operator=(const ResultsFileWriter&) = delete;
+
+	template<typename T>
+	void Write(ResultsBlockType type, uint64_t facet, uint64_t moment, const T* data, size_t count) {
+		static_assert(std::is_trivially_copyable_v<T>, "results blocks are stored as raw bytes");
+		WriteBlock(type, facet, moment, data, count * sizeof(T), sizeof(T));
+	}
+	template<typename T>
+	void Write(ResultsBlockType type, uint64_t facet, uint64_t moment, const std::vector<T>& data) {
+		Write(type, facet, moment, data.data(), data.size());
+	}
+	void WriteBlock(ResultsBlockType type, uint64_t facet, uint64_t moment, const void* data, size_t size, size_t elementSize); //untyped Write()
+	void Finish(bool durable = false); //writes the block table and completes the header, durable: also flushed to the storage device. Throws Error
+
+private:
+	void WriteRaw(const void* data, size_t size);
+
+	FILE* file = nullptr;
+	std::string fileName;
+	const bool compress;
+	ResultsFileHeader header{};
+	std::vector<ResultsBlockEntry> table;
+	uint64_t position = 0;
+};
+
+/**
+* \brief Random access to the blocks of a results file
+ * Only the header and the block table are read on opening, blocks are copied (and decompressed) from the mapped file on request.
+ */
+class ResultsFileReader {
+public:
+	explicit ResultsFileReader(const std::string& fileName); //throws Error if the file isn't a complete results file
+
+	size_t NbFacets() const { return nbFacets; }
+	size_t NbMoments() const { return nbMoments; }
+	bool Has(ResultsBlockType type, uint64_t facet, uint64_t moment) const;
+
+	template<typename T>
+	std::vector<T> Read(ResultsBlockType type, uint64_t facet, uint64_t moment) const {
+		static_assert(std::is_trivially_copyable_v<T>, "results blocks are stored as raw bytes");
+		std::vector<T> result;
+		const ResultsBlockEntry* entry = Locate(type, facet, moment, sizeof(T));
+		if (entry) {
+			result.resize(entry->rawSize / sizeof(T));
+			ReadBlock(*entry, result.data());
+		}
+		return result;
+	}
+
+private:
+	const ResultsBlockEntry* Find(ResultsBlockType type, uint64_t facet, uint64_t moment) const; //nullptr if absent
+	const ResultsBlockEntry* Locate(ResultsBlockType type, uint64_t facet, uint64_t moment, size_t elementSize) const; //nullptr if absent, throws Error on type size mismatch
+	void ReadBlock(const ResultsBlockEntry& entry, void* out) const;
+
+	MappedFile file;
+	std::string fileName;
+	size_t nbFacets = 0;
+	size_t nbMoments = 0;
+	std::vector<ResultsBlockEntry> table; //sorted by type, facet, moment
+};
+
+// Caller holds the hit lock of state
+void SaveResultsBinary(const GlobalSimuState& state, const std::string& fileName, bool compress = true);
+// Replaces all counters, histograms, textures and profiles of state
+void LoadResultsBinary(const std::string& fileName, GlobalSimuState& state);
+
+/**
+* \brief Copy of all result blocks of a GlobalSimuState, to be written after the hit lock is released
+ * Capturing again reuses the block buffers, so once the sizes are settled a capture is a series of memcpy without allocation.
+ */
+class ResultsSnapshot {
+public:
+	// Caller holds the hit lock of state. Returns the snapshot size in bytes, or 0 without copying anything if it would exceed maxBytes
+	size_t Capture(const GlobalSimuState& state, size_t maxBytes);
+	void Save(const std::string& fileName, bool compress, bool durable = false) const; //throws Error
+
+private:
+	struct Block {
+		ResultsBlockType type;
+		uint64_t facet;
+		uint64_t moment;
+		size_t elementSize;
+		std::vector<char> data;
+	};
+	std::vector<Block> blocks; //non-empty arrays only, in file order
+	size_t nbFacets = 0;
+	size_t nbMoments = 0;
+};
+
+/**
+* \brief Autosave that doesn't hold the simulation during compression and writing
+ * Start() only captures a snapshot under the hit lock, a background thread then writes it to a temporary file renamed over the target when complete:
+ * the target always holds the last complete autosave, even if the process dies while writing.
+ * At most one snapshot is kept, so memory use is bounded by memoryBudget.
+ */
+class ResultsAutosaver {
+public:
+	explicit ResultsAutosaver(size_t memoryBudget); //bytes
+	~ResultsAutosaver(); //waits for the write in progress
+	ResultsAutosaver(const ResultsAutosaver&) = delete;
+	ResultsAutosaver& operator=(const ResultsAutosaver&) = delete;
+
+	// Caller holds the hit lock of state. False, without saving, if the previous autosave is still being written or if the snapshot exceeds the budget:
+	// the caller can then retry later or save synchronously. Throws the Error of a previous autosave that failed
+	bool Start(const GlobalSimuState& state, const std::string& fileName, bool compress = true);
+	bool IsBusy() const;
+	void Wait(); //throws the Error of the write in progress, if it fails
+
+	double LastCaptureSeconds() const { return lastCaptureSeconds; } //time the simulation was held by the last Start()
+	double LastWriteSeconds() const { return lastWriteSeconds; } //background time of the last autosave collected by Start() or Wait()
+
+private:
+	const size_t memoryBudget;
+	ResultsSnapshot snapshot; //only touched by the writer thread while it runs
+	std::future<double> writing; //returns the write time
+	double lastCaptureSeconds = 0.0;
+	double lastWriteSeconds = 0.0;
+};
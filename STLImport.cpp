@@ -0,0 +1,325 @@
+
+
+#include "STLImport.h"
+#include "File.h" //MappedFile, FileUtils::FromChars
+#include "GLApp/GLTypes.h" //Error
+#include "Helper/GLProgress_abstract.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <string_view>
+#include <fmt/core.h>
+#include <omp.h>
+
+constexpr size_t STL_BINARY_HEADER_SIZE = 84; //80 byte header, then the uint32 triangle count
+constexpr size_t STL_BINARY_RECORD_SIZE = 50; //normal, 3 vertices (12 floats), uint16 attribute byte count
+constexpr size_t STL_PROGRESS_TRIANGLES = 65536; //triangles processed between two progress updates
+constexpr size_t STL_ASCII_CHUNK_SIZE = 1 << 20; //bytes parsed by a thread at once
+
+namespace {
+    uint64_t HashCell(int64_t x, int64_t y, int64_t z) {
+        // splitmix64 finalizer over the combined coordinates
+        uint64_t h = static_cast<uint64_t>(x) * 0x9E3779B97F4A7C15ULL;
+        h ^= static_cast<uint64_t>(y) + 0x7F4A7C159E3779B9ULL + (h << 6) + (h >> 2);
+        h ^= static_cast<uint64_t>(z) + 0x94D049BB133111EBULL + (h << 6) + (h >> 2);
+        h ^= h >> 30;
+        h *= 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 27;
+        h *= 0x94D049BB133111EBULL;
+        h ^= h >> 31;
+        return h;
+    }
+
+    int64_t CoordinateBits(double value) {
+        value += 0.0; //-0.0 and 0.0 are the same vertex
+        int64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+}
+
+VertexWelder::VertexWelder(std::vector<Vector3d>& vertices, double tolerance, size_t expectedVertices)
+    : vertices(vertices), tolerance(tolerance) {
+    size_t capacity = 16;
+    while (capacity < 2 * expectedVertices) capacity *= 2;
+    slots.resize(capacity);
+    nextInCell.reserve(expectedVertices);
+    vertices.reserve(vertices.size() + expectedVertices);
+}
+
+size_t VertexWelder::FindSlot(uint64_t key) const {
+    const size_t mask = slots.size() - 1;
+    size_t i = static_cast<size_t>(key) & mask;
+    while (slots[i].head != SIZE_MAX && slots[i].key != key) i = (i + 1) & mask;
+    return i;
+}
+
+void VertexWelder::Grow() {
+    std::vector<Slot> oldSlots(2 * slots.size());
+    oldSlots.swap(slots);
+    for (const auto& slot : oldSlots) {
+        if (slot.head != SIZE_MAX) slots[FindSlot(slot.key)] = slot;
+    }
+}
+
+size_t VertexWelder::Add(const Vector3d& p) {
+    // Different cells with the same key only share a chain, candidates are compared by coordinates anyway
+    uint64_t ownKey;
+    if (tolerance == 0.0) {
+        ownKey = HashCell(CoordinateBits(p.x), CoordinateBits(p.y), CoordinateBits(p.z));
+        const size_t slot = FindSlot(ownKey);
+        for (size_t v = slots[slot].head; v != SIZE_MAX; v = nextInCell[v]) {
+            if (vertices[v].x == p.x && vertices[v].y == p.y && vertices[v].z == p.z) return v;
+        }
+    }
+    else {
+        const int64_t cx = static_cast<int64_t>(std::floor(p.x / tolerance));
+        const int64_t cy = static_cast<int64_t>(std::floor(p.y / tolerance));
+        const int64_t cz = static_cast<int64_t>(std::floor(p.z / tolerance));
+        ownKey = HashCell(cx, cy, cz);
+        const double toleranceSqr = tolerance * tolerance;
+        size_t match = SIZE_MAX;
+        for (int64_t dx = -1; dx <= 1; dx++) {
+            for (int64_t dy = -1; dy <= 1; dy++) {
+                for (int64_t dz = -1; dz <= 1; dz++) {
+                    const size_t slot = FindSlot(HashCell(cx + dx, cy + dy, cz + dz));
+                    for (size_t v = slots[slot].head; v != SIZE_MAX; v = nextInCell[v]) {
+                        if (v < match && Dot(vertices[v] - p, vertices[v] - p) <= toleranceSqr) match = v; //earliest vertex wins, independent of the cell order
+                    }
+                }
+            }
+        }
+        if (match != SIZE_MAX) return match;
+    }
+
+    if (2 * (nbCells + 1) > slots.size()) Grow();
+    Slot& slot = slots[FindSlot(ownKey)];
+    if (slot.head == SIZE_MAX) {
+        slot.key = ownKey;
+        nbCells++;
+    }
+    const size_t index = vertices.size();
+    vertices.push_back(p);
+    nextInCell.push_back(slot.head);
+    slot.head = index;
+    return index;
+}
+
+namespace {
+    //! Triangles and body starts parsed from a range of an ASCII STL file
+    struct AsciiChunk {
+        const char* begin = nullptr;
+        const char* end = nullptr;
+        std::vector<double> coordinates; //9 per triangle
+        std::vector<std::pair<size_t, std::string>> bodyStarts; //triangle index in the chunk, body name
+        const char* errorLine = nullptr; //first line that couldn't be parsed
+        std::string errorMessage;
+    };
+
+    bool IsBlank(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    // Parses a number of the form accepted by strtod, p is moved past it
+    bool ParseNumber(const char*& p, const char* end, double& value) {
+        while (p < end && IsBlank(*p)) ++p;
+        if (p < end && *p == '+') ++p;
+        const auto [ptr, ec] = FileUtils::FromChars(p, end, value);
+        if (ec != std::errc()) return false;
+        p = ptr;
+        return true;
+    }
+
+    void ParseAsciiChunk(AsciiChunk& chunk) {
+        int facetVertices = 0;
+        const char* facetLine = chunk.begin;
+        for (const char* line = chunk.begin; line < chunk.end;) {
+            const char* lineEnd = static_cast<const char*>(std::memchr(line, '\n', chunk.end - line));
+            if (!lineEnd) lineEnd = chunk.end;
+
+            const char* p = line;
+            while (p < lineEnd && IsBlank(*p)) ++p;
+            const char* word = p;
+            while (p < lineEnd && !IsBlank(*p)) ++p;
+            const std::string_view keyword(word, p - word);
+
+            if (keyword == "vertex") {
+                double v[3];
+                for (double& coordinate : v) {
+                    if (!ParseNumber(p, lineEnd, coordinate)) {
+                        chunk.errorLine = line;
+                        chunk.errorMessage = "Vertex coordinate can't be converted to a number.";
+                        return;
+                    }
+                }
+                chunk.coordinates.insert(chunk.coordinates.end(), v, v + 3);
+                facetVertices++;
+            }
+            else if (keyword == "facet") {
+                facetVertices = 0;
+                facetLine = line;
+            }
+            else if (keyword == "endfacet") {
+                if (facetVertices != 3) {
+                    chunk.errorLine = line;
+                    chunk.errorMessage = fmt::format("Facet has {} vertices instead of 3.", facetVertices);
+                    return;
+                }
+            }
+            else if (keyword == "solid") {
+                while (p < lineEnd && IsBlank(*p)) ++p;
+                const char* name = p;
+                while (p < lineEnd && !IsBlank(*p)) ++p;
+                chunk.bodyStarts.emplace_back(chunk.coordinates.size() / 9, std::string(name, p - name));
+            }
+            line = lineEnd + 1;
+        }
+        if (chunk.coordinates.size() % 9 != 0) {
+            chunk.errorLine = facetLine;
+            chunk.errorMessage = "Unterminated facet.";
+        }
+    }
+
+    // Ranges of about STL_ASCII_CHUNK_SIZE bytes, each ending after an "endfacet" line so no facet is split
+    std::vector<AsciiChunk> SplitAscii(const char* data, size_t size) {
+        std::vector<AsciiChunk> chunks;
+        const char* end = data + size;
+        const char* begin = data;
+        constexpr std::string_view endFacet = "endfacet";
+        while (begin < end) {
+            const char* split = end;
+            if (static_cast<size_t>(end - begin) > STL_ASCII_CHUNK_SIZE) {
+                split = std::search(begin + STL_ASCII_CHUNK_SIZE, end, endFacet.begin(), endFacet.end());
+                if (split != end) {
+                    split = static_cast<const char*>(std::memchr(split, '\n', end - split));
+                    split = split ? split + 1 : end;
+                }
+            }
+            chunks.emplace_back();
+            chunks.back().begin = begin;
+            chunks.back().end = split;
+            begin = split;
+        }
+        return chunks;
+    }
+
+    void ReadBinary(const MappedFile& file, const std::string& filePath, std::vector<float>& coordinates, GLProgress_Abstract& prg) {
+        if (file.Size() < STL_BINARY_HEADER_SIZE) { //also an empty file, with no mapping
+            throw Error("{} is not a valid STL file:\nno \"solid\" keyword and too short for a binary header ({} bytes)", filePath, file.Size());
+        }
+        uint32_t nbTriangles;
+        std::memcpy(&nbTriangles, file.Data() + 80, sizeof(nbTriangles));
+        if (file.Size() < STL_BINARY_HEADER_SIZE + STL_BINARY_RECORD_SIZE * static_cast<size_t>(nbTriangles)) {
+            throw Error("Truncated binary STL file {}:\n{} triangles declared, but file size is {} bytes", filePath, nbTriangles, file.Size());
+        }
+        coordinates.resize(9 * static_cast<size_t>(nbTriangles));
+        const char* records = file.Data() + STL_BINARY_HEADER_SIZE;
+        for (size_t chunkStart = 0; chunkStart < nbTriangles; chunkStart += STL_PROGRESS_TRIANGLES) {
+            prg.SetProgress(0.5 * static_cast<double>(chunkStart) / static_cast<double>(nbTriangles));
+            const int chunkSize = static_cast<int>(std::min<size_t>(STL_PROGRESS_TRIANGLES, nbTriangles - chunkStart));
+#pragma omp parallel for
+            for (int i = 0; i < chunkSize; i++) {
+                const size_t t = chunkStart + i;
+                std::memcpy(&coordinates[9 * t], records + STL_BINARY_RECORD_SIZE * t + 3 * sizeof(float), 9 * sizeof(float)); //skip the normal
+            }
+        }
+    }
+
+    void ReadAscii(const MappedFile& file, const std::string& filePath, std::vector<double>& coordinates,
+                   std::vector<std::pair<size_t, std::string>>& bodyStarts, GLProgress_Abstract& prg) {
+        std::vector<AsciiChunk> chunks = SplitAscii(file.Data(), file.Size());
+        std::atomic<size_t> nbParsed{0};
+#pragma omp parallel for schedule(dynamic)
+        for (int c = 0; c < (int) chunks.size(); c++) {
+            ParseAsciiChunk(chunks[c]);
+            const size_t parsed = ++nbParsed;
+            if (omp_get_thread_num() == 0) prg.SetProgress(0.5 * static_cast<double>(parsed) / static_cast<double>(chunks.size())); //calling thread only
+        }
+
+        size_t nbCoordinates = 0;
+        for (const auto& chunk : chunks) {
+            if (chunk.errorLine) {
+                const size_t lineNum = 1 + std::count(file.Data(), chunk.errorLine, '\n');
+                const char* lineEnd = static_cast<const char*>(std::memchr(chunk.errorLine, '\n', chunk.end - chunk.errorLine));
+                throw Error("Failed to parse line {} of {}:\n\"{}\"\n{}", lineNum, filePath,
+                            std::string(chunk.errorLine, lineEnd ? lineEnd : chunk.end), chunk.errorMessage);
+            }
+            nbCoordinates += chunk.coordinates.size();
+        }
+        coordinates.reserve(nbCoordinates);
+        for (auto& chunk : chunks) {
+            const size_t triangleOffset = coordinates.size() / 9;
+            for (auto& [triangle, name] : chunk.bodyStarts) bodyStarts.emplace_back(triangleOffset + triangle, std::move(name));
+            coordinates.insert(coordinates.end(), chunk.coordinates.begin(), chunk.coordinates.end());
+            std::vector<double>().swap(chunk.coordinates);
+        }
+    }
+
+    bool IsBinary(const MappedFile& file) {
+        // Some exporters begin binary headers with "solid" too, so the size is checked first
+        if (file.Size() >= STL_BINARY_HEADER_SIZE) {
+            uint32_t nbTriangles;
+            std::memcpy(&nbTriangles, file.Data() + 80, sizeof(nbTriangles));
+            if (file.Size() == STL_BINARY_HEADER_SIZE + STL_BINARY_RECORD_SIZE * static_cast<size_t>(nbTriangles)) return true;
+        }
+        const char* p = file.Data();
+        const char* end = p + file.Size();
+        while (p < end && std::isspace(static_cast<unsigned char>(*p))) ++p;
+        return !(end - p >= 5 && std::memcmp(p, "solid", 5) == 0);
+    }
+
+    // Welds the vertices of the coordinate triplets in file order, distributing the triangles to the bodies
+    template<typename Real>
+    void BuildBodies(const std::vector<Real>& coordinates, const std::vector<std::pair<size_t, std::string>>& bodyStarts,
+                     double weldTolerance, RawSTLfile& result, GLProgress_Abstract& prg) {
+        result.triangleCount = coordinates.size() / 9;
+        std::vector<size_t> bodyFirstTriangle;
+        if (bodyStarts.empty() || bodyStarts.front().first > 0) { //triangles before any "solid" line
+            result.bodies.emplace_back();
+            bodyFirstTriangle.push_back(0);
+        }
+        for (const auto& [triangle, name] : bodyStarts) {
+            result.bodies.emplace_back();
+            result.bodies.back().name = name;
+            bodyFirstTriangle.push_back(triangle);
+        }
+        bodyFirstTriangle.push_back(result.triangleCount);
+
+        VertexWelder welder(result.vertices, weldTolerance, result.triangleCount / 2); //closed triangle meshes have about twice as many triangles as vertices
+        for (size_t b = 0; b < result.bodies.size(); b++) {
+            auto& triangles = result.bodies[b].triangles;
+            triangles.resize(bodyFirstTriangle[b + 1] - bodyFirstTriangle[b]);
+            for (size_t i = 0; i < triangles.size(); i++) {
+                const size_t t = bodyFirstTriangle[b] + i;
+                if (t % STL_PROGRESS_TRIANGLES == 0) prg.SetProgress(0.5 + 0.5 * static_cast<double>(t) / static_cast<double>(result.triangleCount));
+                for (size_t v = 0; v < 3; v++) {
+                    const Real* c = &coordinates[9 * t + 3 * v];
+                    triangles[i].indices[v] = welder.Add(Vector3d(c[0], c[1], c[2]));
+                }
+            }
+        }
+    }
+}
+
+RawSTLfile LoadRawSTL(const std::string& filePath, GLProgress_Abstract& prg, double weldTolerance)
+{
+    MappedFile file(filePath);
+    RawSTLfile result;
+    if (IsBinary(file)) {
+        prg.SetMessage("Reading triangles in binary STL...");
+        std::vector<float> coordinates;
+        ReadBinary(file, filePath, coordinates, prg);
+        //currently no multibody support for binary as SpaceClaim format unclear
+        BuildBodies(coordinates, {{0, ""}}, weldTolerance, result, prg);
+    }
+    else {
+        prg.SetMessage("Reading ASCII STL file...");
+        std::vector<double> coordinates;
+        std::vector<std::pair<size_t, std::string>> bodyStarts;
+        ReadAscii(file, filePath, coordinates, bodyStarts, prg);
+        BuildBodies(coordinates, bodyStarts, weldTolerance, result, prg);
+    }
+    return result;
+}
@@ -0,0 +1,55 @@
+
+
+#pragma once
+
+#include "Vector.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class GLProgress_Abstract;
+
+struct STLTriangle {
+	size_t indices[3]; //into RawSTLfile::vertices, in file order (STL normal is left-handed)
+};
+
+struct STLBody {
+	std::string name;
+	std::vector<STLTriangle> triangles;
+};
+
+//! Contents of an STL file, triangles sharing their welded vertices
+struct RawSTLfile {
+	std::vector<STLBody> bodies;
+	std::vector<Vector3d> vertices;
+	size_t triangleCount=0;
+};
+
+/**
+* \brief Hash grid merging vertices closer than a tolerance, keeping the first occurrence
+ * Cells are tolerance wide, so a match is in the vertex's own cell or a neighbouring one.
+ * With zero tolerance, only vertices with identical coordinates are merged.
+ */
+class VertexWelder {
+public:
+	VertexWelder(std::vector<Vector3d>& vertices, double tolerance, size_t expectedVertices = 0);
+	size_t Add(const Vector3d& p); //index of p or of an earlier vertex within tolerance
+
+private:
+	struct Slot {
+		uint64_t key = 0;
+		size_t head = SIZE_MAX; //last vertex added to the cell, SIZE_MAX if empty
+	};
+	size_t FindSlot(uint64_t key) const;
+	void Grow();
+
+	std::vector<Vector3d>& vertices;
+	const double tolerance;
+	std::vector<Slot> slots; //open addressing, power of two size
+	std::vector<size_t> nextInCell; //per vertex, previous vertex of the same cell
+	size_t nbCells = 0;
+};
+
+// Memory-mapped, multithreaded binary and ASCII STL reader, vertices closer than weldTolerance are merged. Throws Error
+RawSTLfile LoadRawSTL(const std::string& filePath, GLProgress_Abstract& prg, double weldTolerance = 0.0);
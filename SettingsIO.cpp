@@ -3,13 +3,14 @@
 #include "SettingsIO.h"
 #include <Helper/ConsoleLogger.h>
 #include <Helper/StringHelper.h>
+#include <algorithm>
 #include <filesystem>
+#include <fstream>
 #include "GLApp/GLTypes.h"
 
 // zip
 #include <File.h>
-#include <ziplib/Source/ZipLib/ZipArchive.h>
-#include <ziplib/Source/ZipLib/ZipFile.h>
+#include "ZipStream.h"
 
 // Input Output related settings and handy functions for the CLI application
 namespace SettingsIO {
@@ -128,6 +129,8 @@ namespace SettingsIO {
     }
 
     //! Unzip file and set correct variables (e.g. uncompressed work file)
+    //! The entry is still written out: workFile is a path, opened by name by the application's geometry loader and again when results are written back
+    //! next to the input geometry, so it can't be a one-pass stream
     int initFromZip(CLIArguments& parsedArgs) {
         if (std::filesystem::path(parsedArgs.inputFile).extension() == ".zip") {
             //parsedArgs.isArchive = true;
@@ -136,30 +139,36 @@ namespace SettingsIO {
             std::string parseFileName;
             Log::console_msg_master(2, "Decompressing {} ...\n", parsedArgs.inputFile);
 
-            ZipArchive::Ptr zip = ZipFile::Open(parsedArgs.inputFile);
-            if (zip == nullptr) {
-                Log::console_error("Can't open ZIP file\n");
-                return 1;
-            }
-            size_t numItems = zip->GetEntriesCount();
-            bool notFoundYet = true;
-            for (int i = 0; i < numItems && notFoundYet;
-                 i++) { // extract first xml file found in ZIP archive
-                auto zipItem = zip->GetEntry(i);
-                std::string zipFileName = zipItem->GetName();
-
-                if (std::filesystem::path(zipFileName).extension() ==
-                    ".xml") { // if it's an .xml file
-                    notFoundYet = false;
-
+            try {
+                std::vector<std::string> entries = ZipEntryReader::ListEntries(parsedArgs.inputFile);
+                auto xmlEntry = std::find_if(entries.begin(), entries.end(), [](const std::string& name) {
+                    return std::filesystem::path(name).extension() == ".xml";
+                }); // extract first xml file found in ZIP archive
+                if (xmlEntry != entries.end()) {
+                    const std::string& zipFileName = *xmlEntry;
                     std::string tmpFolder = MFMPI::world_size > 1 ? fmt::format("tmp{}/",MFMPI::world_rank) : "tmp/";
                     if (parsedArgs.outputPath != tmpFolder)
                         FileUtils::CreateDir(tmpFolder); // If doesn't exist yet
 
                     parseFileName = tmpFolder + zipFileName;
-                    ZipFile::ExtractFile(parsedArgs.inputFile, zipFileName, parseFileName);
+                    //the application's geometry loaders open workFile by path, so the entry is written out rather than parsed from the stream
+                    ZipEntryReader zipStream(parsedArgs.inputFile, zipFileName); // inflated by a background thread while written out
+                    std::ofstream workFile(parseFileName, std::ios::binary);
+                    if (!workFile) throw Error("Cannot open file for writing ({})", parseFileName);
+                    std::vector<char> chunk(ZIP_STREAM_CHUNK_SIZE);
+                    while (zipStream.read(chunk.data(), chunk.size()) || zipStream.gcount() > 0) {
+                        workFile.write(chunk.data(), zipStream.gcount());
+                    }
+                    if (!workFile) throw Error("Error writing {}", parseFileName);
+                    ArchiveStats stats = zipStream.GetStats();
+                    Log::console_msg_master(2, "Decompressed {:.1f} MB in {:.2f} s ({:.1f} MB/s)\n",
+                                            stats.uncompressedBytes / (1024.0 * 1024.0), stats.seconds, stats.MBps());
                 }
             }
+            catch (const std::exception& e) {
+                Log::console_error("Can't open ZIP file: {}\n", e.what());
+                return 1;
+            }
             if (parseFileName.empty()) {
                 Log::console_error("Zip file does not contain a valid geometry file!\n");
                 return 1;
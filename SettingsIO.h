@@ -12,10 +12,14 @@ namespace SettingsIO {
 
     struct CLIArguments {
         size_t nbThreads = 0;
+        std::string threadAffinity; //! none (default), compact, scatter or explicit CPU list (e.g. 0-7,16-23), see ThreadAffinity::Parse()
         uint64_t simDuration = 0;
         uint64_t desLimit = 0;
+        uint64_t accelRebuildDes = 0; //! If set, accel structure rebuilt with facet hit probabilities after this many desorptions, see OntheflySimulationParams
         uint64_t statprintInterval = 60;
+        std::string telemetryFile; //! If set, per-thread telemetry appended every statprintInterval: JSON lines for .json, CSV otherwise, see SimulationManager::telemetryFile
         uint64_t autoSaveInterval = 600; // default: autosave every 600s=10min
+        uint64_t autoSaveMemoryMB = 2048; //! Snapshot memory of the background autosave (ResultsAutosaver), 0: autosave holds the simulation while writing, see SimulationManager::autosaveMemoryMB
         bool loadAutosave = false;
         
         bool resetOnStart = false;
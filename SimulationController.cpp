@@ -1,5 +1,7 @@
 #include <sstream>
 #include <cmath> //std::ceil
+#include <algorithm> //std::max
+#include <limits>
 #include "GLApp/GLTypes.h" //Error
 #include "SimulationController.h"
 #include "Helper/StringHelper.h"
@@ -28,7 +30,7 @@
 #include <process.h>
 #endif
 
-#define WAITTIME 500 //controlled loop idle wait
+#define WAITTIME 500 //controlled loop idle wait, only a watchdog as new commands wake the loop up
 
 
 SimThreadHandle::SimThreadHandle(ProcComm& procInfo, Simulation_Abstract *simPtr, size_t threadNum, size_t nbThreads) : masterProcInfo(procInfo) {
@@ -97,55 +99,46 @@ void SimThreadHandle::MarkIdle(){
  * \return true when simulation end has been reached via desorption limit, false otherwise
  */
 
-LoopResult SimThreadHandle::RunLoop() {
-    bool finishLoop = false;
+LoopResult SimThreadHandle::RunLoop(double runStart) {
     bool lastUpdateOk = false;
     LoopResult loopResult = LoopResult::Continue;
-    double timeStart = omp_get_wtime();
-    double timeLoopStart = timeStart;
+    double timeStart = runStart; //runs are resumed after an accel structure rebuild, limits apply to the whole run
     double timeEnd;
+    size_t desorbedCount = GetDesorbedCount();
 
+    threadTelemetry = TelemetryCounts(); //only count this run
+    if (nextTelemetryTime <= runStart) nextTelemetryTime = runStart + masterProcInfo.telemetryInterval; //kept when resumed after an accel structure rebuild
+    if (nextAutosaveTime <= runStart) nextAutosaveTime = runStart + masterProcInfo.autosaveInterval;
     SetMyState(ThreadState::Running);
+    ClaimDesorptions(); //first chunk, no-op without des. limit
     do {
         SetMyStatus(ConstructMyThreadStatus());
         RunResult runResult = RunSimulation1sec(localDesLimit); // Run for 1 sec
         
         timeEnd = omp_get_wtime();
 
-        bool forceQueue = timeEnd-timeLoopStart > 60 || threadNum == 0; // update after 60s of no update or when thread 0 is called
-        if (masterProcInfo.hitUpdateQueue.front() == threadNum || forceQueue) {
-            size_t readdOnFail = 0;
-            if(simulationPtr->model->otfParams.desorptionLimit > 0){
-                if(localDesLimit > particleTracerPtr->tmpState->globalStats.globalHits.nbDesorbed) {
-                    localDesLimit -= particleTracerPtr->tmpState->globalStats.globalHits.nbDesorbed;
-                    readdOnFail = particleTracerPtr->tmpState->globalStats.globalHits.nbDesorbed;
-                }
-                else localDesLimit = 0;
-            }
-
-            size_t timeOut_ms = lastUpdateOk ? 0 : 100; //ms
-            lastUpdateOk = particleTracerPtr->UpdateHitsAndLog(simulationPtr->globalState, simulationPtr->globParticleLog,
-                masterProcInfo.threadInfos[threadNum].threadState, masterProcInfo.threadInfos[threadNum].threadStatus, masterProcInfo.procDataMutex, timeOut_ms); // Update hit with 100ms timeout. If fails, probably an other subprocess is updating, so we'll keep calculating and try it later (latest when the simulation is stopped).
-            
-            //set back from HitUpdate state
-            SetMyState(ThreadState::Running); 
-            SetMyStatus(ConstructMyThreadStatus());
-
-            if(!lastUpdateOk) // if update failed, the desorption limit is invalid and has to be reverted
-                localDesLimit += readdOnFail;
+        // Every thread merges after every step: contention is limited to the thread's group, and a busy counter is retried after the next step
+        size_t timeOut_ms = lastUpdateOk ? 0 : 100; //ms
+        lastUpdateOk = MergeHits(timeOut_ms);
 
-            if(masterProcInfo.hitUpdateQueue.front() == threadNum)
-                masterProcInfo.PlaceFrontToBack();
-            timeLoopStart = omp_get_wtime();
+        //set back from HitUpdate state
+        SetMyState(ThreadState::Running);
+        SetMyStatus(ConstructMyThreadStatus());
+        PublishTelemetry();
+        if (threadNum == 0 && !masterProcInfo.telemetryFile.empty() && timeEnd >= nextTelemetryTime) {
+            AppendTelemetry(timeEnd, runStart);
         }
-        else{
-            lastUpdateOk = false;
+        if (threadNum == 0 && !masterProcInfo.autosaveFile.empty() && timeEnd >= nextAutosaveTime) {
+            Autosave(timeEnd);
         }
 
+        size_t stepDesorbed = GetDesorbedCount() - desorbedCount;
+        desorbedCount += stepDesorbed;
+
         if (runResult == RunResult::DesError) {
             loopResult = LoopResult::DesorptionError;
         }
-        else if (runResult == RunResult::MaxReached) {
+        else if (runResult == RunResult::MaxReached && !ClaimDesorptions()) { //chunk done, finish only if the shared budget is empty too
             loopResult = LoopResult::DesLimitReached;
         }
         else if (this->particleTracerPtr->model->otfParams.timeLimit != 0 && ((timeEnd - timeStart) >= this->particleTracerPtr->model->otfParams.timeLimit)) {
@@ -157,47 +150,208 @@ LoopResult SimThreadHandle::RunLoop() {
         else if (masterProcInfo.threadInfos[threadNum].threadState == ThreadState::ThreadError) {
             loopResult = LoopResult::HasThreadError;
         }
+        else if (CountPilotDesorptions(stepDesorbed)) {
+            loopResult = LoopResult::AccelRebuild;
+        }
     } while (loopResult == LoopResult::Continue);
 
-    masterProcInfo.RemoveFromHitUpdateQueue(threadNum);
-    if (!lastUpdateOk) {
-        particleTracerPtr->UpdateHitsAndLog(simulationPtr->globalState, simulationPtr->globParticleLog,
-            masterProcInfo.threadInfos[threadNum].threadState, masterProcInfo.threadInfos[threadNum].threadStatus, masterProcInfo.procDataMutex, 20000); // Update hit with 20s timeout
+    while (!lastUpdateOk) { //local hits must not be dropped, wait as long as the target counter is busy
+        lastUpdateOk = MergeHits(20000);
+        if (!lastUpdateOk) SetMyStatus("Waiting for the hit counter to add the last hits...");
     }
+    // Partial group sums left behind are passed on by the controller once all threads have finished
+
+    LockTimed(masterProcInfo.procDataMutex);
+    masterProcInfo.threadInfos[threadNum].runTime = omp_get_wtime() - timeStart;
+    masterProcInfo.procDataMutex.unlock();
+
     SetMyStatus(ConstructMyThreadStatus());
+    PublishTelemetry();
     if (loopResult == LoopResult::DesLimitReached) {
         SetMyState(ThreadState::LimitReached);
     }
-    else {
+    else if (loopResult != LoopResult::AccelRebuild) { //resumed right after the rebuild
         SetMyState(ThreadState::Idle);
     }
     return loopResult;
 }
 
+/**
+* \brief Adds the thread-local hits to the group's partial counter (or to the global one without group), then tries to pass the group's hits on
+ * \return true if the thread-local hits were merged, false if the target counter stayed busy for timeout_ms
+ */
+bool SimThreadHandle::MergeHits(size_t timeout_ms) {
+    double mergeStart = omp_get_wtime();
+
+    size_t readdOnFail = 0;
+    if(simulationPtr->model->otfParams.desorptionLimit > 0){
+        if(localDesLimit > particleTracerPtr->tmpState->globalStats.globalHits.nbDesorbed) {
+            localDesLimit -= particleTracerPtr->tmpState->globalStats.globalHits.nbDesorbed;
+            readdOnFail = particleTracerPtr->tmpState->globalStats.globalHits.nbDesorbed;
+        }
+        else localDesLimit = 0;
+    }
+
+    const auto& target = hitGroup ? hitGroup->partialState : simulationPtr->globalState;
+    bool updateOk = particleTracerPtr->UpdateHitsAndLog(target, simulationPtr->globParticleLog,
+        masterProcInfo.threadInfos[threadNum].threadState, masterProcInfo.threadInfos[threadNum].threadStatus, masterProcInfo.procDataMutex, timeout_ms); // If fails, probably an other thread is updating, so we'll keep calculating and try it later (latest when the simulation is stopped).
+
+    if(!updateOk) // if update failed, the desorption limit is invalid and has to be reverted
+        localDesLimit += readdOnFail;
+    else if (hitGroup) {
+        hitGroup->hasHits = true;
+        FlushHitGroup(0); //opportunistic, never waits for the global state
+    }
+
+    double mergeTime = omp_get_wtime() - mergeStart;
+    threadTelemetry.mergeWaitNs += static_cast<uint64_t>(mergeTime * 1.0e9);
+    LockTimed(masterProcInfo.procDataMutex);
+    auto& threadInfo = masterProcInfo.threadInfos[threadNum];
+    if (updateOk) threadInfo.nbHitMerges++;
+    threadInfo.hitMergeTime += mergeTime;
+    threadInfo.maxHitMergeLatency = std::max(threadInfo.maxHitMergeLatency, mergeTime);
+    masterProcInfo.procDataMutex.unlock();
+
+    return updateOk;
+}
+
+/**
+* \brief Claims a chunk of the shared desorption budget, adding it to the local desorption limit
+ * Chunks shrink with the remaining budget and are capped to about a second of this thread's work, so threads finish within one chunk of each other
+ * \return true if desorptions were claimed, false without des. limit or when the budget is exhausted
+ */
+bool SimThreadHandle::ClaimDesorptions() {
+    if (!desorptionBudget) return false;
+
+    size_t remaining = desorptionBudget->load();
+    size_t chunk;
+    do {
+        if (remaining == 0) return false;
+        chunk = std::max(DES_CHUNK_MIN, remaining / (DES_CHUNK_SPLIT * nbThreads));
+        if (desPerSec > 0.0) chunk = std::min(chunk, std::max(DES_CHUNK_MIN, static_cast<size_t>(desPerSec)));
+        chunk = std::min(chunk, remaining);
+    } while (!desorptionBudget->compare_exchange_weak(remaining, remaining - chunk));
+
+    localDesLimit += chunk;
+    LockTimed(masterProcInfo.procDataMutex);
+    masterProcInfo.threadInfos[threadNum].nbDesChunks++;
+    masterProcInfo.procDataMutex.unlock();
+    return true;
+}
+
+/**
+* \brief Adds a group's partial hit counter to the global counter, both locked by the caller
+ * Counts are summed, hit and leak histories appended after the global ones, as a tracer's own update would.
+ * Texture scale limits are not carried, they are recomputed from the summed textures when displayed.
+ */
+static void AddGroupHits(GlobalSimuState& globalState, const GlobalSimuState& partialState) {
+    globalState += partialState;
+    globalState.globalStats.AppendCaches(partialState.globalStats);
+}
+
+/**
+* \brief Passes the group's partial hit counter on to the global counter and clears it
+ * Only one thread of the group flushes at a time, others return immediately
+ * \return true if the partial counter is empty on return
+ */
+bool SimThreadHandle::FlushHitGroup(size_t timeout_ms) {
+    if (!hitGroup || !hitGroup->hasHits) return true;
+    if (hitGroup->flushing.exchange(true)) return false; //another thread of the group is on it
+
+    bool flushed = false;
+    {
+        auto partialLock = GetHitLock(hitGroup->partialState.get(), timeout_ms);
+        if (partialLock) {
+            auto globalLock = GetHitLock(simulationPtr->globalState.get(), timeout_ms);
+            if (globalLock) {
+                AddGroupHits(*simulationPtr->globalState, *hitGroup->partialState);
+                hitGroup->partialState->Reset();
+                hitGroup->hasHits = false;
+                flushed = true;
+            }
+        }
+    }
+    hitGroup->flushing = false;
+    return flushed;
+}
+
+/**
+* \brief Counts desorptions of the last step towards the pilot run preceding the accel structure rebuild
+ * \return true once the shared pilot run is complete, false if none is pending
+ */
+bool SimThreadHandle::CountPilotDesorptions(size_t desorbed) {
+    if (!pilotDesorptions) return false;
+
+    size_t remaining = pilotDesorptions->load();
+    while (remaining > 0 && !pilotDesorptions->compare_exchange_weak(remaining, remaining - std::min(remaining, desorbed)));
+    return remaining <= desorbed;
+}
+
+//! Makes the thread's telemetry counts visible to the simulation manager
+void SimThreadHandle::PublishTelemetry() const {
+    auto& counters = masterProcInfo.threadCounters[threadNum];
+    counters.Publish(threadTelemetry);
+    counters.stepsPerSec.store(stepsPerSec, std::memory_order_relaxed);
+}
+
+//! Appends the telemetry of all threads to the telemetry file, stops writing for the rest of the run if it fails
+void SimThreadHandle::AppendTelemetry(double time, double runStart) {
+    nextTelemetryTime = time + masterProcInfo.telemetryInterval;
+    try {
+        AppendTelemetryFile(masterProcInfo.telemetryFile, masterProcInfo.GetThreadTelemetry(), time - runStart);
+    }
+    catch (const std::exception& e) {
+        Log::console_error("Couldn't write telemetry: {}\n", e.what());
+        nextTelemetryTime = std::numeric_limits<double>::infinity();
+    }
+}
+
+/**
+* \brief Saves the global results to the autosave file, called periodically by thread 0
+ * With a memory budget, the simulation is only held while a snapshot is taken, ResultsAutosaver writes it in the background.
+ * Without budget, or if the state doesn't fit in it, the results are written under the hit lock.
+ * A busy global counter or an autosave still being written is retried after the next step.
+ */
+void SimThreadHandle::Autosave(double time) {
+    if (resultsAutosaver && resultsAutosaver->IsBusy()) return; //retried after the next step
+    auto lock = GetHitLock(simulationPtr->globalState.get(), 0);
+    if (!lock) return;
+
+    nextAutosaveTime = time + masterProcInfo.autosaveInterval;
+    try {
+        if (!resultsAutosaver || !resultsAutosaver->Start(*simulationPtr->globalState, masterProcInfo.autosaveFile)) {
+            SaveResultsBinary(*simulationPtr->globalState, masterProcInfo.autosaveFile);
+        }
+    }
+    catch (const std::exception& e) {
+        Log::console_error("Autosave failed: {}\n", e.what());
+    }
+}
+
 void SimThreadHandle::SetMyStatus(const std::string& msg) const { //Writes to master's procInfo
-    masterProcInfo.procDataMutex.lock();
+    LockTimed(masterProcInfo.procDataMutex);
     masterProcInfo.threadInfos[threadNum].threadStatus=msg;
     masterProcInfo.procDataMutex.unlock();
 }
-void SimThreadHandle::SetMyState(const ThreadState state) const { //Writes to master's procInfo
-    masterProcInfo.procDataMutex.lock();
-    masterProcInfo.threadInfos[threadNum].threadState=state;
-    masterProcInfo.procDataMutex.unlock();
+void SimThreadHandle::SetMyState(const ThreadState state) const { //Writes to master's procInfo, wakes up waiting simulation manager
+    masterProcInfo.UpdateThreadState(threadNum, state);
+}
+
+//! Desorptions of this thread, merged or not
+size_t SimThreadHandle::GetDesorbedCount() const {
+    return particleTracerPtr->totalDesorbed + particleTracerPtr->tmpState->globalStats.globalHits.nbDesorbed;
 }
 
 [[nodiscard]] std::string SimThreadHandle::ConstructMyThreadStatus() const {
     if (!particleTracerPtr) return "[No particle tracer constructed.]";
 
-    size_t count = particleTracerPtr->totalDesorbed + particleTracerPtr->tmpState->globalStats.globalHits.nbDesorbed;
+    size_t count = GetDesorbedCount();
 
-    size_t max = 0;
-    if (nbThreads)
-        max = (simulationPtr->model->otfParams.desorptionLimit / nbThreads)
-                + ((this->threadNum < simulationPtr->model->otfParams.desorptionLimit % nbThreads) ? 1 : 0);
+    size_t max = simulationPtr->model->otfParams.desorptionLimit; //threads share the limit dynamically, show contribution to it
 
     if (max != 0) {
         double percent = (double) (count) * 100.0 / (double) (max);
-        return fmt::format("{}/{} des ({:.1f}%)",count, max, percent);
+        return fmt::format("{} des ({:.1f}% of limit)",count, percent);
     } else {
         return fmt::format("{} des", count);
     }
@@ -229,20 +383,27 @@ RunResult SimThreadHandle::RunSimulation1sec(const size_t desorptionLimit) {
 
     
     double start_time = omp_get_wtime();
+    size_t desorbedBefore = particleTracerPtr->tmpState->globalStats.globalHits.nbDesorbed;
     MFSim::MCStepResult runResult = particleTracerPtr->SimulationMCStep(nbStep, threadNum, remainingDes); //run 1 sec
+    double end_time = omp_get_wtime();
+
+    LockTimed(masterProcInfo.procDataMutex);
+    masterProcInfo.threadInfos[threadNum].simTime += end_time - start_time;
+    masterProcInfo.procDataMutex.unlock();
+
     if (runResult==MFSim::MCStepResult::MaxReached) {
         return RunResult::MaxReached;
     }
     else if (runResult == MFSim::MCStepResult::DesorptionError) {
         return RunResult::DesError;
     }
-    double end_time = omp_get_wtime();
 
     // don't update on end, this will give a false ratio (SimMCStep could return actual steps instead of plain "false"
     
     const double elapsedTimeMs = (end_time - start_time);
     if (elapsedTimeMs != 0.0) {
         stepsPerSec = static_cast<double>(nbStep) / elapsedTimeMs; // every 1.0 second
+        desPerSec = static_cast<double>(particleTracerPtr->tmpState->globalStats.globalHits.nbDesorbed - desorbedBefore) / elapsedTimeMs;
     }
     else {
         stepsPerSec = (100.0 * static_cast<double>(nbStep)); // in case of fast initial run
@@ -251,7 +412,7 @@ RunResult SimThreadHandle::RunSimulation1sec(const size_t desorptionLimit) {
 }
 
 SimulationController::SimulationController(size_t parentPID, size_t procIdx, size_t nbThreads,
-                                           Simulation_Abstract *simulationInstance, ProcComm& pInfo) : procInfo(pInfo) {
+                                           Simulation_Abstract *simulationInstance, ProcComm& pInfo, const ThreadAffinity& affinity) : procInfo(pInfo), affinity(affinity) {
     this->prIdx = procIdx;
     this->parentPID = parentPID;
     if (nbThreads == 0)
@@ -264,6 +425,18 @@ SimulationController::SimulationController(size_t parentPID, size_t procIdx, siz
         this->nbThreads = nbThreads;
 
     simulationPtr = simulationInstance; // TODO: Find a nicer way to manager derived simulationunit for Molflow and Synrad
+    executingCommandId = procInfo.GetCommandId(); //in blocking mode commands are called directly, without being posted
+
+    auto topology = CpuTopology::Detect();
+    threadCpus = affinity.MapThreads(topology, this->nbThreads);
+    Log::console_msg_master(2, "CPU topology: {}\n", topology.Describe());
+    if (!threadCpus.empty()) {
+        std::string mapping;
+        for (size_t t = 0; t < threadCpus.size(); t++) {
+            mapping += fmt::format(" {}->{}", t, threadCpus[t]);
+        }
+        Log::console_msg_master(2, "Thread affinity {}, thread->CPU:{}\n", affinity.ToString(), mapping);
+    }
 
     SetRuntimeInfo();
     //procInfo.controllerState = ControllerState::Ready;
@@ -311,14 +484,186 @@ void SimulationController::SetRuntimeInfo() {
     }
 }
 
-void SimulationController::ClearCommand() {
+/**
+* \brief Sets up the intermediate level of the hit reduction tree, one partial counter per HIT_REDUCTION_GROUP_SIZE consecutive threads
+ * With few threads the global counter is not contended enough to pay for an extra merge, threads then add their hits directly
+ */
+void SimulationController::InitHitGroups() {
+    for (auto& thread : simThreadHandles) thread.hitGroup = nullptr;
+    hitGroups.clear();
+    if (nbThreads <= HIT_REDUCTION_GROUP_SIZE) return;
+
+    size_t nbGroups = (nbThreads + HIT_REDUCTION_GROUP_SIZE - 1) / HIT_REDUCTION_GROUP_SIZE;
+    hitGroups.reserve(nbGroups);
+    for (size_t g = 0; g < nbGroups; g++) {
+        auto group = std::make_unique<HitReductionGroup>();
+        group->partialState = std::make_shared<GlobalSimuState>();
+        group->partialState->Resize(simulationPtr->model);
+        hitGroups.emplace_back(std::move(group));
+    }
+    for (auto& thread : simThreadHandles) {
+        thread.hitGroup = hitGroups[thread.threadNum / HIT_REDUCTION_GROUP_SIZE].get();
+    }
+}
+
+//! Passes hits remaining in the group counters on to the global counter, called when no thread is running
+void SimulationController::FlushHitGroups() {
+    for (size_t g = 0; g < hitGroups.size(); g++) {
+        while (!simThreadHandles[g * HIT_REDUCTION_GROUP_SIZE].FlushHitGroup(20000)) { //partial sums must not be dropped, wait as long as the global counter is busy
+            Log::console_msg(4, "Global hit counter busy, still waiting to add the hits of thread group {}\n", g);
+        }
+    }
+}
+
+//! Pins the calling OpenMP thread to the CPU of simulation thread threadNum, if an affinity was requested, until the returned pin goes out of scope
+ScopedThreadPin SimulationController::PinThread(size_t threadNum) const {
+    if (threadNum >= threadCpus.size()) return ScopedThreadPin();
+    ScopedThreadPin pin(threadCpus[threadNum]);
+    if (!pin.IsPinned()) {
+        Log::console_msg(4, "Couldn't pin thread {} to CPU {}\n", threadNum, threadCpus[threadNum]);
+    }
+    return pin;
+}
+
+/**
+* \brief Reallocates thread-local hit counters (including textures) and group partial counters from their pinned owner threads
+ * ParticleTracers are constructed by the controller thread, so with first-touch page placement all counters would land on its NUMA node
+ */
+void SimulationController::FirstTouchLocalStates() {
+    if (threadCpus.empty()) return; //threads not pinned, the OS may move them anyway
+
+#pragma omp parallel num_threads((int)nbThreads)
+    {
+        size_t threadNum = omp_get_thread_num();
+        auto pin = PinThread(threadNum);
+
+        auto localState = std::make_shared<GlobalSimuState>();
+        localState->Resize(simulationPtr->model);
+        simThreadHandles[threadNum].particleTracerPtr->tmpState = localState;
+
+        if (!hitGroups.empty() && threadNum % HIT_REDUCTION_GROUP_SIZE == 0) {
+            auto partialState = std::make_shared<GlobalSimuState>();
+            partialState->Resize(simulationPtr->model);
+            hitGroups[threadNum / HIT_REDUCTION_GROUP_SIZE]->partialState = partialState;
+        }
+    }
+}
+
+//! Lets the last background autosave of the run complete, so that the file is whole once the run is reported finished
+void SimulationController::WaitForAutosave() {
+    if (!resultsAutosaver) return;
+    try {
+        resultsAutosaver->Wait();
+    }
+    catch (const std::exception& e) {
+        Log::console_error("Autosave failed: {}\n", e.what());
+    }
+}
+
+void SimulationController::ResetRunStats() {
+    double simTime;
+    GetTracedRays(raysAtRunStart, simTime);
+    pilotRaysPerSec = 0.0;
+    procInfo.procDataMutex.lock();
+    for (auto& threadInfo : procInfo.threadInfos) {
+        threadInfo.nbHitMerges = 0;
+        threadInfo.hitMergeTime = 0.0;
+        threadInfo.maxHitMergeLatency = 0.0;
+        threadInfo.runTime = 0.0;
+        threadInfo.simTime = 0.0;
+        threadInfo.nbDesChunks = 0;
+    }
+    procInfo.procDataMutex.unlock();
+}
+
+//! Logs hit merge overhead and per-thread utilization (share of the run spent in MC steps) of the last run
+void SimulationController::LogRunStats(double runTime) const {
+    size_t nbMerges = 0;
+    double mergeTime = 0.0, threadTime = 0.0, maxLatency = 0.0;
+    std::string utilization;
+    procInfo.procDataMutex.lock();
+    for (size_t i = 0; i < procInfo.threadInfos.size(); i++) {
+        const auto& threadInfo = procInfo.threadInfos[i];
+        nbMerges += threadInfo.nbHitMerges;
+        mergeTime += threadInfo.hitMergeTime;
+        threadTime += threadInfo.runTime;
+        maxLatency = std::max(maxLatency, threadInfo.maxHitMergeLatency);
+        utilization += fmt::format(" [{}] {:.1f}% ({} chunks)", i, runTime > 0.0 ? 100.0 * threadInfo.simTime / runTime : 0.0, threadInfo.nbDesChunks);
+    }
+    procInfo.procDataMutex.unlock();
+    Log::console_msg(4, "Hit merges: {} in {} groups, {:.2f}% of thread time, max latency {:.1f} ms\n",
+        nbMerges, hitGroups.size(), threadTime > 0.0 ? 100.0 * mergeTime / threadTime : 0.0, maxLatency * 1000.0);
+    Log::console_msg(4, "Thread utilization over {:.2f} s:{}\n", runTime, utilization);
+
+    if (pilotRaysPerSec > 0.0) {
+        uint64_t nbRays;
+        double simTime;
+        GetTracedRays(nbRays, simTime);
+        double raysPerSec = simTime > simTimeAtRebuild ? (double)(nbRays - raysAtRebuild) / (simTime - simTimeAtRebuild) : 0.0;
+        Log::console_msg(3, "Rays/s per thread: {:.4g} before, {:.4g} after the accel structure rebuild from hit statistics ({:+.1f}%)\n",
+            pilotRaysPerSec, raysPerSec, 100.0 * (raysPerSec / pilotRaysPerSec - 1.0));
+    }
+}
+
+//! Rays traced by all threads (since the last telemetry reset) and MC step time summed over threads (since the start of the run)
+void SimulationController::GetTracedRays(uint64_t& nbRays, double& simTime) const {
+    nbRays = 0;
+    simTime = 0.0;
+    if (!procInfo.threadCounters) return;
     procInfo.procDataMutex.lock();
-    procInfo.masterCmd = SimCommand::None;
-    procInfo.cmdParam = 0;
-    procInfo.cmdParam2 = 0;
+    for (size_t i = 0; i < procInfo.threadInfos.size(); i++) {
+        nbRays += procInfo.threadCounters[i].raysTraced.load(std::memory_order_relaxed);
+        simTime += procInfo.threadInfos[i].simTime;
+    }
     procInfo.procDataMutex.unlock();
 }
 
+/**
+* \brief Rebuilds the accel structure with per-facet hit probabilities from the global hit counters (pilot run or loaded results)
+ * Frequently hit facets end up closer to the root. Only called while no thread traces rays.
+ */
+void SimulationController::RebuildAccelFromHits(LoadStatus_abstract* loadStatus) {
+    accelRebuilt = true; //also on failure, no retry until the next load or reset
+    procInfo.UpdateControllerStatus(std::nullopt, { "Rebuilding acceleration structure from hit statistics..." }, loadStatus);
+
+    std::vector<size_t> hitCounts;
+    size_t nbDesorbed = 0;
+    {
+        auto lock = GetHitLock(simulationPtr->globalState.get(), 10000);
+        if (!lock) {
+            Log::console_error("Couldn't read hit statistics for the accel structure rebuild (timeout)\n");
+            procInfo.UpdateControllerStatus(std::nullopt, { "" }, loadStatus);
+            return;
+        }
+        hitCounts.reserve(simulationPtr->globalState->facetStates.size());
+        for (const auto& facetState : simulationPtr->globalState->facetStates) {
+            hitCounts.push_back(facetState.momentResults[0].hits.nbMCHit);
+        }
+        nbDesorbed = simulationPtr->globalState->globalStats.globalHits.nbDesorbed;
+    }
+
+    double simTime;
+    GetTracedRays(raysAtRebuild, simTime);
+    if (simTime > 0.0) {
+        pilotRaysPerSec = (double)(raysAtRebuild - raysAtRunStart) / simTime;
+        simTimeAtRebuild = simTime;
+    }
+
+    double rebuildStart = omp_get_wtime();
+    if (simulationPtr->model->RebuildAccelStructure(HitCountsToProbabilities(hitCounts))) {
+        Log::console_error("Couldn't rebuild acceleration structure: none built\n");
+    }
+    else {
+        Log::console_msg_master(3, "Acceleration structure rebuilt from hit statistics of {} desorptions in {:.1f} ms\n",
+            nbDesorbed, (omp_get_wtime() - rebuildStart) * 1000.0);
+    }
+    procInfo.UpdateControllerStatus(std::nullopt, { "" }, loadStatus);
+}
+
+void SimulationController::ClearCommand() {
+    procInfo.ClearCommand(executingCommandId);
+}
+
 /*
 int SimulationController::SetThreadStates(SimState state, const std::string &status, bool changeState, bool changeStatus) {
 
@@ -427,7 +772,7 @@ void SimulationController::ControllerLoop() {
     exitRequested = false;
     loadOk = false;
     while (!exitRequested) {
-        switch (procInfo.masterCmd) {
+        switch (procInfo.GetCommand(executingCommandId)) {
             case SimCommand::Load: {
                 try {
                     Load();
@@ -448,6 +793,7 @@ void SimulationController::ControllerLoop() {
             case SimCommand::Pause: {
                 //ClearCommand(); //threads will self-stop when command!=run and StartAndRun() will clear command
                 procInfo.UpdateControllerStatus({ ControllerState::Ready }, std::nullopt);
+                procInfo.WaitForCommand(executingCommandId, WAITTIME);
                 break;
             }
             case SimCommand::Reset: {
@@ -463,7 +809,7 @@ void SimulationController::ControllerLoop() {
 			    break;
 		    }
 		    default: {
-			    ProcessSleep(WAITTIME);
+			    procInfo.WaitForCommand(executingCommandId, WAITTIME);
 			    break;
 		    }
 		}
@@ -510,6 +856,12 @@ void SimulationController::Load(LoadStatus_abstract* loadStatus) {
             ClearCommand();
             return; //error
         }
+        if (!simulationPtr->model->IsAccelTypeBuilt(simulationPtr->model->sp.accel_type)) {
+            loadOk = false;
+            procInfo.UpdateControllerStatus({ ControllerState::InError }, { "Wide BVH not supported by this application's acceleration structure build" }, loadStatus);
+            ClearCommand();
+            return;
+        }
 
         loadOk = true;
 
@@ -520,6 +872,9 @@ void SimulationController::Load(LoadStatus_abstract* loadStatus) {
                     SimThreadHandle(procInfo, simulationPtr, t, nbThreads));
             simThreadHandles.back().particleTracerPtr = simulationPtr->GetParticleTracerPtr(t);
         }
+        InitHitGroups();
+        FirstTouchLocalStates();
+        accelRebuilt = false; //LoadSimulation() built it from scratch
         
         // "Warm up" threads, to remove overhead for performance benchmarks
         double randomCounter = 0;
@@ -602,41 +957,67 @@ bool SimulationController::StartAndRun(LoadStatus_abstract* loadStatus) {
     }
     */
 
-    procInfo.InitHitUpdateQueue();
+    ResetRunStats();
 
-    // Calculate remaining work
-    size_t desPerThread = 0;
-    size_t remainder = 0;
-    if(simulationPtr->model->otfParams.desorptionLimit > 0){
-        if(simulationPtr->model->otfParams.desorptionLimit > (simulationPtr->globalState->globalStats.globalHits.nbDesorbed)) {
-            size_t limitDes_global = simulationPtr->model->otfParams.desorptionLimit;
-            desPerThread = limitDes_global / nbThreads;
-            remainder = limitDes_global % nbThreads;
-        }
-    }
+    // Calculate remaining work, claimed in chunks by the threads as they go
+    size_t desorbed_global = simulationPtr->globalState->globalStats.globalHits.nbDesorbed;
+    size_t limitDes_global = simulationPtr->model->otfParams.desorptionLimit;
+    desorptionBudget = (limitDes_global > desorbed_global) ? limitDes_global - desorbed_global : 0;
     for(auto& thread : simThreadHandles){
-        size_t localDes = (desPerThread > thread.particleTracerPtr->totalDesorbed) ? desPerThread - thread.particleTracerPtr->totalDesorbed : 0; //remaining
-        thread.localDesLimit = (thread.threadNum < remainder) ? localDes + 1 : localDes;
+        thread.localDesLimit = 0;
+        thread.desorptionBudget = (limitDes_global > 0) ? &desorptionBudget : nullptr;
+    }
+
+    // Pilot run whose hit statistics guide the accel structure rebuild, loaded results may already be enough
+    size_t rebuildDes = simulationPtr->model->otfParams.accelRebuildDes;
+    bool pilotPending = rebuildDes > 0 && !accelRebuilt;
+    if (pilotPending && desorbed_global >= rebuildDes) {
+        RebuildAccelFromHits(loadStatus);
+        pilotPending = false;
+    }
+    pilotDesorptions = pilotPending ? rebuildDes - desorbed_global : 0;
+    for (auto& thread : simThreadHandles) {
+        thread.pilotDesorptions = pilotPending ? &pilotDesorptions : nullptr;
+    }
+
+    if (!procInfo.autosaveFile.empty() && procInfo.autosaveMemory > 0 && !resultsAutosaver) {
+        resultsAutosaver = std::make_unique<ResultsAutosaver>(procInfo.autosaveMemory);
     }
+    simThreadHandles[0].resultsAutosaver = resultsAutosaver.get();
 
     bool desError_global = false;
+    bool rebuildRequested;
+    double runStart = omp_get_wtime();
 
+    do {
+        rebuildRequested = false;
 #pragma omp parallel num_threads((int)nbThreads)
-    {
-        bool desError_private = false;
-
-        // Set OpenMP thread priority on Windows whenever we start a simulation run
+        {
+            // Set OpenMP thread priority on Windows whenever we start a simulation run
 #if defined(_WIN32) && defined(_MSC_VER)
-        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+            SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
 #endif
-        //Actually run the simulation:
-        desError_private = simThreadHandles[omp_get_thread_num()].RunLoop() == LoopResult::DesorptionError;
+            auto pin = PinThread(omp_get_thread_num()); //released at the end of the region, so the controller thread (master) is not left pinned
+            //Actually run the simulation:
+            LoopResult loopResult = simThreadHandles[omp_get_thread_num()].RunLoop(runStart);
 
-        if(desError_private) {
-//#pragma omp atomic
-            desError_global = true; //Race condition ok, desError_global means "at least one thread finished"
+            if (loopResult == LoopResult::DesorptionError) {
+                desError_global = true; //Race condition ok, desError_global means "at least one thread finished"
+            }
+            else if (loopResult == LoopResult::AccelRebuild) {
+                rebuildRequested = true; //Race condition ok, same as above
+            }
         }
-    }
+
+        FlushHitGroups();
+        if (rebuildRequested) {
+            RebuildAccelFromHits(loadStatus);
+            for (auto& thread : simThreadHandles) thread.pilotDesorptions = nullptr;
+        }
+    } while (rebuildRequested && procInfo.masterCmd == SimCommand::Run && !desError_global);
+
+    LogRunStats(omp_get_wtime() - runStart);
+    WaitForAutosave();
 
     //Run finished
     if (procInfo.masterCmd != SimCommand::Kill) {
@@ -653,6 +1034,11 @@ void SimulationController::Reset(LoadStatus_abstract* loadStatus) {
     procInfo.UpdateControllerStatus({ ControllerState::Resetting }, { "Resetting simulation..." }, loadStatus);
     ResetControls();
     simulationPtr->ResetSimulation();
+    accelRebuilt = false; //hit statistics are gone, next run starts a new pilot
+    for (auto& group : hitGroups) {
+        group->partialState->Reset();
+        group->hasHits = false;
+    }
     procInfo.UpdateControllerStatus({ ControllerState::Ready }, { "" }, loadStatus);
     ClearCommand();
 }
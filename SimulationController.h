@@ -3,12 +3,24 @@
 #pragma once
 
 #include <string>
+#include <atomic>
+#include <memory>
 #include "SMP.h"
 #include "ProcessControl.h"
 #include "SimulationUnit.h"
+#include "ThreadAffinity.h"
+#include "ResultsFile.h" //ResultsAutosaver
 namespace MFSim {
     class ParticleTracer;
 }
+class GlobalSimuState;
+
+//! Number of consecutive threads sharing one partial hit counter before it is passed on to the global state
+constexpr size_t HIT_REDUCTION_GROUP_SIZE = 8;
+
+//! Desorption limit chunks claimed by threads from the shared budget: remaining/(DES_CHUNK_SPLIT*nbThreads), at most one second of work, at least DES_CHUNK_MIN
+constexpr size_t DES_CHUNK_SPLIT = 4;
+constexpr size_t DES_CHUNK_MIN = 16;
 
 //class Simulation_Abstract;
 
@@ -24,7 +36,19 @@ enum LoopResult {
     DesLimitReached,
     TimeLimitReached,
     DesorptionError,
-    HasThreadError
+    HasThreadError,
+    AccelRebuild //pilot run complete, see SimulationController::RebuildAccelFromHits()
+};
+
+/**
+* \brief Intermediate level of the hit counter reduction tree
+ * Threads of a group add their local hits to partialState, the first one finding the global state free passes the partial sum on (SimThreadHandle::FlushHitGroup).
+ * Threads never wait on each other: a busy group or global state is simply retried after the next simulation step.
+ */
+struct HitReductionGroup {
+    std::shared_ptr<GlobalSimuState> partialState;
+    std::atomic<bool> hasHits{false}; //partialState holds hits not yet added to the global state
+    std::atomic<bool> flushing{false}; //a thread of the group is currently passing partialState on
 };
 
 /**
@@ -37,15 +61,23 @@ public:
 
     
     double stepsPerSec=1.0;
-    size_t localDesLimit=0;
+    double desPerSec=0.0; //desorption rate of the last step, sizes claimed chunks
+    size_t localDesLimit=0; //claimed desorptions not yet added to global counters
     double timeLimit=0.0;
+    std::atomic<size_t>* desorptionBudget=nullptr; //shared unclaimed desorptions, nullptr without des. limit
+    std::atomic<size_t>* pilotDesorptions=nullptr; //shared desorptions left before the accel structure rebuild, nullptr if none pending
+    double nextTelemetryTime=0.0; //thread 0 only, see AppendTelemetry()
+    double nextAutosaveTime=0.0; //thread 0 only, see Autosave()
+    ResultsAutosaver* resultsAutosaver=nullptr; //thread 0 only, nullptr for a blocking autosave
 
     ProcComm& masterProcInfo;
     Simulation_Abstract* simulationPtr;
     size_t threadNum,nbThreads;
 
     std::shared_ptr<MFSim::ParticleTracer> particleTracerPtr;
-    LoopResult RunLoop();
+    HitReductionGroup* hitGroup=nullptr; //nullptr: thread-local hits are added directly to the global state
+    LoopResult RunLoop(double runStart);
+    bool FlushHitGroup(size_t timeout_ms);
     void MarkIdle();
     [[nodiscard]] std::string ConstructMyThreadStatus() const;
 
@@ -53,7 +85,14 @@ private:
     
     void SetMyStatus(const std::string& msg) const;
     void SetMyState(const ThreadState state) const;
+    void PublishTelemetry() const;
+    void AppendTelemetry(double time, double runStart);
+    void Autosave(double time);
     RunResult RunSimulation1sec(const size_t desorptionLimit);
+    bool ClaimDesorptions();
+    bool CountPilotDesorptions(size_t desorbed);
+    bool MergeHits(size_t timeout_ms);
+    [[nodiscard]] size_t GetDesorbedCount() const;
     //int advanceForTime(double simDuration);
     //int advanceForSteps(size_t desorptions);
 };
@@ -74,10 +113,19 @@ protected:
     //void SetReady(/*const bool loadOk*/);
     void ClearCommand();
     void SetRuntimeInfo();
+    void InitHitGroups();
+    void FlushHitGroups();
+    void ResetRunStats();
+    void LogRunStats(double runTime) const;
+    void RebuildAccelFromHits(LoadStatus_abstract* loadStatus);
+    void GetTracedRays(uint64_t& nbRays, double& simTime) const;
+    [[nodiscard]] ScopedThreadPin PinThread(size_t threadNum) const;
+    void FirstTouchLocalStates();
+    void WaitForAutosave();
     //size_t GetThreadStates() const;
 public:
     SimulationController(size_t parentPID, size_t procIdx, size_t nbThreads,
-                         Simulation_Abstract *simulationInstance, ProcComm& pInfo);
+                         Simulation_Abstract *simulationInstance, ProcComm& pInfo, const ThreadAffinity& affinity = ThreadAffinity());
     void ControllerLoop();
 
     bool StartAndRun(LoadStatus_abstract* loadStatus=nullptr);
@@ -90,17 +138,32 @@ protected:
 
     Simulation_Abstract* simulationPtr;
     std::vector<SimThreadHandle> simThreadHandles;
+    std::vector<std::unique_ptr<HitReductionGroup>> hitGroups; //empty when few threads merge directly into the global state
+    std::atomic<size_t> desorptionBudget{0}; //desorptions left to claim by threads before reaching the des. limit
+    std::atomic<size_t> pilotDesorptions{0}; //desorptions left before the accel structure is rebuilt from hit statistics
+    bool accelRebuilt=false; //accel structure rebuilt from hit statistics since the last load or reset
+
+    // Ray throughput before and after the rebuild from hit statistics, compared by LogRunStats()
+    uint64_t raysAtRunStart=0;
+    uint64_t raysAtRebuild=0;
+    double simTimeAtRebuild=0.0; //summed over threads
+    double pilotRaysPerSec=0.0; //0 if no rebuild during the last run
 
     ProcComm& procInfo;
     size_t parentPID;
     size_t nbThreads;
     size_t prIdx;
 
+    ThreadAffinity affinity;
+    std::vector<int> threadCpus; //CPU each simulation thread is pinned to, empty if not pinned
+    std::unique_ptr<ResultsAutosaver> resultsAutosaver; //kept between runs to reuse its snapshot buffers
+
 private:
     // tmp
     double stepsPerSec=0.0;
     bool exitRequested=false;
     bool lastHitUpdateOK=true;
     bool loadOk=false;
+    size_t executingCommandId=0; //commandId of procInfo's command being executed, see ProcCommData::ClearCommand()
 
 };
@@ -185,6 +185,11 @@ int SimulationManager::CreateCPUHandle(LoadStatus_abstract* loadStatus) {
 
     try{
         procInformation.Resize(nbThreads);
+        procInformation.telemetryFile = telemetryFile;
+        procInformation.telemetryInterval = static_cast<double>(std::max<size_t>(telemetryInterval, 1));
+        procInformation.autosaveFile = autosaveFile;
+        procInformation.autosaveInterval = static_cast<double>(std::max<size_t>(autosaveInterval, 1));
+        procInformation.autosaveMemory = autosaveMemoryMB * 1024 * 1024;
         procInformation.UpdateControllerStatus(std::nullopt, { "Deleting old simulation..." }, loadStatus);
         controllerLoopThread.reset();
     }
@@ -203,7 +208,7 @@ int SimulationManager::CreateCPUHandle(LoadStatus_abstract* loadStatus) {
     simulation = std::make_unique<SynradSimulation>();
 #endif
     procInformation.UpdateControllerStatus(std::nullopt, { "Creating new simulation controller..." }, loadStatus);
-    simController = std::make_unique<SimulationController>((size_t)processId, (size_t)0, nbThreads, simulation.get(), procInformation);
+    simController = std::make_unique<SimulationController>((size_t)processId, (size_t)0, nbThreads, simulation.get(), procInformation, threadAffinity);
     
     if(asyncMode) {
         controllerLoopThread = std::make_unique<std::thread>(&SimulationController::ControllerLoop, simController.get());
@@ -259,11 +264,12 @@ int SimulationManager::WaitForControllerAndThreadState(const std::vector<Control
     LoadStatus_abstract* loadStatus) {
     // Wait for completion
     bool finished = false;
-    const int waitAmount_ms = 500;
+    const unsigned int waitAmount_ms = 500;
     allProcsReachedLimit = true;
     hasErrorStatus = false;
     bool abortRequested = false;
 	do {
+        size_t seenVersion = procInformation.GetStateVersion(); //read before checking, so that a change during the check ends the wait right away
 
 		finished = true;
         //Check thread success
@@ -282,7 +288,7 @@ int SimulationManager::WaitForControllerAndThreadState(const std::vector<Control
         }
 
         if (!successControllerStates.empty()) {
-            finished = finished && Contains(successControllerStates,procInformation.controllerState);
+            finished = finished && Contains(successControllerStates,procInformation.controllerState.load());
             if (procInformation.controllerState == ControllerState::InError) {
                 hasErrorStatus = true;
                 finished = true;
@@ -298,7 +304,7 @@ int SimulationManager::WaitForControllerAndThreadState(const std::vector<Control
                 loadStatus->Update();
             }
 
-			ProcessSleep(waitAmount_ms);
+			procInformation.WaitForStateChange(seenVersion, waitAmount_ms); //woken up by controller and threads, timeout only to refresh loadStatus and check abort
 
             if (loadStatus) {
                 abortRequested = loadStatus->abortRequested;
@@ -312,9 +318,7 @@ int SimulationManager::WaitForControllerAndThreadState(const std::vector<Control
 //! Forward a command to simulation controllers
 void SimulationManager::ForwardCommand(const SimCommand command, const size_t param, const size_t param2) {
 
-    procInformation.masterCmd = command;
-    procInformation.cmdParam = param;
-    procInformation.cmdParam2 = param2;
+    procInformation.PostCommand(command, param, param2);
     //simController->controllerState = ControllerState::ExecutingCommand;
 
     /*
@@ -343,6 +347,18 @@ int SimulationManager::ExecuteAndWait(const SimCommand command, const size_t par
     return 1; //error or aborted
 }
 
+//! Snapshot of the per-thread telemetry, empty before SetUpSimulation()
+std::vector<ThreadTelemetry> SimulationManager::GetThreadTelemetry() const {
+    return procInformation.GetThreadTelemetry();
+}
+
+void SimulationManager::ResetThreadTelemetry() {
+    if (!procInformation.threadCounters) return;
+    for (size_t i = 0; i < procInformation.threadInfos.size(); i++) {
+        procInformation.threadCounters[i].Reset();
+    }
+}
+
 void SimulationManager::KillSimulation(LoadStatus_abstract* loadStatus) {
     if( controllerLoopThread ) {
         if(ExecuteAndWait(SimCommand::Kill, 0, 0,
@@ -418,7 +434,7 @@ int SimulationManager::GetProcStatus(ProcComm &procInfoList) {
     if(!controllerLoopThread)
         return 1;
 
-    procInfoList.controllerState = procInformation.controllerState;
+    procInfoList.controllerState = procInformation.controllerState.load();
     procInfoList.controllerStatus = procInformation.controllerStatus;
     procInfoList.threadInfos = procInformation.threadInfos;
 
@@ -13,6 +13,7 @@
 #include "../src/Simulation/SynradSimulation.h"
 #endif
 #include "ProcessControl.h"
+#include "ThreadAffinity.h"
 
 typedef unsigned char BYTE;
 
@@ -91,6 +92,9 @@ public:
 
     bool IsRunning();
 
+    [[nodiscard]] std::vector<ThreadTelemetry> GetThreadTelemetry() const; //counters cumulated since ResetThreadTelemetry()
+    void ResetThreadTelemetry();
+
     /*
     int IncreasePriority();
     int DecreasePriority();
@@ -107,6 +111,12 @@ protected:
 public:
     size_t nbThreads=0;
     size_t mainProcId;
+    ThreadAffinity threadAffinity; //Placement of simulation threads, set from CLI arguments before SetUpSimulation()
+    std::string telemetryFile; //Per-thread telemetry output while running, set from CLI arguments before SetUpSimulation(), empty: none
+    size_t telemetryInterval = 60; //seconds between telemetry snapshots, CLI status print interval
+    std::string autosaveFile; //Results autosave while running (binary results file), set from CLI arguments before SetUpSimulation(), empty: none
+    size_t autosaveInterval = 600; //seconds
+    size_t autosaveMemoryMB = 2048; //see ResultsAutosaver, 0: the autosave holds the simulation while writing
 
     bool asyncMode=false; //Commands issued to threads with non-blocking mode. Default for GUI, disabled for CLI and test suite
     bool noProgress = false; //Don't print percentage updates for progressbars, useful if output written to log file
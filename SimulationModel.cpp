@@ -4,6 +4,8 @@
 #include "FacetData.h"
 #include "SimulationFacet.h"
 #include "Helper/MathTools.h"
+#include "RayTracing/KDTree.h"
+#include "RayTracing/Instancing.h"
 
 size_t SimulationModel::GetMemSize() {
     size_t modelSize = 0;
@@ -22,6 +24,124 @@ size_t SimulationModel::GetMemSize() {
     return modelSize;
 }
 
+/**
+* \brief Shared part of BuildAccelStructure(): groups the facets by superstructure and builds the chosen accel structure of each
+ * Facets with superIdx -1 (e.g. counters) belong to all superstructures
+ * \return error code: 0=no error, 1=facet with invalid superstructure index
+ */
+int SimulationModel::BuildRayTracingStructures(AccelType accel_type, BVHAccel::SplitMethod split, int bvh_width) {
+    std::vector<std::vector<std::shared_ptr<RTFacet>>> primitives(sh.nbSuper);
+    for (const auto& facet : facets) {
+        const int superIdx = facet->sh.superIdx;
+        if (superIdx == -1) {
+            for (auto& structurePrimitives : primitives)
+                structurePrimitives.push_back(facet);
+        }
+        else if (superIdx >= 0 && superIdx < (int)sh.nbSuper) {
+            primitives[superIdx].push_back(facet);
+        }
+        else {
+            return 1;
+        }
+    }
+
+    auto settings = std::make_tuple(accel_type, split, bvh_width, wideBVHWidth, wideBVHFloatBounds, instancing);
+    if (settings == rayTracingSettings && RefitAccelStructure(primitives) == 0)
+        return 0;
+
+    rayTracingStructures.clear();
+    for (auto& structurePrimitives : primitives)
+        rayTracingStructures.push_back(ConstructAccelStructure(std::move(structurePrimitives), accel_type, split, bvh_width));
+    rayTracingSettings = settings;
+    return 0;
+}
+
+/**
+* \brief Builds the chosen accel structure over the facets of one superstructure
+ * \param bvh_width max. primitives per BVH leaf
+ * With instancing, connected facet groups that are rigid copies of each other get one accel structure of the chosen type,
+ * placed by an InstancedAccel; without any repetition, the flat structure is built
+ * \param probabilities per-facet hit probabilities (indexed by globalId), used by ProbSplit and the kd-tree
+ */
+std::unique_ptr<RTPrimitive> SimulationModel::ConstructAccelStructure(std::vector<std::shared_ptr<RTFacet>> primitives, AccelType accel_type,
+                                                                      BVHAccel::SplitMethod split, int bvh_width, const std::vector<double>& probabilities) {
+    auto makeAccel = [&](std::vector<std::shared_ptr<RTFacet>> facets) -> std::unique_ptr<RTPrimitive> {
+        switch (accel_type) {
+            case AccelType::KD:
+                return std::make_unique<KdTreeAccel>(std::move(facets), probabilities);
+            case AccelType::WideBVH:
+                return std::make_unique<BVHAccel>(std::move(facets), bvh_width, split, probabilities, wideBVHWidth, wideBVHFloatBounds);
+            case AccelType::BVH:
+            default:
+                return std::make_unique<BVHAccel>(std::move(facets), bvh_width, split, probabilities);
+        }
+    };
+    if (instancing) {
+        InstanceSet instanceSet = FindInstances(primitives, ConnectedFacetGroups(primitives));
+        if (instanceSet.HasRepetitions())
+            return std::make_unique<InstancedAccel>(std::move(instanceSet), makeAccel);
+    }
+    return makeAccel(std::move(primitives));
+}
+
+/**
+* \brief Checks that the built structures are wide BVHs if AccelType::WideBVH was chosen
+ * Instanced structures only come from ConstructAccelStructure(), which handles all types
+ */
+bool SimulationModel::IsAccelTypeBuilt(AccelType accel_type) const {
+    if (accel_type != AccelType::WideBVH)
+        return true;
+    for (const auto& accel : rayTracingStructures) {
+        if (dynamic_cast<InstancedAccel*>(accel.get()))
+            continue;
+        auto bvh = dynamic_cast<BVHAccel*>(accel.get());
+        if (!bvh || bvh->NodeWidth() == 2)
+            return false;
+    }
+    return true;
+}
+
+/**
+* \brief Refits the BVHs of all superstructures to the current facet bounding boxes
+ * The facets may be new objects (e.g. a model sent again after facets were moved) as long as each superstructure has the same globalIds
+ * A BVH whose quality degraded too much is rebuilt with its original settings, see BVHAccel::Refit()
+ * \param primitives facets of each superstructure
+ * \return error code: 0=no error, 1=a structure can't be refitted (kd-tree, instanced, none built or different facets), call BuildAccelStructure()
+ */
+int SimulationModel::RefitAccelStructure(const std::vector<std::vector<std::shared_ptr<RTFacet>>>& primitives) {
+    if (rayTracingStructures.empty() || rayTracingStructures.size() != primitives.size())
+        return 1;
+    for (const auto& accel : rayTracingStructures) {
+        if (!dynamic_cast<BVHAccel*>(accel.get()))
+            return 1;
+    }
+    for (size_t s = 0; s < rayTracingStructures.size(); s++) {
+        if (!static_cast<BVHAccel*>(rayTracingStructures[s].get())->ReplacePrimitives(primitives[s]))
+            return 1; //structures replaced so far are still consistent, just not refitted yet
+    }
+    for (const auto& accel : rayTracingStructures)
+        static_cast<BVHAccel*>(accel.get())->Refit();
+    return 0;
+}
+
+/**
+* \brief Rebuilds the accel structures of all superstructures with per-facet hit probabilities, keeping their type
+ * BVHs switch to ProbSplit, kd-trees weigh their split costs with the probabilities, instanced structures are kept as they are
+ * \param probabilities indexed by globalId, see HitCountsToProbabilities()
+ * \return error code: 0=no error, 1=no accel structure built yet, call BuildAccelStructure()
+ */
+int SimulationModel::RebuildAccelStructure(const std::vector<double>& probabilities) {
+    if (rayTracingStructures.empty())
+        return 1;
+    for (const auto& accel : rayTracingStructures) {
+        if (auto bvh = dynamic_cast<BVHAccel*>(accel.get()))
+            bvh->Rebuild(probabilities);
+        else if (auto kdTree = dynamic_cast<KdTreeAccel*>(accel.get()))
+            kdTree->Rebuild(probabilities);
+    }
+    return 0;
+}
+
 /**
 * \brief Initialises geometry properties that haven't been loaded from file
 * \return error code: 0=no error, 1=error
@@ -40,6 +160,7 @@ int SimulationModel::InitializeFacets() {
         // Current facet
         //SubprocessFacet *f = model->facets[i];
         CalculateFacetParams(&facet);
+        facet.InitPolyGrid();
 
         // Set some texture parameters
         // bool Facet::SetTexture(double width, double height, bool useMesh)
@@ -183,6 +304,9 @@ void SimulationModel::CalculateFacetParams(RTFacet* f) {
         p.v = (p.v - BBmin.v) / vD;
     }
 
+    // Pick the triangle or rectangle fast path if applicable
+    f->InitShape();
+
 #if defined(MOLFLOW)
     f->sh.maxSpeed = 4.0 * std::sqrt(2.0*8.31*f->sh.temperature / 0.001 / sp.gasMass);
 #endif
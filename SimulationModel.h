@@ -9,6 +9,7 @@
 #include <map>
 #include <string>
 #include <mutex>
+#include <tuple>
 
 class RTFacet;
 class GlobalSimuState;
@@ -81,8 +82,21 @@ public:
     virtual void PrepareToRun() = 0; //throws error
     virtual std::vector<std::string> SanityCheck()=0;
     // Molflow will use ParameterSurfaces (for parameter outgassing) for particular construction types
+    // Implementations (Molflow/Synrad models) must build through BuildRayTracingStructures(), otherwise AccelType::WideBVH and instancing have no effect
     virtual int BuildAccelStructure(const std::shared_ptr<GlobalSimuState> globalState, AccelType accel_type, BVHAccel::SplitMethod split,
                             int bvh_width) = 0;
+    // Replaces rayTracingStructures by one accel structure per superstructure, built by ConstructAccelStructure()
+    // Existing structures are refitted instead if only facet positions changed (don't clear them before calling)
+    int BuildRayTracingStructures(AccelType accel_type, BVHAccel::SplitMethod split, int bvh_width);
+    // False if a BuildAccelStructure() implementation ignored AccelType::WideBVH and built other structures
+    bool IsAccelTypeBuilt(AccelType accel_type) const;
+    // Constructs the accel structure of one superstructure
+    std::unique_ptr<RTPrimitive> ConstructAccelStructure(std::vector<std::shared_ptr<RTFacet>> primitives, AccelType accel_type,
+                            BVHAccel::SplitMethod split, int bvh_width, const std::vector<double>& probabilities = std::vector<double>{});
+    // Updates existing accel structures to the facets of each superstructure after they moved (call InitializeFacets() first)
+    int RefitAccelStructure(const std::vector<std::vector<std::shared_ptr<RTFacet>>>& primitives);
+    // Rebuilds existing accel structures with hit probabilities (e.g. from a pilot run), instead of BuildAccelStructure()
+    int RebuildAccelStructure(const std::vector<double>& probabilities);
 
     int InitializeFacets();
     void CalculateFacetParams(RTFacet *f);
@@ -123,6 +137,10 @@ public:
     std::vector<Vector3d> vertices3; // Vertices (3D space)
 
     std::vector<std::unique_ptr<RTPrimitive>> rayTracingStructures; //One raytracing rayTracingStructures. model per superstructure
+    std::tuple<AccelType, BVHAccel::SplitMethod, int, int, bool, bool> rayTracingSettings; //BuildRayTracingStructures() arguments and settings below, refit only if unchanged
+    int wideBVHWidth = 4; //Children per node (4 or 8) when AccelType::WideBVH is chosen
+    bool wideBVHFloatBounds = false; //Wide BVH child boxes stored as floats rounded outward, facet tests stay in double
+    bool instancing = false; //Repeated sub-geometries share one accel structure, placed by a top-level BVH (see InstancedAccel)
     std::map<double,std::shared_ptr<Surface>> surfaces; //Pair of opacity -> facet surface type
 
     // Simulation Properties
@@ -0,0 +1,239 @@
+
+
+#include "ThreadAffinity.h"
+#include "GLApp/GLTypes.h" //Error
+#include "Helper/StringHelper.h"
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif !defined(__MACOSX__) && !defined(__APPLE__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if !defined(_WIN32) && !defined(__MACOSX__) && !defined(__APPLE__)
+//! Reads a single integer from a sysfs file, -1 if not available
+static int ReadSysInt(const std::filesystem::path& path) {
+    std::ifstream file(path);
+    int value = -1;
+    if (!(file >> value)) return -1;
+    return value;
+}
+#endif
+
+CpuTopology CpuTopology::Detect() {
+    CpuTopology topology;
+
+#if defined(_WIN32) || defined(__MACOSX__) || defined(__APPLE__)
+    size_t nbCpus = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < nbCpus; i++) {
+        CpuInfo info;
+        info.cpu = info.core = static_cast<int>(i);
+        topology.cpus.push_back(info);
+    }
+#else
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool hasMask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    size_t nbCpus = hasMask ? CPU_SETSIZE : std::max(1u, std::thread::hardware_concurrency());
+
+    const std::filesystem::path cpuDir = "/sys/devices/system/cpu";
+    for (size_t i = 0; i < nbCpus; i++) {
+        if (hasMask && !CPU_ISSET(i, &allowed)) continue;
+        CpuInfo info;
+        info.cpu = static_cast<int>(i);
+        auto dir = cpuDir / fmt::format("cpu{}", i);
+        info.core = std::max(0, ReadSysInt(dir / "topology" / "core_id"));
+        info.package = std::max(0, ReadSysInt(dir / "topology" / "physical_package_id"));
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+            auto name = entry.path().filename().string();
+            if (name.rfind("node", 0) == 0 && name.size() > 4 && std::isdigit(static_cast<unsigned char>(name[4]))) {
+                info.node = std::stoi(name.substr(4));
+                break;
+            }
+        }
+        topology.cpus.push_back(info);
+    }
+#endif
+
+    //SMT index: order of the hardware thread among the CPUs sharing its core
+    std::set<std::pair<int, int>> cores;
+    std::set<int> packages, nodes;
+    for (auto& info : topology.cpus) {
+        auto core = std::make_pair(info.package, info.core);
+        info.smtIndex = static_cast<int>(std::count_if(topology.cpus.begin(), topology.cpus.end(), [&](const CpuInfo& other) {
+            return other.package == info.package && other.core == info.core && other.cpu < info.cpu;
+        }));
+        cores.insert(core);
+        packages.insert(info.package);
+        nodes.insert(info.node);
+    }
+    topology.nbCores = cores.size();
+    topology.nbPackages = packages.size();
+    topology.nbNodes = nodes.size();
+    return topology;
+}
+
+std::string CpuTopology::Describe() const {
+    return fmt::format("{} logical CPUs, {} cores, {} sockets, {} NUMA nodes", cpus.size(), nbCores, nbPackages, nbNodes);
+}
+
+ThreadAffinity ThreadAffinity::Parse(const std::string& arg) {
+    ThreadAffinity affinity;
+    if (arg.empty() || iequals(arg, "none")) return affinity;
+    if (iequals(arg, "compact")) {
+        affinity.mode = AffinityMode::Compact;
+        return affinity;
+    }
+    if (iequals(arg, "scatter")) {
+        affinity.mode = AffinityMode::Scatter;
+        return affinity;
+    }
+
+    //CPU list, ex. "0-3,8,10-11"
+    affinity.mode = AffinityMode::List;
+    for (const auto& token : SplitString(arg, ',')) {
+        try {
+            size_t dash = token.find('-');
+            int first = std::stoi(token.substr(0, dash));
+            int last = (dash == std::string::npos) ? first : std::stoi(token.substr(dash + 1));
+            if (first < 0 || last < first) throw std::invalid_argument(token);
+            for (int cpu = first; cpu <= last; cpu++) affinity.cpuList.push_back(cpu);
+        }
+        catch (const std::exception&) {
+            throw Error("Invalid thread affinity \"{}\": expected none, compact, scatter or a CPU list like 0-7,16-23", arg);
+        }
+    }
+    if (affinity.cpuList.empty()) {
+        throw Error("Invalid thread affinity \"{}\": empty CPU list", arg);
+    }
+    return affinity;
+}
+
+/**
+* \brief Assigns a CPU to each simulation thread
+ * Within a NUMA node, physical cores are used before their SMT siblings.
+ * Compact fills node after node, keeping consecutive threads (sharing a hit reduction group) on the same node; scatter alternates nodes.
+ * Threads beyond the number of CPUs wrap around.
+ */
+std::vector<int> ThreadAffinity::MapThreads(const CpuTopology& topology, size_t nbThreads) const {
+    std::vector<int> threadCpus;
+    if (mode == AffinityMode::None || topology.cpus.empty()) return threadCpus;
+
+    std::vector<int> order;
+    if (mode == AffinityMode::List) {
+        order = cpuList;
+    }
+    else {
+        auto cpus = topology.cpus;
+        std::sort(cpus.begin(), cpus.end(), [](const CpuInfo& a, const CpuInfo& b) {
+            return std::tie(a.node, a.smtIndex, a.package, a.core, a.cpu) < std::tie(b.node, b.smtIndex, b.package, b.core, b.cpu);
+        });
+        if (mode == AffinityMode::Compact) {
+            for (const auto& info : cpus) order.push_back(info.cpu);
+        }
+        else { //Scatter
+            std::vector<std::vector<int>> nodeCpus;
+            int lastNode = -1;
+            for (const auto& info : cpus) {
+                if (info.node != lastNode) {
+                    nodeCpus.emplace_back();
+                    lastNode = info.node;
+                }
+                nodeCpus.back().push_back(info.cpu);
+            }
+            for (size_t i = 0; order.size() < cpus.size(); i++) {
+                for (const auto& node : nodeCpus) {
+                    if (i < node.size()) order.push_back(node[i]);
+                }
+            }
+        }
+    }
+
+    threadCpus.resize(nbThreads);
+    for (size_t t = 0; t < nbThreads; t++) {
+        threadCpus[t] = order[t % order.size()];
+    }
+    return threadCpus;
+}
+
+std::string ThreadAffinity::ToString() const {
+    switch (mode) {
+    case AffinityMode::Compact:
+        return "compact";
+    case AffinityMode::Scatter:
+        return "scatter";
+    case AffinityMode::List: {
+        std::string list;
+        for (size_t i = 0; i < cpuList.size(); i++) {
+            list += (i ? "," : "") + std::to_string(cpuList[i]);
+        }
+        return list;
+    }
+    default:
+        return "none";
+    }
+}
+
+bool PinCurrentThread(int cpu) {
+#if defined(_WIN32)
+    if (cpu < 0 || cpu >= 64) return false; //single processor group only
+    return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) != 0;
+#elif defined(__MACOSX__) || defined(__APPLE__)
+    return false; //no thread pinning on macOS, only affinity hints
+#else
+    if (cpu < 0 || cpu >= CPU_SETSIZE) return false;
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(cpu, &cpuSet);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0;
+#endif
+}
+
+ScopedThreadPin::ScopedThreadPin(int cpu) {
+#if defined(_WIN32)
+    if (cpu < 0 || cpu >= 64) return; //single processor group only
+    DWORD_PTR previousMask = SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu);
+    if (previousMask == 0) return;
+    for (int i = 0; i < 64; i++) {
+        if (previousMask & (DWORD_PTR(1) << i)) previousCpus.push_back(i);
+    }
+    pinned = true;
+#elif defined(__MACOSX__) || defined(__APPLE__)
+    (void)cpu; //no thread pinning on macOS
+#else
+    cpu_set_t previousSet;
+    if (pthread_getaffinity_np(pthread_self(), sizeof(previousSet), &previousSet) != 0 || !PinCurrentThread(cpu)) return;
+    for (int i = 0; i < CPU_SETSIZE; i++) {
+        if (CPU_ISSET(i, &previousSet)) previousCpus.push_back(i);
+    }
+    pinned = true;
+#endif
+}
+
+ScopedThreadPin::~ScopedThreadPin() {
+    if (!pinned) return;
+#if defined(_WIN32)
+    DWORD_PTR previousMask = 0;
+    for (int cpu : previousCpus) previousMask |= DWORD_PTR(1) << cpu;
+    SetThreadAffinityMask(GetCurrentThread(), previousMask);
+#elif !defined(__MACOSX__) && !defined(__APPLE__)
+    cpu_set_t previousSet;
+    CPU_ZERO(&previousSet);
+    for (int cpu : previousCpus) CPU_SET(cpu, &previousSet);
+    pthread_setaffinity_np(pthread_self(), sizeof(previousSet), &previousSet);
+#endif
+}
@@ -0,0 +1,72 @@
+
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum class AffinityMode : uint8_t {
+    None, //Let the OS place threads
+    Compact, //Fill one NUMA node after the other
+    Scatter, //Round-robin over NUMA nodes
+    List //Explicit list of CPUs
+};
+
+//! A logical CPU available to the process
+struct CpuInfo {
+    int cpu = 0; //OS index
+    int core = 0; //physical core id within its package
+    int package = 0; //socket
+    int node = 0; //NUMA node
+    int smtIndex = 0; //0 for the first hardware thread of a core, 1 for its SMT sibling...
+};
+
+/**
+* \brief Logical CPUs the process may run on, with their core, socket and NUMA node
+ * Read from sysfs on Linux; elsewhere every CPU is reported as its own core on a single node
+ */
+struct CpuTopology {
+    std::vector<CpuInfo> cpus;
+    size_t nbCores = 0;
+    size_t nbPackages = 0;
+    size_t nbNodes = 0;
+
+    static CpuTopology Detect();
+    [[nodiscard]] std::string Describe() const;
+};
+
+/**
+* \brief Thread placement policy for the simulation threads
+ * Parsed from the CLI argument: "none", "compact", "scatter" or a CPU list such as "0-7,16-23"
+ */
+struct ThreadAffinity {
+    AffinityMode mode = AffinityMode::None;
+    std::vector<int> cpuList; //for AffinityMode::List
+
+    static ThreadAffinity Parse(const std::string& arg); //throws Error on invalid argument
+    [[nodiscard]] std::vector<int> MapThreads(const CpuTopology& topology, size_t nbThreads) const; //CPU of each thread, empty if threads aren't pinned
+    [[nodiscard]] std::string ToString() const;
+};
+
+bool PinCurrentThread(int cpu); //returns false if pinning failed or isn't supported
+
+/**
+* \brief Pins the calling thread to a CPU while in scope, then gives it back its previous affinity
+ * The master thread of an OpenMP parallel region is the calling thread itself, which must not stay pinned once the region is over
+ */
+class ScopedThreadPin {
+public:
+    ScopedThreadPin() = default; //pins nothing
+    explicit ScopedThreadPin(int cpu);
+    ~ScopedThreadPin();
+    ScopedThreadPin(const ScopedThreadPin&) = delete;
+    ScopedThreadPin& operator=(const ScopedThreadPin&) = delete;
+    ScopedThreadPin(ScopedThreadPin&& other) noexcept : pinned(other.pinned), previousCpus(std::move(other.previousCpus)) { other.pinned = false; }
+
+    [[nodiscard]] bool IsPinned() const { return pinned; }
+private:
+    bool pinned = false;
+    std::vector<int> previousCpus; //affinity to restore
+};
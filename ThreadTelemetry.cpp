@@ -0,0 +1,55 @@
+
+
+#include "ThreadTelemetry.h"
+#include "Helper/StringHelper.h"
+#include "GLApp/GLTypes.h" //Error
+
+#include <filesystem>
+#include <fstream>
+
+std::string TelemetryToJson(const std::vector<ThreadTelemetry>& telemetry, double time) {
+    std::string json = fmt::format("{{\"time\":{:.3f},\"threads\":[", time);
+    for (size_t i = 0; i < telemetry.size(); i++) {
+        const auto& t = telemetry[i];
+        json += fmt::format("{}{{\"thread\":{},\"raysTraced\":{},\"nodesVisited\":{},\"primitiveTests\":{},\"transparentPasses\":{},"
+            "\"rngDraws\":{},\"mergeWait\":{:.6f},\"mutexWait\":{:.6f},\"stepsPerSec\":{:.1f}}}",
+            i ? "," : "", t.threadNum, t.counts.raysTraced, t.counts.nodesVisited, t.counts.primitiveTests, t.counts.transparentPasses,
+            t.counts.rngDraws, t.counts.mergeWaitNs * 1.0e-9, t.counts.mutexWaitNs * 1.0e-9, t.stepsPerSec);
+    }
+    json += "]}";
+    return json;
+}
+
+std::string TelemetryCsvHeader() {
+    return "time,thread,raysTraced,nodesVisited,primitiveTests,transparentPasses,rngDraws,mergeWait,mutexWait,stepsPerSec";
+}
+
+std::string TelemetryToCsv(const std::vector<ThreadTelemetry>& telemetry, double time) {
+    std::string csv;
+    for (const auto& t : telemetry) {
+        csv += fmt::format("{:.3f},{},{},{},{},{},{},{:.6f},{:.6f},{:.1f}\n",
+            time, t.threadNum, t.counts.raysTraced, t.counts.nodesVisited, t.counts.primitiveTests, t.counts.transparentPasses,
+            t.counts.rngDraws, t.counts.mergeWaitNs * 1.0e-9, t.counts.mutexWaitNs * 1.0e-9, t.stepsPerSec);
+    }
+    return csv;
+}
+
+/**
+* \brief Appends a telemetry snapshot to a file, called periodically by simulation thread 0 (SimThreadHandle::AppendTelemetry())
+ * Writes JSON lines (one object per call) for a .json extension, CSV with a header on file creation otherwise
+ */
+void AppendTelemetryFile(const std::string& fileName, const std::vector<ThreadTelemetry>& telemetry, double time) {
+    bool json = iequals(std::filesystem::path(fileName).extension().string(), ".json");
+    bool newFile = !std::filesystem::exists(fileName);
+    std::ofstream file(fileName, std::ios::app);
+    if (!file.is_open()) {
+        throw Error("Couldn't open telemetry file {}", fileName);
+    }
+    if (json) {
+        file << TelemetryToJson(telemetry, time) << '\n';
+    }
+    else {
+        if (newFile) file << TelemetryCsvHeader() << '\n';
+        file << TelemetryToCsv(telemetry, time);
+    }
+}
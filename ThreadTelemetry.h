@@ -0,0 +1,95 @@
+
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+* \brief Plain event counts of the calling thread
+ * Incremented on the hot path (ray tracing, RNG) without any synchronization, and published to the thread's ThreadCounters after each simulation step
+ */
+struct TelemetryCounts {
+    uint64_t raysTraced = 0;
+    uint64_t nodesVisited = 0; //acceleration structure node bounds tested
+    uint64_t primitiveTests = 0; //facet intersection tests
+    uint64_t transparentPasses = 0; //transparent facet crossings registered by intersection tests
+    uint64_t rngDraws = 0;
+    uint64_t mergeWaitNs = 0; //time adding local hits to group/global counters
+    uint64_t mutexWaitNs = 0; //time blocked on procDataMutex
+};
+
+inline thread_local TelemetryCounts threadTelemetry;
+
+//! Locks mutex, accounting the time spent blocked to the calling thread's telemetry
+inline void LockTimed(std::mutex& mutex) {
+    if (mutex.try_lock()) return;
+    auto start = std::chrono::steady_clock::now();
+    mutex.lock();
+    threadTelemetry.mutexWaitNs += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+/**
+* \brief Published telemetry of one simulation thread, cumulated since the last reset
+ * Each thread has its own cache line, added to by the owner thread once per simulation step and read by anyone.
+ * Additions are atomic read-modify-writes, so that a Reset() from another thread is never overwritten by a concurrent Publish().
+ */
+struct alignas(64) ThreadCounters {
+    std::atomic<uint64_t> raysTraced{0};
+    std::atomic<uint64_t> nodesVisited{0};
+    std::atomic<uint64_t> primitiveTests{0};
+    std::atomic<uint64_t> transparentPasses{0};
+    std::atomic<uint64_t> rngDraws{0};
+    std::atomic<uint64_t> mergeWaitNs{0};
+    std::atomic<uint64_t> mutexWaitNs{0};
+    std::atomic<double> stepsPerSec{0.0};
+
+    //! Adds counts to the published counters and clears them, only to be called by the owner thread
+    void Publish(TelemetryCounts& counts) {
+        auto add = [](std::atomic<uint64_t>& counter, uint64_t value) {
+            counter.fetch_add(value, std::memory_order_relaxed);
+        };
+        add(raysTraced, counts.raysTraced);
+        add(nodesVisited, counts.nodesVisited);
+        add(primitiveTests, counts.primitiveTests);
+        add(transparentPasses, counts.transparentPasses);
+        add(rngDraws, counts.rngDraws);
+        add(mergeWaitNs, counts.mergeWaitNs);
+        add(mutexWaitNs, counts.mutexWaitNs);
+        counts = TelemetryCounts();
+    }
+
+    [[nodiscard]] TelemetryCounts Load() const {
+        TelemetryCounts counts;
+        counts.raysTraced = raysTraced.load(std::memory_order_relaxed);
+        counts.nodesVisited = nodesVisited.load(std::memory_order_relaxed);
+        counts.primitiveTests = primitiveTests.load(std::memory_order_relaxed);
+        counts.transparentPasses = transparentPasses.load(std::memory_order_relaxed);
+        counts.rngDraws = rngDraws.load(std::memory_order_relaxed);
+        counts.mergeWaitNs = mergeWaitNs.load(std::memory_order_relaxed);
+        counts.mutexWaitNs = mutexWaitNs.load(std::memory_order_relaxed);
+        return counts;
+    }
+
+    //! Clears the counters, may be called by any thread: counts published concurrently are either kept whole or cleared
+    void Reset() {
+        raysTraced = nodesVisited = primitiveTests = transparentPasses = rngDraws = mergeWaitNs = mutexWaitNs = 0;
+        stepsPerSec = 0.0;
+    }
+};
+
+//! Snapshot of a thread's telemetry, see SimulationManager::GetThreadTelemetry()
+struct ThreadTelemetry {
+    size_t threadNum = 0;
+    TelemetryCounts counts;
+    double stepsPerSec = 0.0;
+};
+
+std::string TelemetryToJson(const std::vector<ThreadTelemetry>& telemetry, double time); //single line JSON object
+std::string TelemetryCsvHeader();
+std::string TelemetryToCsv(const std::vector<ThreadTelemetry>& telemetry, double time); //one line per thread
+void AppendTelemetryFile(const std::string& fileName, const std::vector<ThreadTelemetry>& telemetry, double time); //JSON lines if .json, CSV otherwise
@@ -0,0 +1,332 @@
+
+
+#include "ZipStream.h"
+#include "GLApp/GLTypes.h" //Error
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <ziplib/Source/ZipLib/extlibs/zlib/zlib.h>
+
+constexpr uint32_t ZIP_LOCAL_HEADER_SIG = 0x04034b50;
+constexpr uint32_t ZIP_CENTRAL_HEADER_SIG = 0x02014b50;
+constexpr uint32_t ZIP_END_SIG = 0x06054b50;
+constexpr uint32_t ZIP64_END_SIG = 0x06064b50;
+constexpr uint32_t ZIP64_LOCATOR_SIG = 0x07064b50;
+constexpr uint64_t ZIP32_LIMIT = 0xFFFFFFFF; //sizes and offsets from here on are stored in the zip64 extra field
+constexpr uint16_t ZIP64_EXTRA_ID = 0x0001;
+constexpr size_t ZIP_READ_SIZE = 1 << 20; //compressed bytes read at once
+constexpr size_t ZIP_READ_AHEAD_CHUNKS = 3; //inflated chunks waiting for the consumer at most
+
+namespace {
+    uint16_t Get16(const uint8_t* p) {
+        return static_cast<uint16_t>(p[0] | (p[1] << 8));
+    }
+    uint32_t Get32(const uint8_t* p) {
+        return static_cast<uint32_t>(Get16(p)) | (static_cast<uint32_t>(Get16(p + 2)) << 16);
+    }
+    uint64_t Get64(const uint8_t* p) {
+        return static_cast<uint64_t>(Get32(p)) | (static_cast<uint64_t>(Get32(p + 4)) << 32);
+    }
+    //! Entry of a zip central directory, zip64 fields resolved
+    struct ZipEntryInfo {
+        std::string name;
+        uint16_t flags = 0;
+        uint16_t method = 0;
+        uint32_t crc = 0;
+        uint64_t compressedSize = 0;
+        uint64_t uncompressedSize = 0;
+        uint64_t localHeaderOffset = 0;
+    };
+
+    void ReadAt(std::ifstream& file, uint64_t offset, void* out, size_t size, const std::string& zipPath) {
+        file.seekg(static_cast<std::streamoff>(offset));
+        file.read(static_cast<char*>(out), static_cast<std::streamsize>(size));
+        if (!file || static_cast<size_t>(file.gcount()) != size) {
+            throw Error("Corrupt zip file {}: unexpected end of file", zipPath);
+        }
+    }
+
+    std::vector<ZipEntryInfo> ReadCentralDirectory(std::ifstream& file, const std::string& zipPath) {
+        file.seekg(0, std::ios::end);
+        const uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+        const size_t tailSize = static_cast<size_t>(std::min<uint64_t>(fileSize, 65535 + 22)); //end record and the longest comment
+        std::vector<uint8_t> tail(tailSize);
+        ReadAt(file, fileSize - tailSize, tail.data(), tailSize, zipPath);
+
+        size_t endPos = SIZE_MAX;
+        for (size_t i = tailSize >= 22 ? tailSize - 22 + 1 : 0; i-- > 0;) {
+            if (Get32(&tail[i]) == ZIP_END_SIG) {
+                endPos = i;
+                break;
+            }
+        }
+        if (endPos == SIZE_MAX) {
+            throw Error("{} is not a zip file", zipPath);
+        }
+        uint64_t nbEntries = Get16(&tail[endPos + 10]);
+        uint64_t directorySize = Get32(&tail[endPos + 12]);
+        uint64_t directoryOffset = Get32(&tail[endPos + 16]);
+        if (endPos >= 20 && Get32(&tail[endPos - 20]) == ZIP64_LOCATOR_SIG) {
+            uint8_t zip64End[56];
+            ReadAt(file, Get64(&tail[endPos - 20 + 8]), zip64End, sizeof(zip64End), zipPath);
+            if (Get32(zip64End) != ZIP64_END_SIG) {
+                throw Error("Corrupt zip file {}: zip64 end record not found", zipPath);
+            }
+            nbEntries = Get64(zip64End + 32);
+            directorySize = Get64(zip64End + 40);
+            directoryOffset = Get64(zip64End + 48);
+        }
+        if (directoryOffset > fileSize || directorySize > fileSize - directoryOffset) {
+            throw Error("Corrupt zip file {}: central directory out of the file", zipPath);
+        }
+
+        std::vector<uint8_t> directory(static_cast<size_t>(directorySize));
+        ReadAt(file, directoryOffset, directory.data(), directory.size(), zipPath);
+        std::vector<ZipEntryInfo> entries;
+        size_t pos = 0;
+        for (uint64_t e = 0; e < nbEntries; e++) {
+            if (pos + 46 > directory.size() || Get32(&directory[pos]) != ZIP_CENTRAL_HEADER_SIG) {
+                throw Error("Corrupt zip file {}: bad central directory entry {}", zipPath, e);
+            }
+            const uint8_t* header = &directory[pos];
+            const size_t nameLength = Get16(header + 28), extraLength = Get16(header + 30), commentLength = Get16(header + 32);
+            if (pos + 46 + nameLength + extraLength + commentLength > directory.size()) {
+                throw Error("Corrupt zip file {}: bad central directory entry {}", zipPath, e);
+            }
+            ZipEntryInfo entry;
+            entry.flags = Get16(header + 8);
+            entry.method = Get16(header + 10);
+            entry.crc = Get32(header + 16);
+            entry.compressedSize = Get32(header + 20);
+            entry.uncompressedSize = Get32(header + 24);
+            entry.localHeaderOffset = Get32(header + 42);
+            entry.name.assign(reinterpret_cast<const char*>(header + 46), nameLength);
+
+            // zip64 extra field: 8-byte values for the 32-bit fields set to 0xFFFFFFFF, in this order
+            const uint8_t* extra = header + 46 + nameLength;
+            for (size_t x = 0; x + 4 <= extraLength;) {
+                const uint16_t id = Get16(extra + x), size = Get16(extra + x + 2);
+                if (x + 4 + size > extraLength) break;
+                if (id == ZIP64_EXTRA_ID) {
+                    const uint8_t* field = extra + x + 4;
+                    const uint8_t* fieldEnd = field + size;
+                    for (uint64_t* value : {&entry.uncompressedSize, &entry.compressedSize, &entry.localHeaderOffset}) {
+                        if (*value == ZIP32_LIMIT && field + 8 <= fieldEnd) {
+                            *value = Get64(field);
+                            field += 8;
+                        }
+                    }
+                }
+                x += 4 + size;
+            }
+            entries.push_back(entry);
+            pos += 46 + nameLength + extraLength + commentLength;
+        }
+        return entries;
+    }
+}
+
+class ZipReaderBuf : public std::streambuf {
+public:
+    ZipReaderBuf(const std::string& zipPath, const std::string& entryName)
+        : zipPath(zipPath), start(std::chrono::steady_clock::now()) {
+        file.open(zipPath, std::ios::binary);
+        if (!file) {
+            throw Error("Cannot open file for reading ({})", zipPath);
+        }
+        const auto entries = ReadCentralDirectory(file, zipPath);
+        auto found = std::find_if(entries.begin(), entries.end(), [&](const ZipEntryInfo& e) { return e.name == entryName; });
+        if (found == entries.end()) {
+            throw Error("{} not found in {}", entryName, zipPath);
+        }
+        entry = *found;
+        if (entry.flags & 0x0001) {
+            throw Error("{} in {} is encrypted", entryName, zipPath);
+        }
+        if (entry.method != 0 && entry.method != Z_DEFLATED) {
+            throw Error("{} in {} uses compression method {}, only deflate is supported", entryName, zipPath, entry.method);
+        }
+        uint8_t localHeader[30];
+        ReadAt(file, entry.localHeaderOffset, localHeader, sizeof(localHeader), zipPath);
+        if (Get32(localHeader) != ZIP_LOCAL_HEADER_SIG) {
+            throw Error("Corrupt zip file {}: local header of {} not found", zipPath, entryName);
+        }
+        dataOffset = entry.localHeaderOffset + sizeof(localHeader) + Get16(localHeader + 26) + Get16(localHeader + 28);
+        producer = std::thread(&ZipReaderBuf::Produce, this);
+    }
+
+    ~ZipReaderBuf() override {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopRequested = true;
+        }
+        changed.notify_all();
+        producer.join();
+    }
+
+    ArchiveStats GetStats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+protected:
+    int_type underflow() override {
+        if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return !ready.empty() || finished; });
+        if (ready.empty()) {
+            if (error) std::rethrow_exception(error);
+            return traits_type::eof();
+        }
+        current = std::move(ready.front());
+        ready.pop_front();
+        lock.unlock();
+        changed.notify_all();
+        setg(current.data(), current.data(), current.data() + current.size());
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    // Background thread: reads and inflates the entry into chunks, until the end or a stop request
+    void Produce() {
+        z_stream zs{};
+        bool inflating = false;
+        try {
+            if (entry.method == Z_DEFLATED) {
+                if (inflateInit2(&zs, -MAX_WBITS) != Z_OK) {
+                    throw Error("Couldn't initialize zip decompression");
+                }
+                inflating = true;
+            }
+            file.seekg(static_cast<std::streamoff>(dataOffset));
+            std::vector<char> input(ZIP_READ_SIZE);
+            std::vector<char> output(ZIP_STREAM_CHUNK_SIZE);
+            size_t outputFill = 0;
+            uint64_t remaining = entry.compressedSize;
+            uint64_t produced = 0;
+            uLong crc = crc32(0L, Z_NULL, 0);
+            bool streamEnd = false;
+
+            auto readInput = [&]() -> size_t {
+                const size_t size = static_cast<size_t>(std::min<uint64_t>(input.size(), remaining));
+                file.read(input.data(), static_cast<std::streamsize>(size));
+                if (static_cast<size_t>(file.gcount()) != size) {
+                    throw Error("Corrupt zip file {}: {} is truncated", zipPath, entry.name);
+                }
+                remaining -= size;
+                return size;
+            };
+            auto publish = [&](bool force) -> bool { //false if the consumer is gone
+                if (outputFill < output.size() && !(force && outputFill > 0)) return true;
+                output.resize(outputFill);
+                crc = crc32(crc, reinterpret_cast<const Bytef*>(output.data()), static_cast<uInt>(output.size()));
+                produced += output.size();
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [this] { return ready.size() < ZIP_READ_AHEAD_CHUNKS || stopRequested; });
+                if (stopRequested) return false;
+                ready.push_back(std::move(output));
+                lock.unlock();
+                changed.notify_all();
+                output.assign(ZIP_STREAM_CHUNK_SIZE, 0);
+                outputFill = 0;
+                return true;
+            };
+
+            bool consumerGone = false;
+            if (!inflating) { //stored
+                while (remaining > 0 && !consumerGone) {
+                    const size_t size = static_cast<size_t>(std::min<uint64_t>(output.size() - outputFill, remaining));
+                    file.read(output.data() + outputFill, static_cast<std::streamsize>(size));
+                    if (static_cast<size_t>(file.gcount()) != size) {
+                        throw Error("Corrupt zip file {}: {} is truncated", zipPath, entry.name);
+                    }
+                    remaining -= size;
+                    outputFill += size;
+                    consumerGone = !publish(remaining == 0);
+                }
+                streamEnd = true;
+            }
+            while (inflating && !streamEnd && !consumerGone) {
+                if (zs.avail_in == 0) {
+                    if (remaining == 0) {
+                        throw Error("Corrupt zip file {}: {} is truncated", zipPath, entry.name);
+                    }
+                    zs.avail_in = static_cast<uInt>(readInput());
+                    zs.next_in = reinterpret_cast<Bytef*>(input.data());
+                }
+                zs.next_out = reinterpret_cast<Bytef*>(output.data() + outputFill);
+                zs.avail_out = static_cast<uInt>(output.size() - outputFill);
+                const int result = inflate(&zs, Z_NO_FLUSH);
+                outputFill = output.size() - zs.avail_out;
+                if (result == Z_STREAM_END) streamEnd = true;
+                else if (result != Z_OK && result != Z_BUF_ERROR) {
+                    throw Error("Corrupt zip file {}: {} can't be inflated (zlib error {})", zipPath, entry.name, result);
+                }
+                consumerGone = !publish(streamEnd);
+            }
+            if (inflating) inflateEnd(&zs);
+            inflating = false;
+
+            if (!consumerGone && (produced != entry.uncompressedSize || crc != entry.crc)) {
+                throw Error("Corrupt zip file {}: {} fails its size or CRC check", zipPath, entry.name);
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            stats.uncompressedBytes = produced;
+            stats.compressedBytes = entry.compressedSize;
+            stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        catch (...) {
+            if (inflating) inflateEnd(&zs);
+            std::lock_guard<std::mutex> lock(mutex);
+            error = std::current_exception();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = true;
+        }
+        changed.notify_all();
+    }
+
+    std::ifstream file;
+    std::string zipPath;
+    ZipEntryInfo entry;
+    uint64_t dataOffset = 0;
+    std::chrono::steady_clock::time_point start;
+
+    std::vector<char> current; //get area
+    std::mutex mutex; //guards the members below
+    std::condition_variable changed;
+    std::deque<std::vector<char>> ready; //inflated chunks, in entry order
+    bool finished = false;
+    bool stopRequested = false;
+    std::exception_ptr error;
+    ArchiveStats stats;
+    std::thread producer; //last, started once everything else is constructed
+};
+
+ZipEntryReader::ZipEntryReader(const std::string& zipPath, const std::string& entryName)
+    : std::istream(nullptr), buffer(std::make_unique<ZipReaderBuf>(zipPath, entryName)) {
+    rdbuf(buffer.get());
+    exceptions(std::ios::badbit); //corrupt data is thrown from the stream operations
+}
+
+ZipEntryReader::~ZipEntryReader() = default;
+
+ArchiveStats ZipEntryReader::GetStats() const {
+    return buffer->GetStats();
+}
+
+std::vector<std::string> ZipEntryReader::ListEntries(const std::string& zipPath) {
+    std::ifstream file(zipPath, std::ios::binary);
+    if (!file) {
+        throw Error("Cannot open file for reading ({})", zipPath);
+    }
+    std::vector<std::string> names;
+    for (const auto& entry : ReadCentralDirectory(file, zipPath)) names.push_back(entry.name);
+    return names;
+}
@@ -0,0 +1,39 @@
+
+
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+constexpr size_t ZIP_STREAM_CHUNK_SIZE = 4 << 20; //uncompressed bytes inflated at once
+
+//! Throughput of a finished ZipEntryReader
+struct ArchiveStats {
+	uint64_t uncompressedBytes = 0;
+	uint64_t compressedBytes = 0;
+	double seconds = 0.0;
+
+	double MBps() const { return seconds > 0.0 ? static_cast<double>(uncompressedBytes) / (1024.0 * 1024.0) / seconds : 0.0; }
+};
+
+class ZipReaderBuf;
+
+/**
+* \brief Input stream inflating an entry of a zip archive (deflated or stored, zip64 supported)
+ * A background thread reads and inflates ahead of the consumer, so parsing overlaps decompression. The CRC is checked at the end of the entry.
+ * Read errors throw Error from the stream operations (badbit exceptions are enabled).
+ */
+class ZipEntryReader : public std::istream {
+public:
+	ZipEntryReader(const std::string& zipPath, const std::string& entryName); //throws Error if the archive or the entry can't be opened
+	~ZipEntryReader() override;
+	ArchiveStats GetStats() const;
+
+	static std::vector<std::string> ListEntries(const std::string& zipPath); //throws Error
+
+private:
+	std::unique_ptr<ZipReaderBuf> buffer;
+};